@@ -73,7 +73,6 @@ struct Ent {
 };
 
 #define MAX_ENTS 2000
-#define NETBUF_SIZE 100
 static struct {
     bool generated;
     u64 start_time, last_render;
@@ -84,11 +83,20 @@ static struct {
 
     Login login;
     bqws_socket *ws;
-    struct { bqws_msg *msg; NetToClient ntc; } netbuf[NETBUF_SIZE];
+    Batch out; /* sent at the start of the next net_frame */
+    Scratch scratch; /* for arrays in the frame being handled */
+    Intern strings; /* the istrings the server has sent */
+    workers_Pool workers; /* for generating the map */
+    mapgen_Field map; /* what's where, on the whole map */
+#ifdef FORMPACK_STATS
+    /* what's been sent and received since the game started */
+    FormpackKindStats net_stats[FORMPACK_KIND_COUNT];
+#endif
 } game;
 #define ENT_STORE game.ents
 #include "ent.h"
 #include "ui.h"
+#include "tiles.h"
 
 // #define TEST_SERV
 /* when this is defined, a server is started in a
@@ -144,6 +152,10 @@ void init(void) {
 
     ui_init();
 
+    /* this thread helps too. with none started, it does all of it alone */
+    workers_start(&game.workers, thread_core_count() - 1, 0);
+    tiles_init(&game.workers);
+
     bqws_pt_init(NULL);
     game.ws = bqws_pt_connect("ws://localhost:80", NULL, NULL, NULL);
     /* sending the server a message should keep the connection alive long enough
@@ -151,7 +163,7 @@ void init(void) {
     NetToServer_AccountExists exists = {
         .user = string_from_nulterm(login.user_str),
     };
-    send_net_to_server_account_exists(exists, game.ws);
+    batch_net_to_server_account_exists(exists, &game.out, game.ws);
 
     game.start_time = stm_now();
     game.dt = 0.0;
@@ -168,23 +180,9 @@ void frame(void) {
     if (!game.generated) {
         {
             seed_simplex();
-            _ui.minimap = rendr_mapgen_tex(128, mapgen_minimap_img, NULL);
-
-            float tile_size = 40.0f / 200.0f;
-            /* works because tile_size is expressed as a portion of a 0..1 tile */
-            int tile_pixels = (int) ((200.0f * 16.0f) * tile_size);
-            mapgen_GroundOpts opts = {
-                .tile_corner = vec2f(0.5f - tile_size / 2.0f),
-                .tile_size = tile_size,
-                .height_map = malloc(pow(tile_pixels, 2)),
-            };
-            Ent *e = add_ent();
-            e->shape = Shape_GroundPlane;
-            e->scale = vec3f(40.0f);
-            sg_image img = rendr_mapgen_tex(tile_pixels, mapgen_ground_img, &opts);
-            e->img = full_sub_img(img);
-            e->height_img = rendr_make_height_img(opts.height_map, tile_pixels);
-            free(opts.height_map);
+            /* finer than the minimap, which is taken from it */
+            mapgen_field_cover(&game.map, vec2f(0.0f), 1.0f, 256, &game.workers);
+            _ui.minimap = rendr_mapgen_tex(128, mapgen_minimap_img, &game.map);
         }
         {
             Ent *e = add_ent();
@@ -195,7 +193,8 @@ void frame(void) {
     }
 
     if (game.ws) net_frame();
-    
+    tiles_frame(game.cam->pos);
+
     Vec3 cam = game.cam->pos;
     start_render(cam);
     for (Ent *e = 0; (e = ent_game_iter(e)); )
@@ -213,7 +212,18 @@ void frame(void) {
         input.keys_pressed[i] = false;
 }
 
+/* where each kind of message from the server goes */
+static NetToClientHandlers net_handlers = {
+    .account_status = login_on_account_status,
+    .account_bad_user = login_on_account_bad_user,
+    .account_bad_pass = login_on_account_bad_pass,
+    .account_trial_accept = login_on_account_trial_accept,
+    .account_login_accept = login_on_account_login_accept,
+    .account_server_error = login_on_account_server_error,
+};
+
 void net_frame(void) {
+    batch_flush(&game.out, game.ws);
     bqws_update(game.ws);
     bqws_msg *msg = NULL;
     while ((msg = bqws_recv(game.ws))) {
@@ -221,17 +231,13 @@ void net_frame(void) {
             printf("[Server]  %.*s", (int)msg->size, msg->data);
             bqws_free_msg(msg);
         } else if (msg->type == BQWS_MSG_BINARY) {
-            NetToClient ntc = unpack_net_to_client((u8 *) msg->data);
-            bool stored = false;
-            for (int i = 0; i < NETBUF_SIZE; i++)
-                if (game.netbuf[i].msg == NULL) {
-                    game.netbuf[i].ntc = ntc;
-                    game.netbuf[i].msg = msg;
-                    stored = true;
-                    break;
-                }
-            if (!stored) printf("netbuf filled!");
-            /* freed when consumed in netbuf */
+            scratch_reset(&game.scratch);
+            Reader r = frame_reader((u8 *) msg->data, msg->size, &game.scratch, &game.strings);
+            /* the messages before a bad one are still handled */
+            dispatch_net_to_client(&r, &net_handlers, NULL);
+            if (r.err != FormpackErr_None)
+                printf("bad message from server (%s)\n", formpack_err_str(r.err));
+            bqws_free_msg(msg);
         } else {
             printf("unknown message type?");
             bqws_free_msg(msg);
@@ -239,6 +245,14 @@ void net_frame(void) {
     }
 }
 
+#ifdef FORMPACK_STATS
+/* printed when F3 is pressed, and on the way out */
+void print_net_stats(void) {
+    formpack_stats_take(game.net_stats);
+    formpack_stats_print(stdout, game.net_stats);
+}
+#endif
+
 void event(const sapp_event *ev) {
     ui_event(ev);
 
@@ -261,6 +275,10 @@ void event(const sapp_event *ev) {
                 if (ev->key_code == SAPP_KEYCODE_ESCAPE)
                     sapp_request_quit();
             #endif
+            #ifdef FORMPACK_STATS
+                if (ev->key_code == SAPP_KEYCODE_F3)
+                    print_net_stats();
+            #endif
             if (!input.keys_down[(int) ev->key_code])
                 input.keys_pressed[(int) ev->key_code] = true;
             input.keys_down[(int) ev->key_code] = true;
@@ -278,6 +296,9 @@ void event(const sapp_event *ev) {
 
 
 void cleanup(void) {
+    #ifdef FORMPACK_STATS
+        print_net_stats();
+    #endif
     sfetch_shutdown();
     sg_shutdown();
 
@@ -504,12 +504,10 @@ sg_image end_offscreen(void) {
     return rendr.offscreen.img;
 }
 
-sg_image rendr_mapgen_tex(int size, void (*mapgen)(uint8_t *, int, void*), void *opts) {
-    int img_size = size * size * 4;
-    u8 *img = malloc(img_size);
-    mapgen(img, size, opts);
+/* uploads `size` by `size` pixels of rgba, generated by mapgen */
+sg_image rendr_make_mapgen_img(uint8_t *img, int size) {
     /* NOTE: https://github.com/floooh/sokol/issues/102 */
-    sg_image ret = sg_make_image_with_mipmaps(&(sg_image_desc) {
+    return sg_make_image_with_mipmaps(&(sg_image_desc) {
         .width = size,
         .height = size,
         .num_mipmaps = 1 + (int) floor(log2((f32) size)),
@@ -525,6 +523,13 @@ sg_image rendr_mapgen_tex(int size, void (*mapgen)(uint8_t *, int, void*), void
         },
         .label = "rendr_mapgen_tex",
     });
+}
+
+sg_image rendr_mapgen_tex(int size, void (*mapgen)(uint8_t *, int, void*), void *opts) {
+    int img_size = size * size * 4;
+    u8 *img = malloc(img_size);
+    mapgen(img, size, opts);
+    sg_image ret = rendr_make_mapgen_img(img, size);
     free(img);
     return ret;
 }
@@ -0,0 +1,252 @@
+/* the ground, as square chunks generated around the camera wherever it goes.
+   chunks are generated on the workers given to tiles_init, or a block a frame
+   on this thread if there are none, and uploaded a few a frame as they finish.
+   once they take up more than TILES_GPU_BUDGET, the ones that have gone longest
+   without being near the camera are let go of. */
+
+/* the map, mapgen's 0..1, is this many world units across, centered on the origin */
+#define TILES_MAP_SIZE 200.0f
+#define TILES_CHUNK_SIZE 16.0f /* world units across a chunk */
+#define TILES_CHUNK_PIXELS 256 /* 16 a world unit */
+/* pixels generated past each edge of a chunk and then cut off,
+   so its blur takes in its neighbours' pixels and leaves no seams */
+#define TILES_APRON 4
+/* with no workers, this many pixels square of a chunk are generated a frame,
+   each with its own apron, so no one frame takes the whole chunk's time */
+#define TILES_BLOCK_PIXELS 64
+#define TILES_BLOCKS (TILES_CHUNK_PIXELS / TILES_BLOCK_PIXELS) /* a side */
+/* how many chunks out from the camera's are wanted */
+#define TILES_RADIUS 2
+#define TILES_MAX_CHUNKS 48
+#define TILES_GPU_BUDGET (16 << 20)
+/* making an upload's mipmaps happens on this thread, so only so many a frame */
+#define TILES_UPLOADS_PER_FRAME 2
+/* how deep the heights go, as they were when the ground was one 40 unit tile */
+#define TILES_HEIGHT_SCALE 40.0f
+
+typedef enum {
+    Chunk_Free,
+    Chunk_Generating, /* on a worker, or a block a frame on this thread */
+    Chunk_Generated, /* waiting to be uploaded */
+    Chunk_Uploaded,
+} ChunkState;
+
+typedef struct {
+    ChunkState state; /* written by a worker when it's done, so only touched under tiles.lock */
+    int x, z; /* covers world x, z from x * TILES_CHUNK_SIZE, z * TILES_CHUNK_SIZE */
+    u64 last_wanted; /* the last frame it was near the camera */
+    u8 *pixels, *heights; /* while it's generated, until they're uploaded */
+    int blocks_done; /* of those generated on this thread */
+    Ent *ent;
+} Chunk;
+
+static struct {
+    Chunk chunks[TILES_MAX_CHUNKS];
+    Mutex lock;
+    workers_Pool *workers;
+    /* each chunk's state as of the start of the frame, and the main thread's
+       own changes since. it goes by these, as workers can be finishing chunks */
+    ChunkState seen[TILES_MAX_CHUNKS];
+    u64 frame;
+    size_t gpu_bytes;
+} tiles;
+
+/* `workers` generate the chunks, or this thread does if it's NULL or empty */
+void tiles_init(workers_Pool *workers) {
+    mutex_init(&tiles.lock);
+    tiles.workers = workers;
+}
+
+/* where a point in the world is on mapgen's map.
+   world z goes up the ground's texture, and the map's y down it */
+INLINE Vec2 tiles_map_pos(Vec2 world_xz) {
+    return vec2(0.5f + world_xz.x / TILES_MAP_SIZE,
+                0.5f - world_xz.y / TILES_MAP_SIZE);
+}
+
+/* generates the `n` by `n` pixels of `c` from `x`, `y`, and its heights from
+   there to one past them. the image is generated past each edge by the apron,
+   then cut down, so the blur takes in the pixels on the other side */
+void _tiles_generate_block(Chunk *c, int x, int y, int n) {
+    int size = n + TILES_APRON * 2;
+    f32 pixel = TILES_CHUNK_SIZE / TILES_CHUNK_PIXELS;
+
+    /* the top left of the image is the block's far left corner, past the apron */
+    Vec2 corner = vec2(c->x * TILES_CHUNK_SIZE + (x - TILES_APRON) * pixel,
+                       (c->z + 1) * TILES_CHUNK_SIZE - (y - TILES_APRON) * pixel);
+    u8 *img = malloc(size * size * 4), *heights = malloc(size * size);
+    mapgen_ground_img(img, size, &(mapgen_GroundOpts) {
+        .tile_corner = tiles_map_pos(corner),
+        .tile_size = size * pixel / TILES_MAP_SIZE,
+        .height_map = heights,
+    });
+
+    /* heights go one further, onto the next block's first row and column,
+       so where two blocks or chunks meet they're at the same height */
+    int stride = TILES_CHUNK_PIXELS;
+    for (int row = 0; row < n; row++)
+        memcpy(c->pixels + ((y + row) * stride + x) * 4,
+               img + ((row + TILES_APRON) * size + TILES_APRON) * 4, n * 4);
+    for (int row = 0; row < n + 1; row++)
+        memcpy(c->heights + (y + row) * (stride + 1) + x,
+               heights + (row + TILES_APRON) * size + TILES_APRON, n + 1);
+    free(img);
+    free(heights);
+}
+
+/* runs on a worker */
+void _tiles_generate(void *arg) {
+    Chunk *c = arg;
+    _tiles_generate_block(c, 0, 0, TILES_CHUNK_PIXELS);
+
+    mutex_lock(&tiles.lock);
+    c->state = Chunk_Generated;
+    mutex_unlock(&tiles.lock);
+}
+
+/* the main thread's changes to a chunk's state */
+void _tiles_set_state(Chunk *c, ChunkState state) {
+    tiles.seen[c - tiles.chunks] = state;
+    mutex_lock(&tiles.lock);
+    c->state = state;
+    mutex_unlock(&tiles.lock);
+}
+
+/* the most gpu memory a chunk takes up, its texture's mipmaps and all */
+INLINE size_t _tiles_chunk_bytes(void) {
+    size_t bytes = (TILES_CHUNK_PIXELS + 1) * (TILES_CHUNK_PIXELS + 1);
+    for (int s = TILES_CHUNK_PIXELS; s > 0; s /= 2) bytes += s * s * 4;
+    return bytes;
+}
+
+Chunk *_tiles_find(int x, int z) {
+    for (int i = 0; i < TILES_MAX_CHUNKS; i++) {
+        Chunk *c = &tiles.chunks[i];
+        if (tiles.seen[i] != Chunk_Free && c->x == x && c->z == z) return c;
+    }
+    return NULL;
+}
+
+/* lets go of the uploaded chunk that's gone longest without being wanted,
+   and isn't this frame. returns false if there isn't one */
+bool _tiles_evict(void) {
+    Chunk *lru = NULL;
+    for (int i = 0; i < TILES_MAX_CHUNKS; i++) {
+        Chunk *c = &tiles.chunks[i];
+        if (tiles.seen[i] == Chunk_Uploaded && c->last_wanted < tiles.frame &&
+            (!lru || c->last_wanted < lru->last_wanted))
+            lru = c;
+    }
+    if (!lru) return false;
+
+    sg_destroy_image(lru->ent->img.src);
+    sg_destroy_image(lru->ent->height_img);
+    take_ent_prop(lru->ent, EntProp_Active);
+    tiles.gpu_bytes -= _tiles_chunk_bytes();
+    _tiles_set_state(lru, Chunk_Free);
+    return true;
+}
+
+void _tiles_upload(Chunk *c) {
+    int n = TILES_CHUNK_PIXELS;
+    Ent *e = c->ent = add_ent();
+    e->shape = Shape_GroundPlane;
+    e->pos = vec3((c->x + 0.5f) * TILES_CHUNK_SIZE, 0.0f, (c->z + 0.5f) * TILES_CHUNK_SIZE);
+    e->scale = vec3(TILES_CHUNK_SIZE, TILES_HEIGHT_SCALE, TILES_CHUNK_SIZE);
+    e->img = full_sub_img(rendr_make_mapgen_img(c->pixels, n));
+    e->height_img = rendr_make_height_img(c->heights, n + 1);
+    free(c->pixels);
+    free(c->heights);
+
+    _tiles_set_state(c, Chunk_Uploaded);
+    tiles.gpu_bytes += _tiles_chunk_bytes();
+}
+
+/* a chunk to generate into, letting go of one if they're all taken.
+   NULL if every one is still wanted or being worked on */
+Chunk *_tiles_free_chunk(void) {
+    do {
+        for (int i = 0; i < TILES_MAX_CHUNKS; i++)
+            if (tiles.seen[i] == Chunk_Free) return &tiles.chunks[i];
+    } while (_tiles_evict());
+    return NULL;
+}
+
+/* called every frame, to have the chunks around `cam` generated and drawn */
+void tiles_frame(Vec3 cam) {
+    tiles.frame++;
+
+    /* picks up the chunks the workers have finished since last frame */
+    mutex_lock(&tiles.lock);
+    for (int i = 0; i < TILES_MAX_CHUNKS; i++) tiles.seen[i] = tiles.chunks[i].state;
+    mutex_unlock(&tiles.lock);
+
+    int generating = 0;
+    Chunk *generated[TILES_MAX_CHUNKS];
+    int generated_count = 0;
+    for (int i = 0; i < TILES_MAX_CHUNKS; i++) {
+        generating += tiles.seen[i] == Chunk_Generating;
+        if (tiles.seen[i] == Chunk_Generated) generated[generated_count++] = &tiles.chunks[i];
+    }
+
+    /* every chunk that's wanted is marked before any can be evicted */
+    int cam_x = (int) floorf(cam.x / TILES_CHUNK_SIZE),
+        cam_z = (int) floorf(cam.z / TILES_CHUNK_SIZE);
+    for (int dz = -TILES_RADIUS; dz <= TILES_RADIUS; dz++)
+    for (int dx = -TILES_RADIUS; dx <= TILES_RADIUS; dx++) {
+        Chunk *c = _tiles_find(cam_x + dx, cam_z + dz);
+        if (c) c->last_wanted = tiles.frame;
+    }
+
+    /* without any workers, they're generated here, a block a frame */
+    int threads = tiles.workers ? tiles.workers->thread_count : 0;
+    int max_generating = max(1, threads);
+    /* set once as many are being generated as can be, or no chunk is free */
+    bool full = generating >= max_generating;
+    /* asked for in rings going out, so the nearest are done first */
+    for (int ring = 0; ring <= TILES_RADIUS && !full; ring++)
+    for (int dz = -ring; dz <= ring && !full; dz++)
+    for (int dx = -ring; dx <= ring && !full; dx++) {
+        if (max(abs(dx), abs(dz)) != ring) continue;
+        if (_tiles_find(cam_x + dx, cam_z + dz)) continue;
+
+        Chunk *c = _tiles_free_chunk();
+        if (!c) {
+            full = true;
+            continue;
+        }
+        c->x = cam_x + dx, c->z = cam_z + dz;
+        c->last_wanted = tiles.frame;
+        c->pixels = malloc(TILES_CHUNK_PIXELS * TILES_CHUNK_PIXELS * 4);
+        c->heights = malloc((TILES_CHUNK_PIXELS + 1) * (TILES_CHUNK_PIXELS + 1));
+        c->blocks_done = 0;
+        _tiles_set_state(c, Chunk_Generating);
+        full = ++generating >= max_generating;
+        if (threads) workers_submit(tiles.workers, _tiles_generate, c);
+    }
+
+    if (threads == 0)
+        for (int i = 0; i < TILES_MAX_CHUNKS; i++) {
+            Chunk *c = &tiles.chunks[i];
+            if (tiles.seen[i] != Chunk_Generating) continue;
+            int b = c->blocks_done++;
+            _tiles_generate_block(c, b % TILES_BLOCKS * TILES_BLOCK_PIXELS,
+                                     b / TILES_BLOCKS * TILES_BLOCK_PIXELS, TILES_BLOCK_PIXELS);
+            if (c->blocks_done == TILES_BLOCKS * TILES_BLOCKS) _tiles_set_state(c, Chunk_Generated);
+            break;
+        }
+
+    /* the nearest first */
+    int uploads = 0;
+    for (int ring = 0; ring <= TILES_RADIUS + 1 && uploads < TILES_UPLOADS_PER_FRAME; ring++)
+    for (int i = 0; i < generated_count && uploads < TILES_UPLOADS_PER_FRAME; i++) {
+        Chunk *c = generated[i];
+        int dist = max(abs(c->x - cam_x), abs(c->z - cam_z));
+        if (tiles.seen[c - tiles.chunks] != Chunk_Generated || min(dist, TILES_RADIUS + 1) != ring)
+            continue;
+        _tiles_upload(c);
+        uploads++;
+    }
+
+    while (tiles.gpu_bytes > TILES_GPU_BUDGET && _tiles_evict());
+}
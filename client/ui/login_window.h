@@ -13,6 +13,7 @@ typedef struct {
     char pass_str[128], bad_pass_reason[256], confirm_pass_str[256],
          user_str[128], bad_user_reason[256], server_error_str[256];
     int skip_tutorial, show_pass; /* booleans typed as ints for mu compat */
+    bool close_window;
 } LoginWindow;
 static LoginWindow login;
 /* if confirm is enabled, returns true if "confirm password" input matches original */
@@ -56,73 +57,66 @@ bool password_input(mu_Context *ctx, bool confirm) {
 
     return pass_match;
 }
+
+/* handlers for the server's replies, see net_handlers */
+void login_on_account_status(void *ctx, NetToClient_AccountStatus *msg) {
+    (void) ctx;
+    String user = string_from_nulterm(login.user_str);
+    if (!string_eq(&user, &msg->user)) return;
+    if (game.login != Login_User) return;
+
+    game.login = msg->exists ? Login_Exists : Login_Available;
+}
+
+void login_on_account_bad_user(void *ctx, NetToClient_AccountBadUser *msg) {
+    (void) ctx;
+    String user = string_from_nulterm(login.user_str);
+    if (game.login != Login_User) return;
+    if (!string_eq(&user, &msg->user)) return;
+
+    strncpy(login.bad_user_reason, msg->reason.str, msg->reason.len);
+    login.bad_user_reason[msg->reason.len] = '\0';
+}
+
+void login_on_account_bad_pass(void *ctx, NetToClient_AccountBadPass *msg) {
+    (void) ctx;
+    String pass = string_from_nulterm(login.pass_str);
+    if (!(game.login == Login_Pass
+          || game.login == Login_Register)) return;
+    if (!string_eq(&pass, &msg->pass)) return;
+
+    strncpy(login.bad_pass_reason, msg->reason.str, msg->reason.len);
+    login.bad_pass_reason[msg->reason.len] = '\0';
+}
+
+void login_on_account_trial_accept(void *ctx, NetToClient_AccountTrialAccept *msg) {
+    (void) ctx;
+    game.login = Login_Trial;
+    /* the window's closed next time it's drawn */
+    login.close_window = true;
+    strncpy(login.user_str, msg->user.str, msg->user.len);
+}
+
+void login_on_account_login_accept(void *ctx, NetToClient_AccountLoginAccept *msg) {
+    (void) ctx;
+    game.login = Login_Done;
+    strncpy(login.user_str, msg->user.str, msg->user.len);
+}
+
+void login_on_account_server_error(void *ctx, NetToClient_AccountServerError *msg) {
+    (void) ctx;
+    game.login = Login_ServerError;
+    strncpy(login.server_error_str, msg->desc.str, msg->desc.len);
+}
+
 void _login_window(mu_Context *ctx) {
     char *title = "Login/Signup";
     mu_Container *window = mu_get_container(ctx, title);
-
-    for (int i = 0; i < NETBUF_SIZE; i++) if (game.netbuf[i].msg) {
-        NetToClient *ntc = &game.netbuf[i].ntc;
-        bool consume = true;
-        String user = string_from_nulterm(login.user_str),
-               pass = string_from_nulterm(login.pass_str);
-
-        String *reason;
-        switch (ntc->kind) {
-        case (NetToClientKind_AccountStatus):;
-            if (!string_eq(&user, &ntc->account_status.user)) break;
-            if (game.login != Login_User) break;
-
-            game.login = ntc->account_status.exists ? Login_Exists : Login_Available;
-            break;
-        case (NetToClientKind_AccountBadUser):;
-            String *bad_user = &ntc->account_bad_user.user;
-            reason = &ntc->account_bad_user.reason;
-
-            if (game.login != Login_User) break;
-            if (!string_eq(&user, bad_user)) break;
-
-            strncpy(login.bad_user_reason, reason->str, reason->len);
-            login.bad_user_reason[reason->len] = '\0';
-            break;
-        case (NetToClientKind_AccountBadPass):;
-            String *bad_pass = &ntc->account_bad_pass.pass;
-            reason = &ntc->account_bad_pass.reason;
-
-            if (!(game.login == Login_Pass
-                  || game.login == Login_Register)) break;
-            if (!string_eq(&pass, bad_pass)) break;
-
-            strncpy(login.bad_pass_reason, reason->str, reason->len);
-            login.bad_pass_reason[reason->len] = '\0';
-            break;
-        case (NetToClientKind_AccountTrialAccept):;
-            game.login = Login_Trial;
-            window->open = 0;
-            strncpy(login.user_str,
-                    ntc->account_trial_accept.user.str,
-                    ntc->account_trial_accept.user.len);
-            break;
-        case (NetToClientKind_AccountLoginAccept):;
-            game.login = Login_Done;
-            strncpy(login.user_str,
-                    ntc->account_login_accept.user.str,
-                    ntc->account_login_accept.user.len);
-            break;
-        case (NetToClientKind_AccountServerError):;
-            game.login = Login_ServerError;
-            strncpy(login.server_error_str,
-                    ntc->account_server_error.desc.str,
-                    ntc->account_server_error.desc.len);
-            break;
-        /* whoops, you're not one of ours! */
-        default: consume = false; break;
-        }
-
-        if (consume) {
-            bqws_free_msg(game.netbuf[i].msg);
-            game.netbuf[i].msg = NULL;
-        }
+    if (login.close_window) {
+        login.close_window = false;
+        window->open = 0;
     }
+
     if (game.login == Login_Done) return;
     if (game.login == Login_Trial || !window->open) {
         int opt = MU_OPT_AUTOSIZE | MU_OPT_NORESIZE |
@@ -163,7 +157,7 @@ void _login_window(mu_Context *ctx) {
             NetToServer_AccountExists exists = {
                 .user = string_from_nulterm(login.user_str),
             };
-            send_net_to_server_account_exists(exists, game.ws);
+            batch_net_to_server_account_exists(exists, &game.out, game.ws);
             login.bad_user_reason[0] = '\0';
         }
         char input_user_label[400] = "Username";
@@ -189,7 +183,7 @@ void _login_window(mu_Context *ctx) {
                     .user = string_from_nulterm(login.user_str),
                     .pass = string_from_nulterm(login.pass_str),
                 };
-                send_net_to_server_account_login(log, game.ws);
+                batch_net_to_server_account_login(log, &game.out, game.ws);
             }
         }
         if (game.login == Login_Available) {
@@ -199,7 +193,7 @@ void _login_window(mu_Context *ctx) {
                 NetToServer_AccountTrial trial = {
                     .user = string_from_nulterm(login.user_str),
                 };
-                send_net_to_server_account_trial(trial, game.ws);
+                batch_net_to_server_account_trial(trial, &game.out, game.ws);
             }
 
             if (mu_button(ctx, "Finish Signing up")) {
@@ -214,7 +208,7 @@ void _login_window(mu_Context *ctx) {
                     .user = string_from_nulterm(login.user_str),
                     .pass = string_from_nulterm(login.pass_str),
                 };
-                send_net_to_server_account_register(reg, game.ws);
+                batch_net_to_server_account_register(reg, &game.out, game.ws);
             }
         }
 
@@ -18,11 +18,16 @@
 
 #include <string.h>
 #include "math.h"
+#include "lz.h"
+#include "thread.h"
+#include "workers.h"
 #include "mapgen.h"
 
+/* the biggest message formpack will pack, or accept in a compressed frame */
+#define FORMPACK_MAX_SIZE (1 << 20)
 typedef struct {
     uint8_t *data;
-    uint16_t size;
+    uint32_t size;
 } Pack;
 
 typedef struct {
@@ -44,6 +49,124 @@ INLINE bool string_eq(String *a, String *b) {
     return true;
 }
 
+/* why a received message couldn't be decoded */
+typedef enum {
+    FormpackErr_None,
+    FormpackErr_Truncated, /* ended partway through a value */
+    FormpackErr_BadKind, /* names a variant that doesn't exist */
+    FormpackErr_BadValue, /* has a value its type can't hold, e.g. a bool of 2 */
+    FormpackErr_TrailingBytes, /* has bytes left over after the message */
+} FormpackErr;
+
+INLINE const char *formpack_err_str(FormpackErr err) {
+    switch (err) {
+    case (FormpackErr_None): return "no error";
+    case (FormpackErr_Truncated): return "truncated";
+    case (FormpackErr_BadKind): return "unknown kind";
+    case (FormpackErr_BadValue): return "bad value";
+    case (FormpackErr_TrailingBytes): return "trailing bytes";
+    }
+    return "unknown error";
+}
+
+/* memory for decoded arrays, handed out a bump at a time until it's reset.
+   it grows as it needs to, and keeps its biggest block across resets,
+   so one that's reused for every message soon stops calling malloc. */
+typedef struct _ScratchBlock {
+    struct _ScratchBlock *prev;
+    size_t cap;
+} _ScratchBlock;
+/* keeps what's handed out after a block header suitably aligned */
+#define SCRATCH_HEADER ((sizeof(_ScratchBlock) + 15) & ~(size_t) 15)
+typedef struct {
+    _ScratchBlock *block;
+    size_t used;
+} Scratch;
+
+INLINE void *scratch_alloc(Scratch *s, size_t size) {
+    size = (size + 15) & ~(size_t) 15;
+    if (s->block == NULL || s->block->cap - s->used < size) {
+        size_t cap = s->block ? s->block->cap * 2 : 4096;
+        if (cap < size) cap = size;
+        _ScratchBlock *block = malloc(SCRATCH_HEADER + cap);
+        *block = (_ScratchBlock) { .prev = s->block, .cap = cap };
+        s->block = block, s->used = 0;
+    }
+    void *mem = (uint8_t *) s->block + SCRATCH_HEADER + s->used;
+    s->used += size;
+    return mem;
+}
+
+/* frees up everything handed out so far */
+INLINE void scratch_reset(Scratch *s) {
+    /* blocks double, so the newest one is the biggest */
+    while (s->block && s->block->prev) {
+        _ScratchBlock *prev = s->block->prev;
+        s->block->prev = prev->prev;
+        free(prev);
+    }
+    s->used = 0;
+}
+
+/* the strings recently sent one way over a connection, each end keeping
+   its own copy, so that an istring seen lately can be sent as its slot.
+   a string is added to the next slot round as it's first sent or received,
+   pushing out whatever was there, so both copies always match as long as
+   they see the same istrings in the same order. */
+#define INTERN_SLOTS 32
+#define INTERN_MAX_LEN 31 /* longer strings are always sent in full */
+typedef struct {
+    char strs[INTERN_SLOTS][INTERN_MAX_LEN];
+    uint8_t lens[INTERN_SLOTS];
+    uint8_t next, count;
+} Intern;
+
+INLINE int intern_find(Intern *in, String *s) {
+    for (int i = 0; i < in->count; i++)
+        if (in->lens[i] == s->len && memcmp(in->strs[i], s->str, s->len) == 0)
+            return i;
+    return -1;
+}
+
+INLINE void intern_add(Intern *in, String *s) {
+    memcpy(in->strs[in->next], s->str, s->len);
+    in->lens[in->next] = s->len;
+    in->next = (in->next + 1) % INTERN_SLOTS;
+    if (in->count < INTERN_SLOTS) in->count++;
+}
+
+/* reads values out of a received message, never past its end.
+   the first error sticks, and once there is one every read gives back
+   zeroes, so decoders only need to check `err` once they're done. */
+typedef struct {
+    uint8_t *at, *end;
+    FormpackErr err;
+    Scratch *scratch; /* where arrays are decoded to */
+    Intern *intern; /* istrings received so far on the connection, if kept */
+} Reader;
+
+INLINE void reader_fail(Reader *r, FormpackErr err) {
+    if (r->err == FormpackErr_None) r->err = err;
+    r->at = r->end;
+}
+
+/* returns the next `len` bytes and skips past them,
+   or NULL if there aren't that many left */
+INLINE uint8_t *reader_take(Reader *r, size_t len) {
+    if ((size_t) (r->end - r->at) < len) {
+        reader_fail(r, FormpackErr_Truncated);
+        return NULL;
+    }
+    uint8_t *bytes = r->at;
+    r->at += len;
+    return bytes;
+}
+
+INLINE uint8_t reader_byte(Reader *r) {
+    uint8_t *b = reader_take(r, 1);
+    return b ? *b : 0;
+}
+
 int16_t encoded_size_string(String *s) {
     return 1 + s->len;
 }
@@ -52,10 +175,11 @@ uint8_t *encode_string(uint8_t *data, String *s) {
     for (uint8_t i = 0; i < s->len; i++) *data++ = s->str[i];
     return data;
 }
-String decode_string(uint8_t **src) {
-    uint8_t len = *(*src)++;
-    char *data = (char *) *src;
-    *src += len;
+/* the String points into the message, so it lives as long as that does */
+String decode_string(Reader *r) {
+    uint8_t len = reader_byte(r);
+    char *data = (char *) reader_take(r, len);
+    if (data == NULL) return (String) { .len = 0, .str = "" };
     return (String) { .len = len, .str = data };
 }
 
@@ -68,8 +192,9 @@ uint8_t *encode_uint16_t(uint8_t *data, uint16_t *u) {
     *data++ = (uint8_t) (*u >> 8);
     return data;
 }
-uint16_t decode_uint16_t(uint8_t **data) {
-    return (uint8_t) *(*data)++ | (uint8_t)(*(*data)++ << 8);
+uint16_t decode_uint16_t(Reader *r) {
+    uint8_t *b = reader_take(r, 2);
+    return b ? (uint16_t) (b[0] | (b[1] << 8)) : 0;
 }
 
 uint16_t encoded_size_bool(bool *b) {
@@ -80,8 +205,344 @@ uint8_t *encode_bool(uint8_t *data, bool *b) {
     *data++ = (uint8_t) *b;
     return data;
 }
-bool decode_bool(uint8_t **data) {
-    return (bool) *(*data)++;
+bool decode_bool(Reader *r) {
+    uint8_t b = reader_byte(r);
+    if (b > 1) reader_fail(r, FormpackErr_BadValue);
+    return b == 1;
+}
+
+uint16_t encoded_size_f32(f32 *x) {
+    (void) x;
+    return 4;
+}
+uint8_t *encode_f32(uint8_t *data, f32 *x) {
+    uint32_t bits;
+    memcpy(&bits, x, 4);
+    for (int i = 0; i < 4; i++) *data++ = (uint8_t) (bits >> (i * 8));
+    return data;
+}
+f32 decode_f32(Reader *r) {
+    uint8_t *b = reader_take(r, 4);
+    if (b == NULL) return 0.0f;
+    uint32_t bits = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+    f32 x;
+    memcpy(&x, &bits, 4);
+    return x;
+}
+
+/* LEB128: seven bits a byte, low bits first, the top bit set on all but the
+   last byte. small numbers, which most are, take up a byte or two. */
+INLINE uint16_t encoded_size_varint(uint64_t x) {
+    uint16_t len = 1;
+    while (x >= 0x80) x >>= 7, len++;
+    return len;
+}
+INLINE uint8_t *encode_varint(uint8_t *data, uint64_t x) {
+    while (x >= 0x80) {
+        *data++ = (uint8_t) (x | 0x80);
+        x >>= 7;
+    }
+    *data++ = (uint8_t) x;
+    return data;
+}
+/* values over `max` are treated as malformed */
+INLINE uint64_t decode_varint(Reader *r, uint64_t max) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = reader_byte(r);
+        x |= (uint64_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            if (x > max || (shift == 63 && b > 1)) break;
+            return x;
+        }
+    }
+    reader_fail(r, FormpackErr_BadValue);
+    return 0;
+}
+
+/* zigzag maps signed to unsigned so small negatives stay small:
+   0, -1, 1, -2, 2 ... become 0, 1, 2, 3, 4 ... */
+INLINE uint32_t zigzag32(int32_t x) {
+    return ((uint32_t) x << 1) ^ (x < 0 ? UINT32_MAX : 0);
+}
+INLINE int32_t unzigzag32(uint32_t u) {
+    return (int32_t) ((u >> 1) ^ (0u - (u & 1)));
+}
+
+uint16_t encoded_size_u32(u32 *u) { return encoded_size_varint(*u); }
+uint8_t *encode_u32(uint8_t *data, u32 *u) { return encode_varint(data, *u); }
+u32 decode_u32(Reader *r) { return (u32) decode_varint(r, UINT32_MAX); }
+
+uint16_t encoded_size_u64(u64 *u) { return encoded_size_varint(*u); }
+uint8_t *encode_u64(uint8_t *data, u64 *u) { return encode_varint(data, *u); }
+u64 decode_u64(Reader *r) { return decode_varint(r, UINT64_MAX); }
+
+uint16_t encoded_size_i32(i32 *i) { return encoded_size_varint(zigzag32(*i)); }
+uint8_t *encode_i32(uint8_t *data, i32 *i) { return encode_varint(data, zigzag32(*i)); }
+i32 decode_i32(Reader *r) { return unzigzag32((uint32_t) decode_varint(r, UINT32_MAX)); }
+
+/* qfloats are sent as a whole number of `precision` sized steps above `min`,
+   in `bytes` little endian bytes. formpack works all of these out from the
+   declared range, values outside of which are clamped (and NaN becomes min). */
+INLINE uint32_t qfloat_quantize(float x, double min, double precision, uint32_t steps) {
+    double q = ((double) x - min) / precision + 0.5;
+    return (q >= 1.0) ? ((q < (double) steps) ? (uint32_t) q : steps) : 0;
+}
+INLINE float qfloat_value(uint32_t u, double min, double precision) {
+    return (float) (min + u * precision);
+}
+INLINE uint8_t *encode_qfloat(uint8_t *data, float x, double min, double precision,
+                              uint32_t steps, int bytes) {
+    uint32_t u = qfloat_quantize(x, min, precision, steps);
+    for (int i = 0; i < bytes; i++) *data++ = (uint8_t) (u >> (i * 8));
+    return data;
+}
+INLINE float decode_qfloat(Reader *r, double min, double precision,
+                           uint32_t steps, int bytes) {
+    uint8_t *b = reader_take(r, bytes);
+    if (b == NULL) return (float) min;
+    uint32_t u = 0;
+    for (int i = 0; i < bytes; i++) u |= (uint32_t) b[i] << (i * 8);
+    if (u > steps) {
+        reader_fail(r, FormpackErr_BadValue);
+        return (float) min;
+    }
+    return qfloat_value(u, min, precision);
+}
+
+/* a websocket frame is a flag byte, then messages back to back,
+   since each knows its own size. frames of at least FRAME_COMPRESS_MIN bytes
+   are compressed if that makes them smaller, and flagged as such, in which
+   case the flag is followed by a varint of their size decompressed. */
+#define FRAME_COMPRESS_MIN 1024
+typedef enum {
+    FrameFlag_Raw,
+    FrameFlag_Lz,
+} FrameFlag;
+
+/* `frame` is `len` bytes of messages, with a byte free before them for the flag.
+   returns what's to be sent, setting `len` to its size, which is either
+   `frame` or compressed into memory that needs freeing */
+INLINE uint8_t *frame_seal(uint8_t *frame, size_t *len) {
+    frame[0] = FrameFlag_Raw;
+    if (*len < FRAME_COMPRESS_MIN) {
+        *len += 1;
+        return frame;
+    }
+
+    uint8_t *sealed = malloc(1 + 5 + lz_bound(*len));
+    sealed[0] = FrameFlag_Lz;
+    uint8_t *at = encode_varint(sealed + 1, *len);
+    at += lz_compress(frame + 1, *len, at);
+    if ((size_t) (at - sealed) >= 1 + *len) {
+        free(sealed);
+        *len += 1;
+        return frame;
+    }
+    *len = at - sealed;
+    return sealed;
+}
+#define frame_send(ws, frame, len) do {                   \
+    size_t _sealed_len = (len);                            \
+    uint8_t *_sealed = frame_seal((frame), &_sealed_len);  \
+    bqws_send_binary((ws), _sealed, _sealed_len);          \
+    if (_sealed != (frame)) free(_sealed);                 \
+} while (false)
+
+/* a Reader for the messages in a received frame,
+   decompressing them into `scratch` if need be */
+INLINE Reader frame_reader(uint8_t *data, size_t size, Scratch *scratch, Intern *intern) {
+    Reader r = { .at = data, .end = data + size, .scratch = scratch, .intern = intern };
+    FrameFlag flag = (FrameFlag) reader_byte(&r);
+    if (r.err != FormpackErr_None || flag == FrameFlag_Raw) return r;
+    if (flag != FrameFlag_Lz) {
+        reader_fail(&r, FormpackErr_BadValue);
+        return r;
+    }
+
+    size_t len = (size_t) decode_varint(&r, FORMPACK_MAX_SIZE);
+    if (r.err != FormpackErr_None) return r;
+    uint8_t *raw = len ? scratch_alloc(scratch, len) : NULL;
+    if (raw == NULL || !lz_decompress(r.at, r.end - r.at, raw, len)) {
+        reader_fail(&r, FormpackErr_BadValue);
+        return r;
+    }
+    r.at = raw, r.end = raw + len;
+    return r;
+}
+
+/* messages for one connection, to go out together as one frame.
+   `data` is allocated the first time something is added,
+   with the byte before the messages left free for the frame's flag. */
+#define BATCH_CAP 4096
+typedef struct {
+    uint8_t *data;
+    uint32_t len;
+    Intern *intern; /* what's been sent to the other end, for istrings */
+} Batch;
+/* sends whatever is in the batch, if anything, and empties it */
+#define batch_flush(b, ws) do {                            \
+    if ((b)->len) frame_send((ws), (b)->data, (b)->len);   \
+    (b)->len = 0;                                          \
+} while (false)
+
+/* arrays are sent as a varint count, then each element.
+   a count can't claim more elements than there are bytes left for,
+   so a bogus one can't make us allocate much. */
+INLINE uint32_t decode_array_len(Reader *r, size_t min_elem_size) {
+    uint32_t len = (uint32_t) decode_varint(r, UINT32_MAX);
+    if ((uint64_t) len * min_elem_size > (uint64_t) (r->end - r->at)) {
+        reader_fail(r, FormpackErr_Truncated);
+        return 0;
+    }
+    return len;
+}
+INLINE void *reader_alloc(Reader *r, uint32_t len, size_t elem_size) {
+    return len ? scratch_alloc(r->scratch, len * elem_size) : NULL;
 }
 
+/* a String sent as its slot in the connection's Intern, once it's in there.
+   the first byte says which: 0 is a String to be taken as is,
+   1 a String that's also to be interned, 2 and on are slot 0 and on.
+   without an Intern, they're all sent as is. */
+typedef String istring;
+uint16_t encoded_size_istring(String *s) {
+    return 2 + s->len; /* at most, it's less once interned */
+}
+uint8_t *encode_istring(uint8_t *data, String *s, Intern *intern) {
+    int slot = intern ? intern_find(intern, s) : -1;
+    if (slot >= 0) {
+        *data++ = (uint8_t) (2 + slot);
+        return data;
+    }
+    bool add = intern && s->len <= INTERN_MAX_LEN;
+    if (add) intern_add(intern, s);
+    *data++ = add;
+    return encode_string(data, s);
+}
+/* reads past an istring, interning it if it's to be */
+void skip_istring(Reader *r) {
+    uint8_t tag = reader_byte(r);
+    if (tag < 2) {
+        String s = decode_string(r);
+        if (tag == 1 && s.len > INTERN_MAX_LEN) reader_fail(r, FormpackErr_BadValue);
+        else if (tag == 1 && r->intern && r->err == FormpackErr_None) intern_add(r->intern, &s);
+    } else if (r->intern ? tag - 2 >= r->intern->count : tag - 2 >= INTERN_SLOTS)
+        reader_fail(r, FormpackErr_BadValue);
+}
+/* strings from the Intern are copied to the scratch, as a later istring
+   in the same message could push them out */
+String decode_istring(Reader *r) {
+    uint8_t *start = r->at;
+    skip_istring(r);
+    if (r->err != FormpackErr_None) return (String) { .len = 0, .str = "" };
+    if (start[0] < 2) return (String) { .len = start[1], .str = (char *) start + 2 };
+    if (r->intern == NULL) {
+        reader_fail(r, FormpackErr_BadValue);
+        return (String) { .len = 0, .str = "" };
+    }
+
+    uint8_t slot = start[0] - 2;
+    String s = { .len = r->intern->lens[slot], .str = "" };
+    if (s.len) {
+        s.str = reader_alloc(r, s.len, 1);
+        memcpy(s.str, r->intern->strs[slot], s.len);
+    }
+    return s;
+}
+
+/* a type is raw if it's sent as exactly the bytes it is in memory.
+   formpack knows which types would be, going by their fields,
+   this checks the machine is little endian and the compiler added no padding */
+#if defined(__BYTE_ORDER__)
+#define FORMPACK_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#else
+/* msvc only targets little endian machines */
+#define FORMPACK_LITTLE_ENDIAN 1
+#endif
+#define formpack_is_raw(T, wire_size) (FORMPACK_LITTLE_ENDIAN && sizeof(T) == (wire_size))
+
+/* arrays of raw types go in and out with one memcpy */
+INLINE uint8_t *encode_raw_array(uint8_t *data, void *items, uint32_t len, size_t size) {
+    if (len) memcpy(data, items, len * size);
+    return data + len * size;
+}
+INLINE void decode_raw_array(Reader *r, void *items, uint32_t len, size_t size) {
+    uint8_t *bytes = reader_take(r, len * size);
+    if (bytes && len) memcpy(items, bytes, len * size);
+    else if (items) memset(items, 0, len * size);
+}
+
+#ifdef FORMPACK_STATS
+#include <time.h>
+#include <inttypes.h>
+
+/* what's gone through formpack for one kind of message, on one thread.
+   `packed` counts pack_*, `unpacked` anything that decodes, views or dispatches.
+   the time is only formpack's, not sending or handling the message. */
+typedef struct {
+    uint64_t count, bytes, nanos;
+} FormpackStat;
+typedef struct {
+    FormpackStat packed, unpacked;
+} FormpackKindStats;
+
+/* monotonic nanoseconds, only useful for measuring intervals */
+INLINE uint64_t formpack_nanos(void) {
+#ifdef _WIN32
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t) ((double) now.QuadPart * 1e9 / (double) freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+INLINE void formpack_stat_add(FormpackStat *s, size_t bytes, uint64_t start) {
+    s->count++;
+    s->bytes += bytes;
+    s->nanos += formpack_nanos() - start;
+}
+#endif
+
 #include "../formpack/build/formpack.h"
+
+#ifdef FORMPACK_STATS
+/* adds each of the counters in `from` to those in `into` */
+INLINE void formpack_stats_add(FormpackKindStats *into, FormpackKindStats *from) {
+    for (int i = 0; i < FORMPACK_KIND_COUNT; i++) {
+        FormpackStat *f[] = { &from[i].packed, &from[i].unpacked },
+                     *t[] = { &into[i].packed, &into[i].unpacked };
+        for (int j = 0; j < 2; j++) {
+            t[j]->count += f[j]->count;
+            t[j]->bytes += f[j]->bytes;
+            t[j]->nanos += f[j]->nanos;
+        }
+    }
+}
+
+/* moves this thread's counters into `into`, for gathering up
+   what every thread has done somewhere it can be printed */
+INLINE void formpack_stats_take(FormpackKindStats *into) {
+    formpack_stats_add(into, formpack_stats);
+    memset(formpack_stats, 0, sizeof(formpack_stats));
+}
+
+/* a line for each kind of message in `stats` that's been seen at all */
+INLINE void formpack_stats_print(FILE *out, FormpackKindStats *stats) {
+    fprintf(out, "%-32s %10s %12s %8s %10s %12s %8s\n", "message",
+            "packed", "bytes", "ns/msg", "unpacked", "bytes", "ns/msg");
+    for (int i = 0; i < FORMPACK_KIND_COUNT; i++) {
+        FormpackStat *p = &stats[i].packed, *u = &stats[i].unpacked;
+        if (p->count == 0 && u->count == 0) continue;
+        fprintf(out, "%-32s %10" PRIu64 " %12" PRIu64 " %8" PRIu64
+                     " %10" PRIu64 " %12" PRIu64 " %8" PRIu64 "\n",
+                formpack_kind_names[i],
+                p->count, p->bytes, p->count ? p->nanos / p->count : 0,
+                u->count, u->bytes, u->count ? u->nanos / u->count : 0);
+    }
+}
+#endif
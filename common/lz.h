@@ -0,0 +1,132 @@
+/* a small LZ77 codec, laid out like LZ4's blocks, for compressing big frames.
+   the output is a run of sequences, each a token byte, some literal bytes
+   copied as they are, then a match: a two byte offset back into what's
+   already been decompressed, from where the next however many bytes are copied.
+   the token's high four bits count the literals, its low four the match's
+   length less LZ_MIN_MATCH, 15 in either meaning bytes follow adding to it,
+   until one of them is under 255. the last sequence has only literals. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+/* the last bytes are always sent as literals, so matches can be
+   found and extended reading four bytes at a time */
+#define LZ_LAST_LITERALS 8
+
+/* the most bytes compressing `len` bytes can take up */
+INLINE size_t lz_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+INLINE uint32_t _lz_read32(const uint8_t *p) {
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return x;
+}
+
+INLINE uint32_t _lz_hash(uint32_t x) {
+    return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+INLINE uint8_t *_lz_token(uint8_t *out, size_t literals, size_t match) {
+    *out++ = (uint8_t) ((min(literals, 15) << 4) | min(match, 15));
+    return out;
+}
+
+/* the part of a length past the 15 in its token */
+INLINE uint8_t *_lz_put_len(uint8_t *out, size_t len) {
+    for (len -= 15; len >= 255; len -= 255) *out++ = 255;
+    *out++ = (uint8_t) len;
+    return out;
+}
+
+INLINE bool _lz_get_len(const uint8_t **in, const uint8_t *end, size_t *len) {
+    uint8_t b;
+    do {
+        if (*in == end || *len > ((size_t) 1 << 30)) return false;
+        *len += b = *(*in)++;
+    } while (b == 255);
+    return true;
+}
+
+INLINE uint8_t *_lz_literals(uint8_t *out, const uint8_t *from, size_t len, size_t match) {
+    out = _lz_token(out, len, match);
+    if (len >= 15) out = _lz_put_len(out, len);
+    memcpy(out, from, len);
+    return out + len;
+}
+
+/* compresses the `len` bytes at `in` into `out`, which has room for
+   lz_bound(len) of them. returns how many it took. */
+size_t lz_compress(const uint8_t *in, size_t len, uint8_t *out) {
+    /* where each hash of four bytes was last seen, as an offset into `in` */
+    uint32_t seen[1 << LZ_HASH_BITS] = { 0 };
+    const uint8_t *at = in, *anchor = in, *end = in + len;
+    const uint8_t *limit = (len > LZ_LAST_LITERALS + LZ_MIN_MATCH)
+                         ? end - LZ_LAST_LITERALS - LZ_MIN_MATCH : in;
+    uint8_t *o = out;
+    int misses = 0;
+
+    while (at < limit) {
+        uint32_t bytes = _lz_read32(at);
+        uint32_t *slot = &seen[_lz_hash(bytes)];
+        const uint8_t *match = in + *slot;
+        *slot = (uint32_t) (at - in);
+        if (match >= at || at - match > LZ_MAX_OFFSET || _lz_read32(match) != bytes) {
+            /* the longer it's been since a match, the less likely one is,
+               so the faster incompressible data is stepped over */
+            at += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+
+        const uint8_t *m = at + LZ_MIN_MATCH, *from = match + LZ_MIN_MATCH;
+        while (m < end - LZ_LAST_LITERALS && *m == *from) m++, from++;
+        size_t match_len = m - at - LZ_MIN_MATCH;
+
+        o = _lz_literals(o, anchor, at - anchor, match_len);
+        size_t offset = at - match;
+        *o++ = (uint8_t) offset;
+        *o++ = (uint8_t) (offset >> 8);
+        if (match_len >= 15) o = _lz_put_len(o, match_len);
+        at = anchor = m;
+    }
+
+    o = _lz_literals(o, anchor, end - anchor, 0);
+    return o - out;
+}
+
+/* decompresses the `in_len` bytes at `in` into `out`, which they should
+   fill exactly. returns false if they're malformed or don't. */
+bool lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len) {
+    const uint8_t *i = in, *in_end = in + in_len;
+    uint8_t *o = out, *out_end = out + out_len;
+    for (;;) {
+        if (i == in_end) return false;
+        uint8_t token = *i++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !_lz_get_len(&i, in_end, &literals)) return false;
+        if ((size_t) (in_end - i) < literals || (size_t) (out_end - o) < literals) return false;
+        memcpy(o, i, literals);
+        o += literals, i += literals;
+        if (i == in_end) return o == out_end;
+
+        if (in_end - i < 2) return false;
+        size_t offset = i[0] | (i[1] << 8);
+        i += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !_lz_get_len(&i, in_end, &match_len)) return false;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (o - out) || (size_t) (out_end - o) < match_len)
+            return false;
+
+        const uint8_t *from = o - offset;
+        if (offset >= match_len) {
+            memcpy(o, from, match_len);
+            o += match_len;
+        } else
+            /* overlaps what it's writing, so a byte at a time */
+            while (match_len--) *o++ = *from++;
+    }
+}
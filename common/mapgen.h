@@ -35,71 +35,170 @@ _mapgen_Biome _mapgen_fbm_to_biome(float fbm) {
     return _mapgen_Biome_OOB;
 }
 
+/* noise is worked out for this many points at a time, so it can be done several wide */
+#define _MAPGEN_BATCH 64
+
 float _mapgen_snoise(Vec2 p) {
     return simplex2(p) * 0.7f;
 }
 
-float _mapgen_fbm(Vec2 p) {
+void _mapgen_snoise_many(const float *xs, const float *ys, float *out, int count) {
+    simplex2_many(xs, ys, out, count);
+    for (int i = 0; i < count; i++) out[i] *= 0.7f;
+}
+
+/* _mapgen_fbm of up to _MAPGEN_BATCH points, an octave at a time */
+void _mapgen_fbm_many(const float *xs, const float *ys, float *out, int count) {
     Vec2 step = vec2(1.3f, 1.7f);
-    return _mapgen_snoise(p)
-           + (1.0f / 2.0f  ) * _mapgen_snoise(sub2(mul2f(p, 2.0f  ), mul2f(step, 1.0f)))
-           + (1.0f / 4.0f  ) * _mapgen_snoise(sub2(mul2f(p, 4.0f  ), mul2f(step, 2.0f)))
-           + (1.0f / 8.0f  ) * _mapgen_snoise(sub2(mul2f(p, 8.0f  ), mul2f(step, 3.0f)))
-           + (1.0f / 16.0f ) * _mapgen_snoise(sub2(mul2f(p, 16.0f ), mul2f(step, 4.0f)))
-           + (1.0f / 32.0f ) * _mapgen_snoise(sub2(mul2f(p, 32.0f ), mul2f(step, 5.0f)))
-           + (1.0f / 64.0f ) * _mapgen_snoise(sub2(mul2f(p, 64.0f ), mul2f(step, 6.0f)))
-           + (1.0f / 128.0f) * _mapgen_snoise(sub2(mul2f(p, 128.0f), mul2f(step, 7.0f)))
-           + (1.0f / 256.0f) * _mapgen_snoise(sub2(mul2f(p, 256.0f), mul2f(step, 8.0f)))
-           //(1.0f / 512.0f) * sample(sub2(mul2f(p, 512.0f), mul2f(step, 16.0f)))
-           ;
+    float oxs[_MAPGEN_BATCH] = {0}, oys[_MAPGEN_BATCH] = {0}, n[_MAPGEN_BATCH];
+
+    _mapgen_snoise_many(xs, ys, out, count);
+    for (int octave = 1; octave <= 8; octave++) {
+        float scale = (float) (1 << octave);
+        for (int i = 0; i < count; i++) {
+            oxs[i] = xs[i] * scale - step.x * octave;
+            oys[i] = ys[i] * scale - step.y * octave;
+        }
+        _mapgen_snoise_many(oxs, oys, n, count);
+        for (int i = 0; i < count; i++)
+            out[i] += (1.0f / scale) * n[i];
+    }
 }
 
-float _mapgen_island_weighted_fbm(Vec2 p) {
-    float fbm = _mapgen_fbm(p);
+float _mapgen_fbm(Vec2 p) {
+    float fbm;
+    _mapgen_fbm_many(&p.x, &p.y, &fbm, 1);
+    return fbm;
+}
 
+/* raises the middle of the map, and sinks its edges */
+float _mapgen_island_weight(Vec2 p) {
     /* distance to center, circular distance */
     float cd = mag2(sub2f(p, 0.5f));
 
     #define IN  ( 0.2f)
     #define OUT (-0.5f)
     #define FAR (-0.8f)
-    if (cd < 0.3f)      fbm += IN;
-    else if (cd < 0.4f) fbm += lerp( IN, OUT, smoothstep(inv_lerp(0.3f, 0.4f, cd)));
-    else if (cd < 0.5f) fbm += lerp(OUT, FAR, smoothstep(inv_lerp(0.4f, 0.5f, cd)));
-    else               fbm += FAR;
+    if (cd < 0.3f) return IN;
+    if (cd < 0.4f) return lerp( IN, OUT, smoothstep(inv_lerp(0.3f, 0.4f, cd)));
+    if (cd < 0.5f) return lerp(OUT, FAR, smoothstep(inv_lerp(0.4f, 0.5f, cd)));
+    return FAR;
+}
 
-    return fbm;
+void _mapgen_island_weighted_fbm_many(const float *xs, const float *ys, float *out, int count) {
+    _mapgen_fbm_many(xs, ys, out, count);
+    for (int i = 0; i < count; i++)
+        out[i] += _mapgen_island_weight(vec2(xs[i], ys[i]));
 }
 
-void _mapgen_blur(uint8_t *img, int img_size, int k) {
-    #define P_IND(x, y) ((y * img_size + x) * 4)
-    int max = img_size-1;
-    int neighbor_count = pow(k * 2 + 1, 2);
-    for (int x = 0; x < img_size; x++)
-    for (int y = 0; y < img_size; y++) {
+float _mapgen_island_weighted_fbm(Vec2 p) {
+    return _mapgen_fbm(p) + _mapgen_island_weight(p);
+}
+
+/* a box blur of an image, done as a blur across its rows and then down its
+   columns, each keeping a running sum so any radius costs the same */
+typedef struct {
+    uint8_t *img;
+    int img_size, k;
+    int *sums; /* every pixel's rgb summed across its row, 2k+1 wide */
+} _mapgen_Blur;
+/* bigger than _MAPGEN_BAND_ROWS, as a band going down starts by summing 2k+1 rows */
+#define _MAPGEN_BLUR_BAND_ROWS 32
+
+void _mapgen_blur_across(void *arg, int start, int end) {
+    _mapgen_Blur *b = arg;
+    int img_size = b->img_size, k = b->k, last = img_size - 1;
+    for (int y = start; y < end; y++) {
+        uint8_t *row = b->img + y * img_size * 4;
+        int *sums = b->sums + y * img_size * 3;
+
+        /* the edge pixels stand in for those past them */
         int rgb[3] = {0};
         for (int ox = -k; ox <= k; ox++)
-        for (int oy = -k; oy <= k; oy++) {
-            int i = P_IND(clamp(0, x + ox, max),
-                          clamp(0, y + oy, max));
-            rgb[0] += img[i + 0];
-            rgb[1] += img[i + 1];
-            rgb[2] += img[i + 2];
+            for (int c = 0; c < 3; c++) rgb[c] += row[clamp(0, ox, last) * 4 + c];
+
+        for (int x = 0; x < img_size; x++) {
+            uint8_t *in = row + min(x + k + 1, last) * 4, *out = row + max(x - k, 0) * 4;
+            for (int c = 0; c < 3; c++) {
+                sums[x * 3 + c] = rgb[c];
+                rgb[c] += in[c] - out[c];
+            }
         }
-        int i = (y * img_size + x) * 4;
-        img[i + 0] = rgb[0] / neighbor_count;
-        img[i + 1] = rgb[1] / neighbor_count;
-        img[i + 2] = rgb[2] / neighbor_count;
     }
 }
 
+void _mapgen_blur_down(void *arg, int start, int end) {
+    _mapgen_Blur *b = arg;
+    int img_size = b->img_size, k = b->k, last = img_size - 1;
+    int row_len = img_size * 3, neighbor_count = (k * 2 + 1) * (k * 2 + 1);
+
+    /* each column's sums, summed down the 2k+1 rows around the one being written */
+    int *rgb = calloc(row_len, sizeof(int));
+    for (int oy = -k; oy <= k; oy++) {
+        int *sums = b->sums + clamp(0, start + oy, last) * row_len;
+        for (int i = 0; i < row_len; i++) rgb[i] += sums[i];
+    }
+
+    for (int y = start; y < end; y++) {
+        uint8_t *row = b->img + y * img_size * 4;
+        for (int x = 0; x < img_size; x++)
+            for (int c = 0; c < 3; c++)
+                row[x * 4 + c] = rgb[x * 3 + c] / neighbor_count;
+
+        int *in = b->sums + min(y + k + 1, last) * row_len,
+            *out = b->sums + max(y - k, 0) * row_len;
+        for (int i = 0; i < row_len; i++) rgb[i] += in[i] - out[i];
+    }
+    free(rgb);
+}
+
+/* averages each pixel's rgb with the (2k+1)^2 around it, as they were before
+   any of them were blurred. rows are shared out between `workers`, if given */
+void _mapgen_blur(uint8_t *img, int img_size, int k, workers_Pool *workers) {
+    _mapgen_Blur b = {
+        .img = img,
+        .img_size = img_size,
+        .k = k,
+        .sums = malloc(img_size * img_size * 3 * sizeof(int)),
+    };
+    /* every row is summed across before any are written over going down */
+    workers_for(workers, img_size, _MAPGEN_BLUR_BAND_ROWS, _mapgen_blur_across, &b);
+    workers_for(workers, img_size, _MAPGEN_BLUR_BAND_ROWS, _mapgen_blur_down, &b);
+    free(b.sums);
+}
+
+/* the island's fbm, and the biomes it makes, at `res` by `res` points
+   over a square of the map. worked out once, then read from by whatever
+   needs to know what's where: images of the map, and the game itself */
+typedef struct {
+    Vec2          corner; /* of the square, on the map's 0..1 */
+    float         size;
+    int           res;
+    float         *fbm;
+    _mapgen_Biome *biomes;
+    uint32_t      generation; /* the simplex_generation it was worked out in */
+} mapgen_Field;
+
 typedef struct {
     Vec2    tile_corner; /* 0, 0 for top-left */
     float   tile_size;   /* 1.0 for whole map */
     uint8_t *height_map; /* some memory to write a height map into.
                             needs pow(img_size, 2) bytes, ignored if NULL */
+    workers_Pool *workers; /* help generating it, NULL for none */
+    mapgen_Field *field; /* where to keep the tile's field, to be used again.
+                            one is made for the occasion if NULL */
 } mapgen_GroundOpts;
 
+/* an image being generated, shared out a band of rows at a time.
+   every pixel comes out the same whichever thread does it */
+typedef struct {
+    uint8_t           *img;
+    mapgen_Field      *field;
+    int               img_size;
+    mapgen_GroundOpts *opts;
+} _mapgen_Ground;
+#define _MAPGEN_BAND_ROWS 8
+
 Vec2 _mapgen_pixel_world_pos(int x, int y, int img_size, mapgen_GroundOpts *opts) {
     /* in the domain 0..1 */
     Vec2 p = div2f(vec2(x, y), img_size);
@@ -107,46 +206,158 @@ Vec2 _mapgen_pixel_world_pos(int x, int y, int img_size, mapgen_GroundOpts *opts
     return add2(opts->tile_corner, mul2f(p, opts->tile_size));
 }
 
-void _mapgen_texture_sand_pixels(uint8_t           *img    ,
-                                 _mapgen_Biome     *biomes ,
-                                 int               img_size,
-                                 mapgen_GroundOpts *opts   ) {
+/* how much darker each of the `count` sand pixels at xs, ys gets */
+void _mapgen_sand_detail_many(const float *xs, const float *ys, uint8_t *out, int count) {
     Vec2 step = vec2(1.3f, 1.7f);
+    float oxs[_MAPGEN_BATCH] = {0}, oys[_MAPGEN_BATCH] = {0};
+    float dxs[_MAPGEN_BATCH], dys[_MAPGEN_BATCH];
+    float n[_MAPGEN_BATCH], detail[_MAPGEN_BATCH] = {0};
+
+    /* displaced, so the detail isn't on a grid */
+    for (int i = 0; i < count; i++) oxs[i] = xs[i] * 200, oys[i] = ys[i] * 200;
+    _mapgen_snoise_many(oxs, oys, n, count);
+    for (int i = 0; i < count; i++) dxs[i] = xs[i] + n[i];
+    for (int i = 0; i < count; i++) oxs[i] += 5.7f, oys[i] += 0.2f;
+    _mapgen_snoise_many(oxs, oys, n, count);
+    for (int i = 0; i < count; i++) dys[i] = ys[i] + n[i];
 
-    for (int x = 0; x < img_size; x++)
-    for (int y = 0; y < img_size; y++) {
-        Vec2 p = _mapgen_pixel_world_pos(x, y, img_size, opts);
-        int i_b = (y * img_size) + x;
-        _mapgen_Biome biome = biomes[i_b];
-        if (biome >= _mapgen_Biome_Sand1 && biome <= _mapgen_Biome_Sand5) {
-            Vec2 dp = vec2(p.x + _mapgen_snoise(mul2f(p, 200)),
-                           p.y + _mapgen_snoise(add2(mul2f(p, 200), vec2(5.7, 0.2))));
-            float detail = _mapgen_snoise(sub2(mul2f(dp, 400), mul2f(step, 40)))
-                         + 0.50f * _mapgen_snoise(sub2(mul2f(dp, 800), mul2f(step, 59)))
-                         + 0.25f * _mapgen_snoise(sub2(mul2f(dp, 900), mul2f(step, 62)));
-            uint8_t sand_d = (((detail + 1.0) / 2.0) * 25.0);
-            int pixel_i = i_b * 4;
-            img[pixel_i+0] -= sand_d;
-            img[pixel_i+1] -= sand_d;
-            img[pixel_i+2] -= sand_d;
+    static const struct { float scale, step, weight; } octaves[] = {
+        { 400, 40, 1.00f },
+        { 800, 59, 0.50f },
+        { 900, 62, 0.25f },
+    };
+    for (int o = 0; o < LEN(octaves); o++) {
+        for (int i = 0; i < count; i++) {
+            oxs[i] = dxs[i] * octaves[o].scale - step.x * octaves[o].step;
+            oys[i] = dys[i] * octaves[o].scale - step.y * octaves[o].step;
         }
+        _mapgen_snoise_many(oxs, oys, n, count);
+        for (int i = 0; i < count; i++)
+            detail[i] += octaves[o].weight * n[i];
     }
+
+    for (int i = 0; i < count; i++)
+        out[i] = (((detail[i] + 1.0) / 2.0) * 25.0);
 }
 
+void _mapgen_texture_sand_rows(void *arg, int start, int end) {
+    _mapgen_Ground *g = arg;
+    uint8_t *img = g->img;
+    _mapgen_Biome *biomes = g->field->biomes;
+    int img_size = g->img_size;
 
-void mapgen_ground_img(uint8_t *img, int img_size, void *options) {
-    mapgen_GroundOpts *opts = options;
-    _mapgen_Biome *biomes = malloc(img_size * img_size * sizeof(_mapgen_Biome));
+    for (int y = start; y < end; y++) {
+        /* the sand pixels of the row, so only they have their noise worked out */
+        int i_bs[_MAPGEN_BATCH], count = 0;
+        float xs[_MAPGEN_BATCH] = {0}, ys[_MAPGEN_BATCH] = {0};
+        uint8_t sand_ds[_MAPGEN_BATCH];
+
+        for (int x = 0; x < img_size; x++) {
+            int i_b = (y * img_size) + x;
+            _mapgen_Biome biome = biomes[i_b];
+            if (biome >= _mapgen_Biome_Sand1 && biome <= _mapgen_Biome_Sand5) {
+                Vec2 p = _mapgen_pixel_world_pos(x, y, img_size, g->opts);
+                i_bs[count] = i_b, xs[count] = p.x, ys[count] = p.y;
+                count++;
+            }
+            if (count < _MAPGEN_BATCH && x < img_size - 1) continue;
+
+            _mapgen_sand_detail_many(xs, ys, sand_ds, count);
+            for (int i = 0; i < count; i++) {
+                int pixel_i = i_bs[i] * 4;
+                img[pixel_i+0] -= sand_ds[i];
+                img[pixel_i+1] -= sand_ds[i];
+                img[pixel_i+2] -= sand_ds[i];
+            }
+            count = 0;
+        }
+    }
+}
+
+void _mapgen_texture_sand_pixels(_mapgen_Ground *g) {
+    workers_for(g->opts->workers, g->img_size, _MAPGEN_BAND_ROWS, _mapgen_texture_sand_rows, g);
+}
 
-    for (int x = 0; x < img_size; x++)
-    for (int y = 0; y < img_size; y++) {
+/* _mapgen_island_weighted_fbm of the pixels in the row from x, y,
+   up to _MAPGEN_BATCH of them, or to the end of the row */
+void _mapgen_fbm_row(float *out, int x, int y, int img_size, mapgen_GroundOpts *opts) {
+    int count = min(_MAPGEN_BATCH, img_size - x);
+    float xs[_MAPGEN_BATCH] = {0}, ys[_MAPGEN_BATCH] = {0};
+    for (int i = 0; i < count; i++) {
+        Vec2 p = _mapgen_pixel_world_pos(x + i, y, img_size, opts);
+        xs[i] = p.x, ys[i] = p.y;
+    }
+    _mapgen_island_weighted_fbm_many(xs, ys, out, count);
+}
+
+void _mapgen_field_rows(void *arg, int start, int end) {
+    mapgen_Field *f = arg;
+    mapgen_GroundOpts square = { .tile_corner = f->corner, .tile_size = f->size };
+    for (int y = start; y < end; y++)
+    for (int x = 0; x < f->res; x += _MAPGEN_BATCH) {
+        int i = y * f->res + x;
+        _mapgen_fbm_row(f->fbm + i, x, y, f->res, &square);
+        for (int row_end = i + min(_MAPGEN_BATCH, f->res - x); i < row_end; i++)
+            f->biomes[i] = _mapgen_fbm_to_biome(f->fbm[i]);
+    }
+}
+
+/* has `f` cover the square of the map from `corner`, `size` across, at `res` by `res`.
+   if it already does, and simplex hasn't been seeded since, nothing's worked out again.
+   `f` starts zeroed */
+void mapgen_field_cover(mapgen_Field *f, Vec2 corner, float size, int res, workers_Pool *workers) {
+    if (f->fbm && f->generation == simplex_generation
+        && eq2(f->corner, corner) && f->size == size && f->res == res) return;
+
+    if (f->res != res) {
+        free(f->fbm);
+        free(f->biomes);
+        f->fbm = malloc(res * res * sizeof(float));
+        f->biomes = malloc(res * res * sizeof(_mapgen_Biome));
+    }
+    f->corner = corner, f->size = size, f->res = res;
+    f->generation = simplex_generation;
+    workers_for(workers, res, _MAPGEN_BAND_ROWS, _mapgen_field_rows, f);
+}
+
+void mapgen_field_free(mapgen_Field *f) {
+    free(f->fbm);
+    free(f->biomes);
+    *f = (mapgen_Field) { 0 };
+}
+
+/* the index of the point of `f` nearest `p` and above and to the left of it,
+   or -1 if `p` is off the square `f` covers, or `f` is from before a reseed */
+int _mapgen_field_index(mapgen_Field *f, Vec2 p) {
+    Vec2 at = mul2f(sub2(p, f->corner), f->res / f->size);
+    int x = (int) floorf(at.x), y = (int) floorf(at.y);
+    if (!f->fbm || f->generation != simplex_generation || x < 0 || y < 0 || x >= f->res || y >= f->res) return -1;
+    return y * f->res + x;
+}
+
+/* the fbm at `p`, on the map's 0..1. worked out on the spot if `f` doesn't cover it */
+float mapgen_field_fbm(mapgen_Field *f, Vec2 p) {
+    int i = _mapgen_field_index(f, p);
+    return (i < 0) ? _mapgen_island_weighted_fbm(p) : f->fbm[i];
+}
+
+_mapgen_Biome mapgen_field_biome(mapgen_Field *f, Vec2 p) {
+    int i = _mapgen_field_index(f, p);
+    return (i < 0) ? _mapgen_fbm_to_biome(_mapgen_island_weighted_fbm(p)) : f->biomes[i];
+}
+
+void _mapgen_ground_rows(void *arg, int start, int end) {
+    _mapgen_Ground *g = arg;
+    uint8_t *img = g->img;
+    _mapgen_Biome *biomes = g->field->biomes;
+    int img_size = g->img_size;
+    mapgen_GroundOpts *opts = g->opts;
+
+    for (int y = start; y < end; y++)
+    for (int x = 0; x < img_size; x++) {
         typedef struct { uint8_t r; uint8_t g; uint8_t b; } Col;
         Col rgb;
-        Vec2 p = _mapgen_pixel_world_pos(x, y, img_size, opts);
-
-        float fbm = _mapgen_island_weighted_fbm(p);
-        _mapgen_Biome biome = _mapgen_fbm_to_biome(fbm);
-        biomes[(y * img_size) + x] = biome;
+        _mapgen_Biome biome = biomes[(y * img_size) + x];
         switch (biome) {
         case (_mapgen_Biome_Ocean4): rgb = (Col) {180, 180, 185}; break; // (clouded)
         case (_mapgen_Biome_Ocean3): rgb = (Col) {200, 200, 205}; break; // (clouded)
@@ -187,22 +398,41 @@ void mapgen_ground_img(uint8_t *img, int img_size, void *options) {
             opts->height_map[y * img_size + x] = height;
         }
     }
-    _mapgen_texture_sand_pixels(img, biomes, img_size, opts);
-    _mapgen_blur(img, img_size, 3);
-    _mapgen_texture_sand_pixels(img, biomes, img_size, opts);
-    free(biomes);
 }
 
+void mapgen_ground_img(uint8_t *img, int img_size, void *options) {
+    mapgen_GroundOpts *opts = options;
+    mapgen_Field field = { 0 };
+    _mapgen_Ground g = {
+        .img = img,
+        .field = opts->field ? opts->field : &field,
+        .img_size = img_size,
+        .opts = opts,
+    };
+
+    mapgen_field_cover(g.field, opts->tile_corner, opts->tile_size, img_size, opts->workers);
+    workers_for(opts->workers, img_size, _MAPGEN_BAND_ROWS, _mapgen_ground_rows, &g);
+    _mapgen_texture_sand_pixels(&g);
+    _mapgen_blur(img, img_size, 3, opts->workers);
+    _mapgen_texture_sand_pixels(&g);
+    mapgen_field_free(&field);
+}
+
+/* `options` is a field of the whole map to take the minimap from, or NULL.
+   it's worked out first, at `img_size`, if it's not there or not that fine */
 void mapgen_minimap_img(uint8_t *img, int img_size, void *options) {
-    (void) options; // for compat with mapgen_ground_img
+    mapgen_Field field = { 0 }, *world = options ? options : &field;
+    if (!world->fbm || world->generation != simplex_generation
+        || !eq2(world->corner, vec2f(0.0f)) || world->size != 1.0f || world->res < img_size)
+        mapgen_field_cover(world, vec2f(0.0f), 1.0f, img_size, NULL);
 
-    for (int x = 0; x < img_size; x++)
-    for (int y = 0; y < img_size; y++) {
+    for (int y = 0; y < img_size; y++)
+    for (int x = 0; x < img_size; x++) {
         typedef struct { uint8_t r; uint8_t g; uint8_t b; } Col;
         Col rgb;
-        Vec2 p = div2f(vec2(x, y), img_size);
-        float fbm = _mapgen_island_weighted_fbm(p);
-        switch (_mapgen_fbm_to_biome(fbm)) {
+        /* the nearest point of the field, which may be finer than the minimap */
+        int i_f = (y * world->res / img_size) * world->res + (x * world->res / img_size);
+        switch (world->biomes[i_f]) {
         case (_mapgen_Biome_Ocean4): rgb = (Col) {180, 180, 185}; break; // (clouded)
         case (_mapgen_Biome_Ocean3): rgb = (Col) {200, 200, 205}; break; // (clouded)
         case (_mapgen_Biome_Ocean2): rgb = (Col) { 50,  80, 140}; break;
@@ -225,5 +455,6 @@ void mapgen_minimap_img(uint8_t *img, int img_size, void *options) {
         img[i+2] = rgb.b;
         img[i+3] = 255;
     }
-    _mapgen_blur(img, img_size, 1);
+    _mapgen_blur(img, img_size, 1, NULL);
+    mapgen_field_free(&field);
 }
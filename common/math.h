@@ -213,7 +213,10 @@ INLINE i32 fastfloor(f32 fp) {
 }
 
 static uint8_t simplex_gradients[256] = {0};
+/* counts seed_simplex calls, so noise that's been kept can tell it's stale */
+static uint32_t simplex_generation = 0;
 void seed_simplex() {
+    simplex_generation++;
     int i = 0;
     while (i < 256) {
         u32 r = rand_u32();
@@ -315,6 +318,98 @@ INLINE f32 simplex2(Vec2 pnt) {
     return 45.23065f * (n0 + n1 + n2);
 }
 
+/* simplex2 of N points at once, (xs[i], ys[i]) into out[i], giving exactly
+   what simplex2 would. written with GCC/Clang vector extensions, which become
+   SSE or AVX2 on x86, NEON on ARM and SIMD128 on wasm, depending on what the
+   target has. the gradient lookups are done a lane at a time, nothing has a
+   gather worth using. every corner's contribution is worked out and the
+   ones outside of the corner's radius zeroed after, rather than branching. */
+#if defined(__GNUC__) || defined(__clang__)
+#define _SIMPLEX2_LANES(N)                                                       \
+typedef f32 f32x##N __attribute__((vector_size(N * 4)));                         \
+typedef i32 i32x##N __attribute__((vector_size(N * 4)));                         \
+INLINE void simplex2_x##N(const f32 *xs, const f32 *ys, f32 *out) {             \
+    const f32 F2 = 0.366025403f, G2 = 0.211324865f;                              \
+    f32x##N x, y;                                                                \
+    memcpy(&x, xs, sizeof(x));                                                   \
+    memcpy(&y, ys, sizeof(y));                                                   \
+                                                                                 \
+    /* skew, and floor as fastfloor does */                                      \
+    const f32x##N s = (x + y) * F2;                                              \
+    const f32x##N xs_ = x + s, ys_ = y + s;                                      \
+    i32x##N i = __builtin_convertvector(xs_, i32x##N);                           \
+    i32x##N j = __builtin_convertvector(ys_, i32x##N);                           \
+    i += xs_ < __builtin_convertvector(i, f32x##N); /* true is -1 */             \
+    j += ys_ < __builtin_convertvector(j, f32x##N);                              \
+                                                                                 \
+    const f32x##N t = __builtin_convertvector(i + j, f32x##N) * G2;              \
+    const f32x##N x0 = x - (__builtin_convertvector(i, f32x##N) - t);            \
+    const f32x##N y0 = y - (__builtin_convertvector(j, f32x##N) - t);            \
+                                                                                 \
+    /* 1, 0 in the lower triangle and 0, 1 in the upper */                       \
+    const i32x##N lower = x0 > y0;                                               \
+    const i32x##N i1 = -lower, j1 = 1 + lower;                                   \
+                                                                                 \
+    const f32x##N x1 = x0 - __builtin_convertvector(i1, f32x##N) + G2;           \
+    const f32x##N y1 = y0 - __builtin_convertvector(j1, f32x##N) + G2;           \
+    const f32x##N x2 = x0 - 1.0f + 2.0f * G2;                                    \
+    const f32x##N y2 = y0 - 1.0f + 2.0f * G2;                                    \
+                                                                                 \
+    i32x##N gi0, gi1, gi2;                                                       \
+    for (int l = 0; l < N; l++) {                                                \
+        gi0[l] = hash(i[l] + hash(j[l]));                                        \
+        gi1[l] = hash(i[l] + i1[l] + hash(j[l] + j1[l]));                        \
+        gi2[l] = hash(i[l] + 1 + hash(j[l] + 1));                                \
+    }                                                                            \
+                                                                                 \
+    f32x##N n[3];                                                                \
+    const f32x##N cx[3] = { x0, x1, x2 }, cy[3] = { y0, y1, y2 };                \
+    const i32x##N gi[3] = { gi0, gi1, gi2 };                                     \
+    for (int c = 0; c < 3; c++) {                                                \
+        /* grad(), with its selects done by masking */                           \
+        const i32x##N h = gi[c] & 0x3F, x_major = h < 4;                         \
+        const i32x##N xb = (i32x##N) cx[c], yb = (i32x##N) cy[c];                \
+        const i32x##N ub = (xb & x_major) | (yb & ~x_major);                     \
+        const i32x##N vb = (yb & x_major) | (xb & ~x_major);                     \
+        const i32x##N sign = (i32x##N) { 0 } + INT32_MIN;                        \
+        const f32x##N u = (f32x##N) (ub ^ (sign & -(h & 1)));                    \
+        const f32x##N v = 2.0f * (f32x##N) (vb ^ (sign & -((h >> 1) & 1)));      \
+        f32x##N tc = 0.5f - cx[c] * cx[c] - cy[c] * cy[c];                       \
+        const i32x##N outside = tc < 0.0f;                                       \
+        tc *= tc;                                                                \
+        n[c] = (f32x##N) ((i32x##N) (tc * tc * (u + v)) & ~outside);             \
+    }                                                                            \
+                                                                                 \
+    const f32x##N result = 45.23065f * (n[0] + n[1] + n[2]);                     \
+    memcpy(out, &result, sizeof(result));                                        \
+}
+_SIMPLEX2_LANES(4)
+_SIMPLEX2_LANES(8)
+#else
+INLINE void simplex2_x4(const f32 *xs, const f32 *ys, f32 *out) {
+    for (int l = 0; l < 4; l++) out[l] = simplex2(vec2(xs[l], ys[l]));
+}
+INLINE void simplex2_x8(const f32 *xs, const f32 *ys, f32 *out) {
+    for (int l = 0; l < 8; l++) out[l] = simplex2(vec2(xs[l], ys[l]));
+}
+#endif
+
+/* simplex2 of each of `count` points, as many at once as the target has room for.
+   without AVX, eight wide is done as two halves, and slower than four */
+#ifdef __AVX__
+#define SIMPLEX2_LANES 8
+#define simplex2_xN simplex2_x8
+#else
+#define SIMPLEX2_LANES 4
+#define simplex2_xN simplex2_x4
+#endif
+INLINE void simplex2_many(const f32 *xs, const f32 *ys, f32 *out, int count) {
+    int l = 0;
+    for (; l + SIMPLEX2_LANES <= count; l += SIMPLEX2_LANES)
+        simplex2_xN(xs + l, ys + l, out + l);
+    for (; l < count; l++) out[l] = simplex2(vec2(xs[l], ys[l]));
+}
+
 INLINE f32 line_dist2(Vec2 start, Vec2 end, Vec2 pt) {
     Vec2 line_dir = sub2(end, start);
     Vec2 perp_dir = perp2(line_dir);
@@ -0,0 +1,115 @@
+/* just enough threading to get by: pthreads everywhere but windows
+   (MinGW included), where the equivalent win32 primitives are used instead. */
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+    #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    typedef HANDLE Thread;
+    typedef CRITICAL_SECTION Mutex;
+    typedef CONDITION_VARIABLE Cond;
+    typedef SRWLOCK RwLock;
+#else
+    #include <pthread.h>
+    #include <unistd.h>
+    typedef pthread_t Thread;
+    typedef pthread_mutex_t Mutex;
+    typedef pthread_cond_t Cond;
+    typedef pthread_rwlock_t RwLock;
+#endif
+
+/* a global with a copy per thread */
+#ifdef _MSC_VER
+    #define THREAD_LOCAL __declspec(thread)
+#else
+    #define THREAD_LOCAL _Thread_local
+#endif
+
+typedef void *(*ThreadFn)(void *arg);
+
+#ifdef _WIN32
+typedef struct { ThreadFn fn; void *arg; } _thread_Start;
+static DWORD WINAPI _thread_trampoline(LPVOID param) {
+    _thread_Start start = *(_thread_Start *) param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+#endif
+
+/* returns false if the thread couldn't be started */
+bool thread_start(Thread *t, ThreadFn fn, void *arg) {
+#ifdef _WIN32
+    _thread_Start *start = malloc(sizeof(_thread_Start));
+    *start = (_thread_Start) { fn, arg };
+    *t = CreateThread(NULL, 0, _thread_trampoline, start, 0, NULL);
+    if (*t == NULL) free(start);
+    return *t != NULL;
+#else
+    return pthread_create(t, NULL, fn, arg) == 0;
+#endif
+}
+
+void thread_join(Thread t) {
+#ifdef _WIN32
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+#else
+    pthread_join(t, NULL);
+#endif
+}
+
+/* number of hardware threads, or 1 if that can't be determined */
+int thread_core_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return max(1, (int) info.dwNumberOfProcessors);
+#elif defined(_SC_NPROCESSORS_ONLN)
+    return max(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+#else
+    return 1;
+#endif
+}
+
+#ifdef _WIN32
+INLINE void mutex_init(Mutex *m)   { InitializeCriticalSection(m); }
+INLINE void mutex_free(Mutex *m)   { DeleteCriticalSection(m); }
+INLINE void mutex_lock(Mutex *m)   { EnterCriticalSection(m); }
+INLINE void mutex_unlock(Mutex *m) { LeaveCriticalSection(m); }
+
+INLINE void cond_init(Cond *c)             { InitializeConditionVariable(c); }
+INLINE void cond_free(Cond *c)             { (void) c; }
+INLINE void cond_wait(Cond *c, Mutex *m)   { SleepConditionVariableCS(c, m, INFINITE); }
+INLINE void cond_signal(Cond *c)           { WakeConditionVariable(c); }
+INLINE void cond_broadcast(Cond *c)        { WakeAllConditionVariable(c); }
+
+INLINE void rwlock_init(RwLock *l)         { InitializeSRWLock(l); }
+INLINE void rwlock_free(RwLock *l)         { (void) l; }
+INLINE void rwlock_read(RwLock *l)         { AcquireSRWLockShared(l); }
+INLINE void rwlock_read_unlock(RwLock *l)  { ReleaseSRWLockShared(l); }
+INLINE void rwlock_write(RwLock *l)        { AcquireSRWLockExclusive(l); }
+INLINE void rwlock_write_unlock(RwLock *l) { ReleaseSRWLockExclusive(l); }
+#else
+INLINE void mutex_init(Mutex *m)   { pthread_mutex_init(m, NULL); }
+INLINE void mutex_free(Mutex *m)   { pthread_mutex_destroy(m); }
+INLINE void mutex_lock(Mutex *m)   { pthread_mutex_lock(m); }
+INLINE void mutex_unlock(Mutex *m) { pthread_mutex_unlock(m); }
+
+INLINE void cond_init(Cond *c)             { pthread_cond_init(c, NULL); }
+INLINE void cond_free(Cond *c)             { pthread_cond_destroy(c); }
+INLINE void cond_wait(Cond *c, Mutex *m)   { pthread_cond_wait(c, m); }
+INLINE void cond_signal(Cond *c)           { pthread_cond_signal(c); }
+INLINE void cond_broadcast(Cond *c)        { pthread_cond_broadcast(c); }
+
+INLINE void rwlock_init(RwLock *l)         { pthread_rwlock_init(l, NULL); }
+INLINE void rwlock_free(RwLock *l)         { pthread_rwlock_destroy(l); }
+INLINE void rwlock_read(RwLock *l)         { pthread_rwlock_rdlock(l); }
+INLINE void rwlock_read_unlock(RwLock *l)  { pthread_rwlock_unlock(l); }
+INLINE void rwlock_write(RwLock *l)        { pthread_rwlock_wrlock(l); }
+INLINE void rwlock_write_unlock(RwLock *l) { pthread_rwlock_unlock(l); }
+#endif
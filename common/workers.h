@@ -0,0 +1,155 @@
+/* a fixed set of threads working through a shared queue of jobs,
+   for work that would otherwise stall a shard's event loop, or a frame.
+   jobs report back however they like, usually by mailing their shard.
+   workers_for splits up a loop between them and waits for it to finish. */
+
+typedef void (*workers_Fn)(void *arg);
+
+typedef struct {
+    workers_Fn fn;
+    void *arg;
+} workers_Job;
+
+typedef struct {
+    Thread *threads;
+    int thread_count;
+
+    Mutex lock; /* guards everything below */
+    Cond cond; /* signalled when a job is queued */
+    workers_Job *queue; /* a ring, `head` is the next job to run */
+    int head, len, cap;
+    int max_queued; /* 0 for no limit */
+} workers_Pool;
+
+void *_workers_run(void *arg) {
+    workers_Pool *pool = arg;
+    for (;;) {
+        mutex_lock(&pool->lock);
+        while (pool->len == 0) cond_wait(&pool->cond, &pool->lock);
+        workers_Job job = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->cap;
+        pool->len--;
+        mutex_unlock(&pool->lock);
+
+        job.fn(job.arg);
+    }
+    return NULL;
+}
+
+/* starts `thread_count` workers. `max_queued` bounds how many jobs
+   can be waiting at once, 0 leaves it unbounded.
+   returns false if not a single thread could be started. */
+bool workers_start(workers_Pool *pool, int thread_count, int max_queued) {
+    *pool = (workers_Pool) { .max_queued = max_queued };
+    mutex_init(&pool->lock);
+    cond_init(&pool->cond);
+
+    pool->threads = calloc(thread_count, sizeof(Thread));
+    for (int i = 0; i < thread_count; i++)
+        if (thread_start(&pool->threads[pool->thread_count], _workers_run, pool))
+            pool->thread_count++;
+    return pool->thread_count > 0;
+}
+
+/* queues `fn(arg)` to be run on one of the workers.
+   returns false, without queueing it, if the pool already has
+   `max_queued` jobs waiting. */
+bool workers_submit(workers_Pool *pool, workers_Fn fn, void *arg) {
+    mutex_lock(&pool->lock);
+    if (pool->max_queued && pool->len >= pool->max_queued) {
+        mutex_unlock(&pool->lock);
+        return false;
+    }
+
+    if (pool->len == pool->cap) {
+        /* unwrap the ring into the bigger buffer */
+        int cap = pool->cap ? pool->cap * 2 : 64;
+        workers_Job *queue = malloc(cap * sizeof(workers_Job));
+        for (int i = 0; i < pool->len; i++)
+            queue[i] = pool->queue[(pool->head + i) % pool->cap];
+        free(pool->queue);
+        pool->queue = queue, pool->cap = cap, pool->head = 0;
+    }
+    pool->queue[(pool->head + pool->len++) % pool->cap] = (workers_Job) { fn, arg };
+    mutex_unlock(&pool->lock);
+
+    cond_signal(&pool->cond);
+    return true;
+}
+
+/* how many jobs are waiting for a worker */
+int workers_queued(workers_Pool *pool) {
+    mutex_lock(&pool->lock);
+    int len = pool->len;
+    mutex_unlock(&pool->lock);
+    return len;
+}
+
+typedef void (*workers_ForFn)(void *arg, int start, int end);
+
+/* a workers_for being shared out, a band at a time */
+typedef struct {
+    workers_ForFn fn;
+    void *arg;
+    int count, band;
+
+    Mutex lock; /* guards everything below */
+    Cond done; /* signalled when the last helper finishes */
+    int next; /* the start of the next band nobody has taken */
+    int helping; /* workers yet to finish helping */
+} _workers_For;
+
+/* runs bands until there are none left to take */
+void _workers_for_bands(_workers_For *f) {
+    for (;;) {
+        mutex_lock(&f->lock);
+        int start = f->next;
+        f->next = min(f->count, start + f->band);
+        mutex_unlock(&f->lock);
+
+        if (start >= f->count) return;
+        f->fn(f->arg, start, min(f->count, start + f->band));
+    }
+}
+
+void _workers_for_help(void *arg) {
+    _workers_For *f = arg;
+    _workers_for_bands(f);
+
+    mutex_lock(&f->lock);
+    if (--f->helping == 0) cond_signal(&f->done);
+    mutex_unlock(&f->lock);
+}
+
+/* calls `fn(arg, start, end)` for bands of up to `band` of 0..count, until
+   all of it is covered, and returns once they've all returned. the calling
+   thread takes bands too, alongside as many of the pool's workers as would
+   have one, so a NULL or empty `pool` does it all on the calling thread.
+   which thread gets which band, and when, changes from run to run, so bands
+   shouldn't touch anything the others do. not for use from the pool's own jobs,
+   which could end up waiting on helpers queued behind themselves. */
+void workers_for(workers_Pool *pool, int count, int band, workers_ForFn fn, void *arg) {
+    band = max(1, band);
+    _workers_For f = { .fn = fn, .arg = arg, .count = count, .band = band };
+    mutex_init(&f.lock);
+    cond_init(&f.done);
+
+    int bands = (count + band - 1) / band;
+    int helpers = pool ? min(pool->thread_count, bands - 1) : 0;
+    f.helping = max(0, helpers);
+    for (int i = 0; i < helpers; i++)
+        if (!workers_submit(pool, _workers_for_help, &f)) {
+            mutex_lock(&f.lock);
+            f.helping -= helpers - i;
+            mutex_unlock(&f.lock);
+            break;
+        }
+
+    _workers_for_bands(&f);
+
+    mutex_lock(&f.lock);
+    while (f.helping > 0) cond_wait(&f.done, &f.lock);
+    mutex_unlock(&f.lock);
+    mutex_free(&f.lock);
+    cond_free(&f.done);
+}
@@ -4,6 +4,7 @@
 #include "./metadesk/source/md.h"
 #include "./metadesk/source/md.c"
 #include <inttypes.h>
+#include <stdbool.h>
 
 /* Generates C code for a serializable struct. */
 void gen_struct(MD_Node *node);
@@ -20,11 +21,85 @@ void gen_struct(MD_Node *node);
    */
 void gen_tagun(MD_Node *node);
 
-static FILE *f;
+/* the fewest and most bytes a value of each type can take up on the wire,
+   so buffers big enough for any message can be sized at compile time.
+   the basic types' codecs are hand-written in common/common.h,
+   structs are added as they're generated. */
+typedef struct {
+    MD_String8 name;
+    uint64_t min_size, max_size;
+    /* its wire format is exactly its bytes in memory (on little endian
+       machines, and if the compiler didn't pad it) so it can be memcpy'd */
+    bool raw;
+    bool is_struct; /* so has a generated skip_ */
+    /* is or holds an istring, so it has a skip_ too, and it can only be
+       decoded in order, by a Reader with the connection's Intern */
+    bool interned;
+    MD_Node *fields; /* the first of a struct's fields */
+} TypeInfo;
+static TypeInfo types[512];
+static int type_count;
+/* the max_size of anything holding an array */
+#define UNBOUNDED UINT64_MAX
+void add_type(MD_String8 name, uint64_t min_size, uint64_t max_size, bool raw);
+TypeInfo *lookup_type(MD_String8 name);
+TypeInfo *find_type(MD_Node *type);
+
+/* what a field's type is, going by the nodes after its name */
+typedef enum {
+    /* `name: Type`, (de)serialized with Type's codec */
+    FieldKind_Plain,
+    /* `name: qfloat(min, max, precision)`, a float sent as a whole number of
+       `precision` sized steps above `min`, in as few bytes as that fits in */
+    FieldKind_QFloat,
+    /* `name: [Type]`, a varint count and then that many Types */
+    FieldKind_Array,
+} FieldKind;
+typedef struct {
+    FieldKind kind;
+    MD_Node *node;
+    TypeInfo *type; /* for FieldKind_Plain, and the elements of FieldKind_Array */
+    double min, max, precision; /* for FieldKind_QFloat */
+    uint64_t steps;
+    int bytes;
+} Field;
+Field parse_field(MD_Node *field);
+
+/* with FORMPACK_STATS defined, every kind of message gets a slot in
+   formpack_stats, each tagged union's kinds in a run starting here */
+static int stats_base;
+void gen_stats_table(MD_Node *code);
+
+/* the generated code, and random values and equality for test/ to round trip
+   them with, which the client and server have no use for */
+static FILE *f, *test_f;
 int main(int argument_count, char **arguments) {
-    MD_Node *code = MD_ParseWholeFile(MD_S8Lit("../formpack/formpack.dd"));
-    f = fopen("../formpack/build/formpack.h", "wb");
-    
+    /* `gen in.dd out.h random.h` for any other file, test/ has its own */
+    MD_String8 in = MD_S8Lit("../formpack/formpack.dd");
+    char *out = "../formpack/build/formpack.h";
+    char *test_out = "../formpack/build/formpack_random.h";
+    if (argument_count == 4)
+        in = MD_S8CString(arguments[1]), out = arguments[2], test_out = arguments[3];
+    MD_Node *code = MD_ParseWholeFile(in);
+    f = fopen(out, "wb");
+    test_f = fopen(test_out, "wb");
+
+    add_type(MD_S8Lit("String"), 1, 1 + UINT8_MAX, false);
+    /* a String that's sent as a one byte slot once it's been seen */
+    add_type(MD_S8Lit("istring"), 1, 2 + UINT8_MAX, false);
+    lookup_type(MD_S8Lit("istring"))->interned = true;
+    add_type(MD_S8Lit("uint16_t"), 2, 2, true);
+    /* not raw, anything but 0 or 1 has to be turned away */
+    add_type(MD_S8Lit("bool"), 1, 1, false);
+    add_type(MD_S8Lit("f32"), 4, 4, true);
+    /* LEB128 varints, zigzagged when signed */
+    add_type(MD_S8Lit("u32"), 1, 5, false);
+    add_type(MD_S8Lit("i32"), 1, 5, false);
+    add_type(MD_S8Lit("u64"), 1, 10, false);
+
+    /* a report of how big each message can get, to keep an eye on bandwidth */
+    printf("%-40s %s\n", "message", "bytes (with any qfloats as f32)");
+    gen_stats_table(code);
     for (MD_EachNode(node, code->first_child))
         if (MD_NodeHasTag(node, MD_S8Lit("struct")))
             gen_struct(node);
@@ -34,21 +109,38 @@ int main(int argument_count, char **arguments) {
     return 0;
 }
 
+void gen_struct_decl(MD_Node *_struct);
+void gen_struct_max_encoded_size(MD_Node *_struct);
 void gen_struct_encoded_size(MD_Node *_struct);
 void gen_struct_encode(MD_Node *_struct);
 void gen_struct_decode(MD_Node *_struct);
+void gen_struct_skip(MD_Node *_struct);
+void gen_struct_test(MD_Node *_struct);
 void gen_struct(MD_Node *_struct) {
-    MD_OutputTree_C_Struct(f, _struct);
+    gen_struct_decl(_struct);
+    gen_struct_max_encoded_size(_struct);
+    TypeInfo *type = lookup_type(_struct->string);
+    type->is_struct = true;
+    type->fields = _struct->first_child;
+    for (MD_EachNode(field, _struct->first_child)) {
+        Field fl = parse_field(field);
+        if (fl.type && fl.type->interned) type->interned = true;
+    }
     gen_struct_encoded_size(_struct);
     gen_struct_encode(_struct);
     gen_struct_decode(_struct);
+    gen_struct_skip(_struct);
+    gen_struct_test(_struct);
 }
 
 MD_String8 variant_struct_name(MD_Node *tagun, MD_Node *variant) ;
 void gen_tagun_decls(MD_Node *tagun);
+void gen_tagun_max_encoded_size(MD_Node *tagun);
 void gen_tagun_encoded_size(MD_Node *tagun);
 void gen_tagun_encode(MD_Node *tagun);
 void gen_tagun_decode(MD_Node *tagun);
+void gen_tagun_dispatch(MD_Node *tagun);
+void gen_tagun_test(MD_Node *tagun);
 void gen_tagun(MD_Node *tagun) {
     /* each field in our tagged union is also a struct, we generate
        (de)serialization code for those struct fields here */
@@ -59,11 +151,15 @@ void gen_tagun(MD_Node *tagun) {
     }
 
     /* and a tag enum + decl for the tagged union itself */
+    gen_tagun_max_encoded_size(tagun);
     gen_tagun_decls(tagun);
     /* then code to make all that (de)serializable */
     gen_tagun_encoded_size(tagun);
     gen_tagun_encode(tagun);
     gen_tagun_decode(tagun);
+    gen_tagun_dispatch(tagun);
+    gen_tagun_test(tagun);
+    stats_base += (int) MD_ChildCountFromNode(tagun);
 }
 
 
@@ -82,8 +178,83 @@ MD_String8 snake_case(MD_String8 s) {
     return MD_JoinStringListWithSeparator(result, MD_S8Lit("_"));
 }
 
-void assert_field_just_type(MD_Node *field) {
+bool string_is(MD_String8 s, const char *lit) {
+    return s.size == strlen(lit) && memcmp(s.str, lit, s.size) == 0;
+}
+
+/* reads the numbers in a set like (-512, 512, 0.01) into `out`,
+   returns how many there were */
+int parse_numbers(MD_Node *set, double *out, int max) {
+    int count = 0;
+    double sign = 1.0;
+    for (MD_EachNode(num, set->first_child)) {
+        /* a leading minus is a node of its own */
+        if (string_is(num->string, "-")) {
+            sign = -sign;
+            continue;
+        }
+        char buf[64], *end;
+        snprintf(buf, sizeof(buf), "%.*s", MD_StringExpand(num->string));
+        double value = strtod(buf, &end);
+        if (*end != '\0' || end == buf || count == max) {
+            MD_NodeErrorF(num, "expected one of %d numbers.", max);
+            abort();
+        }
+        out[count++] = sign * value;
+        sign = 1.0;
+    }
+    return count;
+}
+
+Field parse_field(MD_Node *field) {
+    Field fl = { .node = field };
+    MD_Node *type = field->first_child;
     int kid_count = MD_ChildCountFromNode(field);
+
+    if (kid_count == 2 && string_is(type->string, "qfloat")) {
+        double args[3];
+        if (!(type->next->flags & MD_NodeFlag_ParenLeft) ||
+            parse_numbers(type->next, args, 3) != 3) {
+            MD_NodeErrorF(field, "expected qfloat(min, max, precision).");
+            abort();
+        }
+        fl.kind = FieldKind_QFloat;
+        fl.min = args[0], fl.max = args[1], fl.precision = args[2];
+        if (!(fl.max > fl.min) || !(fl.precision > 0.0)) {
+            MD_NodeErrorF(field, "qfloat needs min < max and a positive precision.");
+            abort();
+        }
+        /* rounded up, so max is always in range */
+        double span = (fl.max - fl.min) / fl.precision;
+        if (span >= 4294967296.0) {
+            MD_NodeErrorF(field, "qfloat has more steps than fit in 4 bytes.");
+            abort();
+        }
+        fl.steps = (uint64_t) span;
+        if (fl.steps < span - 1e-9) fl.steps++;
+        for (fl.bytes = 1; fl.bytes < 4 && (fl.steps >> (fl.bytes * 8)); fl.bytes++);
+        if (fl.steps >> (fl.bytes * 8)) {
+            MD_NodeErrorF(field, "qfloat has more steps than fit in 4 bytes.");
+            abort();
+        }
+        return fl;
+    }
+
+    if (field->flags & MD_NodeFlag_BracketLeft) {
+        if (kid_count != 1 || !MD_NodeIsNil(type->first_child)) {
+            MD_NodeErrorF(field, "expected an array of one named type, like [Type].");
+            abort();
+        }
+        fl.kind = FieldKind_Array;
+        fl.type = find_type(type);
+        /* otherwise a tiny message could claim billions of elements */
+        if (fl.type->min_size == 0) {
+            MD_NodeErrorF(field, "arrays of types that can take up no bytes aren't supported.");
+            abort();
+        }
+        return fl;
+    }
+
     if (kid_count != 1) {
         MD_NodeErrorF(field,
                       "expected 1 type for field, "
@@ -91,6 +262,108 @@ void assert_field_just_type(MD_Node *field) {
                       kid_count);
         abort();
     }
+    fl.kind = FieldKind_Plain;
+    fl.type = find_type(type);
+    return fl;
+}
+
+MD_String8 field_c_type(Field *fl) {
+    switch (fl->kind) {
+    case (FieldKind_QFloat): return MD_S8Lit("float");
+    case (FieldKind_Array):
+        return MD_PushStringF("struct { %.*s *items; uint32_t len; }",
+                              MD_StringExpand(fl->type->name));
+    default: return fl->type->name;
+    }
+}
+
+uint64_t field_min_size(Field *fl) {
+    switch (fl->kind) {
+    case (FieldKind_QFloat): return fl->bytes;
+    case (FieldKind_Array): return 1; /* an empty one's count */
+    default: return fl->type->min_size;
+    }
+}
+
+uint64_t field_max_size(Field *fl) {
+    switch (fl->kind) {
+    case (FieldKind_QFloat): return fl->bytes;
+    case (FieldKind_Array): return UNBOUNDED;
+    default: return fl->type->max_size;
+    }
+}
+
+bool field_raw(Field *fl) {
+    return fl->kind == FieldKind_Plain && fl->type->raw;
+}
+
+uint64_t size_add(uint64_t a, uint64_t b) {
+    return (a > UNBOUNDED - b) ? UNBOUNDED : a + b;
+}
+
+void print_size_range(uint64_t min_size, uint64_t max_size) {
+    if (max_size == UNBOUNDED)
+        printf("%" PRIu64 "..unbounded", min_size);
+    else
+        printf("%" PRIu64 "..%" PRIu64, min_size, max_size);
+}
+
+/* the arguments after the value in encode_qfloat and decode_qfloat */
+void print_qfloat_args(Field *fl) {
+    fprintf(f, "%.17g, %.17g, %" PRIu64 "u, %d",
+            fl->min, fl->precision, fl->steps, fl->bytes);
+}
+
+/* code timing a message for formpack_stats, compiled out unless FORMPACK_STATS is.
+   print_stat_start goes where formpack starts working on the message,
+   print_stat where it's done, `from` and `to` bounding its bytes */
+void print_stat_start(void) {
+    fprintf(f, "#ifdef FORMPACK_STATS\n");
+    fprintf(f, "uint64_t stat_start = formpack_nanos();\n");
+    fprintf(f, "#endif\n");
+}
+void print_stat(const char *which, MD_String8 kind, const char *from, const char *to) {
+    fprintf(f, "#ifdef FORMPACK_STATS\n");
+    fprintf(f, "formpack_stat_add(&formpack_stats[%d + %.*s].%s, (size_t) (%s - %s), stat_start);\n",
+           stats_base, MD_StringExpand(kind), which, to, from);
+    fprintf(f, "#endif\n");
+}
+
+MD_String8 upper_snake_case(MD_String8 s) {
+    MD_String8 snake = snake_case(s);
+    MD_String8 upper = MD_PushStringF("%.*s", MD_StringExpand(snake));
+    for (uint64_t i = 0; i < upper.size; i++)
+        if (upper.str[i] >= 'a' && upper.str[i] <= 'z')
+            upper.str[i] -= 'a' - 'A';
+    return upper;
+}
+
+void add_type(MD_String8 name, uint64_t min_size, uint64_t max_size, bool raw) {
+    if (type_count == sizeof(types) / sizeof(types[0])) {
+        fprintf(stderr, "too many types, raise the size of `types` in gen.c\n");
+        abort();
+    }
+    types[type_count++] = (TypeInfo) {
+        .name = name,
+        .min_size = min_size,
+        .max_size = max_size,
+        .raw = raw,
+    };
+}
+
+TypeInfo *lookup_type(MD_String8 name) {
+    for (int i = 0; i < type_count; i++)
+        if (types[i].name.size == name.size &&
+            memcmp(types[i].name.str, name.str, name.size) == 0)
+            return &types[i];
+    return NULL;
+}
+
+TypeInfo *find_type(MD_Node *type) {
+    TypeInfo *found = lookup_type(type->string);
+    if (found) return found;
+    MD_NodeErrorF(type, "unknown type, types must be declared before use.");
+    abort();
 }
 
 MD_String8 variant_struct_name(MD_Node *tagun, MD_Node *variant) {
@@ -106,7 +379,89 @@ MD_String8 variant_kind(MD_Node *tagun, MD_Node *variant) {
 }
 
 
+/* whether a struct always encodes to the same number of bytes */
+bool struct_fixed(MD_Node *stru) {
+    TypeInfo *type = lookup_type(stru->string);
+    return type->min_size == type->max_size;
+}
+
+/* straight-line code (de)serializing the fixed size fields from `first` on,
+   at `*offset` bytes into `data` (or `b`, when decoding), with nested structs
+   flattened into their fields. `prefix` is what goes before a field's name. */
+void gen_fixed_fields(MD_Node *first, MD_String8 prefix, uint64_t *offset, bool encode) {
+    for (MD_EachNode(field, first)) {
+        Field fl = parse_field(field);
+        MD_String8 path = MD_PushStringF("%.*s%.*s",
+                                         MD_StringExpand(prefix),
+                                         MD_StringExpand(field->string));
+        if (fl.kind == FieldKind_Plain && fl.type->is_struct) {
+            gen_fixed_fields(fl.type->fields,
+                             MD_PushStringF("%.*s.", MD_StringExpand(path)),
+                             offset, encode);
+            continue;
+        }
+
+        uint64_t o = *offset;
+        int bytes = (int) field_max_size(&fl);
+        *offset += bytes;
+        bool is_bool = fl.kind == FieldKind_Plain && string_is(fl.type->name, "bool");
+        /* qfloats and f32s go through a u32, the rest are uint16_t and bool */
+        bool via_u32 = fl.kind == FieldKind_QFloat || string_is(fl.type->name, "f32");
+
+        if (encode) {
+            if (!via_u32) {
+                for (int i = 0; i < bytes; i++)
+                    fprintf(f, "data[%" PRIu64 "] = (uint8_t) (%.*s >> %d);\n",
+                           o + i, MD_StringExpand(path), i * 8);
+                continue;
+            }
+            if (fl.kind == FieldKind_QFloat)
+                fprintf(f, "{ uint32_t u = qfloat_quantize(%.*s, %.17g, %.17g, %" PRIu64 "u);",
+                       MD_StringExpand(path), fl.min, fl.precision, fl.steps);
+            else
+                fprintf(f, "{ uint32_t u; memcpy(&u, &%.*s, 4);", MD_StringExpand(path));
+            for (int i = 0; i < bytes; i++)
+                fprintf(f, " data[%" PRIu64 "] = (uint8_t) (u >> %d);", o + i, i * 8);
+            fprintf(f, " }\n");
+            continue;
+        }
+
+        if (is_bool) {
+            fprintf(f, "if (b[%" PRIu64 "] > 1) reader_fail(r, FormpackErr_BadValue);\n", o);
+            fprintf(f, "%.*s = b[%" PRIu64 "] == 1;\n", MD_StringExpand(path), o);
+            continue;
+        }
+        if (!via_u32) {
+            fprintf(f, "%.*s = (uint16_t) (b[%" PRIu64 "] | (b[%" PRIu64 "] << 8));\n",
+                   MD_StringExpand(path), o, o + 1);
+            continue;
+        }
+        fprintf(f, "{ uint32_t u = 0");
+        for (int i = 0; i < bytes; i++)
+            fprintf(f, " | ((uint32_t) b[%" PRIu64 "] << %d)", o + i, i * 8);
+        fprintf(f, ";");
+        if (fl.kind == FieldKind_QFloat)
+            fprintf(f, " if (u > %" PRIu64 "u) { reader_fail(r, FormpackErr_BadValue); u = 0; }"
+                   " %.*s = qfloat_value(u, %.17g, %.17g); }\n",
+                   fl.steps, MD_StringExpand(path), fl.min, fl.precision);
+        else
+            fprintf(f, " memcpy(&%.*s, &u, 4); }\n", MD_StringExpand(path));
+    }
+}
+
+
 // -------------------------- DECLS ----------------------------------
+void gen_struct_decl(MD_Node *stru) {
+    fprintf(f, "typedef struct %.*s {\n", MD_StringExpand(stru->string));
+    for (MD_EachNode(field, stru->first_child)) {
+        Field fl = parse_field(field);
+        fprintf(f, "%.*s %.*s;\n",
+               MD_StringExpand(field_c_type(&fl)),
+               MD_StringExpand(field->string));
+    }
+    fprintf(f, "} %.*s;\n\n", MD_StringExpand(stru->string));
+}
+
 void gen_tagun_decls(MD_Node *node) {
     /*  here we generate the tag enum */
     fprintf(f, "typedef enum {\n");
@@ -134,41 +489,175 @@ void gen_tagun_decls(MD_Node *node) {
         MD_String8 variant_struct = variant_struct_name(node, variant);
         fprintf(f, "#define send_%.*s(mdk, ws) do {\\\n",
                MD_StringExpand(snake_case(variant_struct)));
-        fprintf(f, " Pack _p = pack_%.*s(\\\n", MD_StringExpand(snake_case(node->string)));
-        fprintf(f, "  &(%.*s) {\\\n", MD_StringExpand(node->string));
-        fprintf(f, "   .kind = %.*s,\\\n", MD_StringExpand(variant_kind(node, variant)));
-        fprintf(f, "   .%.*s = (mdk),\\\n", MD_StringExpand(snake_case(variant->string)));
-        fprintf(f, "  });\\\n"); // end call
-        fprintf(f, " bqws_send_binary((ws), _p.data, _p.size);\\\n"); // end call
-        fprintf(f, " free(_p.data);\\\n"); // end call
+        if (lookup_type(variant_struct)->max_size == UNBOUNDED) {
+            /* could be any size, so it goes on the heap */
+            fprintf(f, " send_frame_%.*s((&(%.*s) {\\\n",
+                   MD_StringExpand(snake_case(node->string)),
+                   MD_StringExpand(node->string));
+            fprintf(f, "   .kind = %.*s,\\\n", MD_StringExpand(variant_kind(node, variant)));
+            fprintf(f, "   .%.*s = (mdk),\\\n", MD_StringExpand(snake_case(variant->string)));
+            fprintf(f, "  }), (ws));\\\n"); // end call
+        } else {
+            /* encoded on the stack, which is always big enough,
+               after a byte for the frame's flag and one for the kind */
+            fprintf(f, " uint8_t _buf[2 + %.*s_MAX_ENCODED_SIZE];\\\n",
+                   MD_StringExpand(upper_snake_case(variant_struct)));
+            fprintf(f, " uint32_t _size = pack_%.*s_into(\\\n", MD_StringExpand(snake_case(node->string)));
+            fprintf(f, "  &(%.*s) {\\\n", MD_StringExpand(node->string));
+            fprintf(f, "   .kind = %.*s,\\\n", MD_StringExpand(variant_kind(node, variant)));
+            fprintf(f, "   .%.*s = (mdk),\\\n", MD_StringExpand(snake_case(variant->string)));
+            fprintf(f, "  }, _buf + 1, sizeof(_buf) - 1, NULL);\\\n"); // end call
+            fprintf(f, " frame_send((ws), _buf, _size);\\\n"); // end call
+        }
         fprintf(f, "} while (false)\\\n\n\n"); // end constructor macro
     }
+
+    /* sends a message in a frame of its own, from the heap.
+       messages over FORMPACK_MAX_SIZE aren't sent. */
+    MD_String8 snake = snake_case(node->string);
+    fprintf(f, "#define send_frame_%.*s(d, ws) do {\\\n", MD_StringExpand(snake));
+    fprintf(f, " %.*s *_fd = (d);\\\n", MD_StringExpand(node->string));
+    fprintf(f, " size_t _cap = encoded_size_%.*s(_fd);\\\n", MD_StringExpand(snake));
+    fprintf(f, " uint8_t *_frame = (uint8_t *) malloc(1 + _cap);\\\n");
+    fprintf(f, " uint32_t _len = pack_%.*s_into(_fd, _frame + 1, _cap, NULL);\\\n",
+           MD_StringExpand(snake));
+    fprintf(f, " if (_len) frame_send((ws), _frame, _len);\\\n");
+    fprintf(f, " free(_frame);\\\n");
+    fprintf(f, "} while (false)\n\n");
+
+    /* the same again, but appending to a Batch to be sent as part of one frame.
+       if the batch is too full it's sent first, and should a message not fit
+       even in an empty one, it's sent on its own */
+    fprintf(f, "#define batch_send_%.*s(d, b, ws) do {\\\n", MD_StringExpand(snake));
+    fprintf(f, " %.*s *_d = (d);\\\n", MD_StringExpand(node->string));
+    fprintf(f, " if (!batch_%.*s((b), _d)) {\\\n", MD_StringExpand(snake));
+    fprintf(f, "  batch_flush((b), (ws));\\\n");
+    fprintf(f, "  if (!batch_%.*s((b), _d)) {\\\n", MD_StringExpand(snake));
+    fprintf(f, "   send_frame_%.*s(_d, (ws));\\\n", MD_StringExpand(snake));
+    fprintf(f, "  }\\\n");
+    fprintf(f, " }\\\n");
+    fprintf(f, "} while (false)\n\n");
+    for (MD_EachNode(variant, node->first_child)) {
+        fprintf(f, "#define batch_%.*s(mdk, b, ws) batch_send_%.*s(\\\n",
+               MD_StringExpand(snake_case(variant_struct_name(node, variant))),
+               MD_StringExpand(snake));
+        /* parenthesized, or its commas would split it into more arguments */
+        fprintf(f, " (&(%.*s) {\\\n", MD_StringExpand(node->string));
+        fprintf(f, "  .kind = %.*s,\\\n", MD_StringExpand(variant_kind(node, variant)));
+        fprintf(f, "  .%.*s = (mdk),\\\n", MD_StringExpand(snake_case(variant->string)));
+        fprintf(f, " }), (b), (ws))\n\n");
+    }
+}
+
+
+// -------------------------- MAX ENCODED SIZE ----------------------------------
+void gen_struct_max_encoded_size(MD_Node *stru) {
+    uint64_t min_size = 0, max_size = 0, f32_min = 0, f32_max = 0;
+    bool quantized = false, raw = true;
+    for (MD_EachNode(field, stru->first_child)) {
+        Field fl = parse_field(field);
+        min_size += field_min_size(&fl), max_size = size_add(max_size, field_max_size(&fl));
+        quantized |= fl.kind == FieldKind_QFloat;
+        raw &= field_raw(&fl);
+        f32_min += (fl.kind == FieldKind_QFloat) ? 4 : field_min_size(&fl);
+        f32_max = size_add(f32_max, (fl.kind == FieldKind_QFloat) ? 4 : field_max_size(&fl));
+    }
+    add_type(stru->string, min_size, max_size, raw);
+    /* arrays have no upper bound, short of FORMPACK_MAX_SIZE */
+    if (max_size != UNBOUNDED)
+        fprintf(f, "#define %.*s_MAX_ENCODED_SIZE %" PRIu64 "\n\n",
+               MD_StringExpand(upper_snake_case(stru->string)),
+               max_size);
+    if (min_size == max_size)
+        fprintf(f, "#define %.*s_ENCODED_SIZE %" PRIu64 "\n\n",
+               MD_StringExpand(upper_snake_case(stru->string)),
+               max_size);
+
+    printf("%-40.*s ", MD_StringExpand(stru->string));
+    print_size_range(min_size, max_size);
+    if (quantized) {
+        printf(" (");
+        print_size_range(f32_min, f32_max);
+        printf(")");
+    }
+    printf("\n");
+}
+
+void gen_tagun_max_encoded_size(MD_Node *node) {
+    /* one byte for the variant, then room for the biggest one */
+    uint64_t max_size = 0;
+    for (MD_EachNode(variant, node->first_child)) {
+        uint64_t variant_size = 0;
+        for (MD_EachNode(field, variant->first_child)) {
+            Field fl = parse_field(field);
+            variant_size = size_add(variant_size, field_max_size(&fl));
+        }
+        if (variant_size > max_size) max_size = variant_size;
+    }
+    /* messages with arrays are checked as they're packed instead */
+    if (max_size == UNBOUNDED) {
+        fprintf(f, "#define %.*s_MAX_ENCODED_SIZE FORMPACK_MAX_SIZE\n",
+               MD_StringExpand(upper_snake_case(node->string)));
+        fprintf(f, "#define %.*s_UNBOUNDED\n\n",
+               MD_StringExpand(upper_snake_case(node->string)));
+        return;
+    }
+    /* the send_ macros pack these on the stack */
+    if (1 + max_size > UINT16_MAX) {
+        MD_NodeErrorF(node, "messages with no arrays can't be over 64KB.");
+        abort();
+    }
+    fprintf(f, "#define %.*s_MAX_ENCODED_SIZE %" PRIu64 "\n\n",
+           MD_StringExpand(upper_snake_case(node->string)),
+           1 + max_size);
 }
 
 
 // -------------------------- ENCODED SIZE ----------------------------------
 void gen_struct_encoded_size(MD_Node *stru) {
-    fprintf(f, "uint16_t encoded_size_%.*s(%.*s *v) {\n",
+    /* a size_t, arrays can add up to more than FORMPACK_MAX_SIZE */
+    fprintf(f, "size_t encoded_size_%.*s(%.*s *v) {\n",
            MD_StringExpand(snake_case(stru->string)),
            MD_StringExpand(stru->string));
-    fprintf(f, "return 0");
+    if (struct_fixed(stru)) {
+        fprintf(f, "(void) v;\n");
+        fprintf(f, "return %.*s_ENCODED_SIZE;\n}\n\n",
+               MD_StringExpand(upper_snake_case(stru->string)));
+        return;
+    }
+    if (MD_NodeIsNil(stru->first_child)) fprintf(f, "(void) v;\n");
+    fprintf(f, "size_t size = 0;\n");
     for (MD_EachNode(field, stru->first_child)) {
-        assert_field_just_type(field);
-        MD_Node *type = field->first_child;
-        fprintf(f, "\n + encoded_size_%.*s(&v->%.*s)",
-               MD_StringExpand(snake_case(type->string)),
-               MD_StringExpand(field->string));
+        Field fl = parse_field(field);
+        MD_String8 name = field->string;
+        if (fl.kind == FieldKind_QFloat)
+            fprintf(f, "size += %d;\n", fl.bytes);
+        else if (fl.kind == FieldKind_Array) {
+            fprintf(f, "size += encoded_size_varint(v->%.*s.len);\n", MD_StringExpand(name));
+            if (fl.type->min_size == fl.type->max_size)
+                fprintf(f, "size += (size_t) v->%.*s.len * %" PRIu64 ";\n",
+                       MD_StringExpand(name), fl.type->max_size);
+            else
+                fprintf(f, "for (uint32_t i = 0; i < v->%.*s.len; i++)"
+                       " size += encoded_size_%.*s(&v->%.*s.items[i]);\n",
+                       MD_StringExpand(name),
+                       MD_StringExpand(snake_case(fl.type->name)),
+                       MD_StringExpand(name));
+        } else
+            fprintf(f, "size += encoded_size_%.*s(&v->%.*s);\n",
+                   MD_StringExpand(snake_case(fl.type->name)),
+                   MD_StringExpand(name));
     }
-    fprintf(f, ";\n}\n\n"); // end encoded_size_<stru> function
+    fprintf(f, "return size;\n}\n\n"); // end encoded_size_<stru> function
 }
 
 void gen_tagun_encoded_size(MD_Node *node) {
     /* returns size of the entire tagged union */
-    fprintf(f, "uint16_t encoded_size_%.*s(%.*s *d) {\n", 
+    fprintf(f, "size_t encoded_size_%.*s(%.*s *d) {\n", 
            MD_StringExpand(snake_case(node->string)),
            MD_StringExpand(node->string));
     /*  one byte for the variant */
-    fprintf(f, "uint16_t nbytes = 1;\n");
+    fprintf(f, "size_t nbytes = 1;\n");
     fprintf(f, "switch (d->kind) {\n");
     for (MD_EachNode(variant, node->first_child)) {
         fprintf(f, "case (%.*s):\n", MD_StringExpand(variant_kind(node, variant)));
@@ -182,81 +671,422 @@ void gen_tagun_encoded_size(MD_Node *node) {
 
 
 // -------------------------- ENCODE ----------------------------------
+/* the trailing argument for a call to the type's encoder */
+const char *intern_arg(TypeInfo *type) {
+    return (type->is_struct || type->interned) ? ", intern" : "";
+}
+
 void gen_struct_encode(MD_Node *stru) {
-    fprintf(f, "uint8_t *encode_%.*s(uint8_t *data, %.*s *v) {\n",
+    /* every struct's encoder takes the Intern, so callers needn't know
+       which ones hold istrings */
+    fprintf(f, "uint8_t *encode_%.*s(uint8_t *data, %.*s *v, Intern *intern) {\n",
            MD_StringExpand(snake_case(stru->string)),
            MD_StringExpand(stru->string));
+    if (!lookup_type(stru->string)->interned) fprintf(f, "(void) intern;\n");
+    if (struct_fixed(stru)) {
+        /* every field's at a known offset, so they're written straight out */
+        if (MD_NodeIsNil(stru->first_child)) fprintf(f, "(void) v;\n");
+        uint64_t offset = 0;
+        gen_fixed_fields(stru->first_child, MD_S8Lit("v->"), &offset, true);
+        fprintf(f, "return data + %.*s_ENCODED_SIZE;\n}\n\n",
+               MD_StringExpand(upper_snake_case(stru->string)));
+        return;
+    }
+    if (MD_NodeIsNil(stru->first_child)) fprintf(f, "(void) v;\n");
     for (MD_EachNode(field, stru->first_child)) {
-        assert_field_just_type(field);
-        MD_Node *type = field->first_child;
-        fprintf(f, "data = encode_%.*s(data, &v->%.*s);\n",
-               MD_StringExpand(snake_case(type->string)),
-               MD_StringExpand(field->string));
+        Field fl = parse_field(field);
+        if (fl.kind == FieldKind_QFloat) {
+            fprintf(f, "data = encode_qfloat(data, v->%.*s, ", MD_StringExpand(field->string));
+            print_qfloat_args(&fl);
+            fprintf(f, ");\n");
+        } else if (fl.kind == FieldKind_Array) {
+            MD_String8 name = field->string;
+            fprintf(f, "data = encode_varint(data, v->%.*s.len);\n", MD_StringExpand(name));
+            /* one memcpy for the lot, if they're laid out like they're sent */
+            if (fl.type->raw)
+                fprintf(f, "if (formpack_is_raw(%.*s, %" PRIu64 "))"
+                       " data = encode_raw_array(data, v->%.*s.items, v->%.*s.len, %" PRIu64 ");\n"
+                       "else ",
+                       MD_StringExpand(fl.type->name), fl.type->max_size,
+                       MD_StringExpand(name), MD_StringExpand(name), fl.type->max_size);
+            fprintf(f, "for (uint32_t i = 0; i < v->%.*s.len; i++)"
+                   " data = encode_%.*s(data, &v->%.*s.items[i]%s);\n",
+                   MD_StringExpand(name),
+                   MD_StringExpand(snake_case(fl.type->name)),
+                   MD_StringExpand(name), intern_arg(fl.type));
+        } else
+            fprintf(f, "data = encode_%.*s(data, &v->%.*s%s);\n",
+                   MD_StringExpand(snake_case(fl.type->name)),
+                   MD_StringExpand(field->string), intern_arg(fl.type));
     }
     fprintf(f, "return data;\n}\n\n"); // end encode<stru> function
 }
 
 void gen_tagun_encode(MD_Node *node) {
-    /* serialization entry point, returns entire tagged union encoded */
-    fprintf(f, "Pack pack_%.*s(%.*s *d) {\n", 
+    /* serialization entry point, encodes the entire tagged union into `buf`.
+       returns how many bytes that took, or 0 if it wouldn't fit in `cap`.
+       `intern` is what's been sent on the connection, or NULL to send
+       any istrings in full. it's only added to if the message is packed. */
+    fprintf(f, "uint32_t pack_%.*s_into(%.*s *d, uint8_t *buf, size_t cap, Intern *intern) {\n",
            MD_StringExpand(snake_case(node->string)),
            MD_StringExpand(node->string));
-    fprintf(f, "uint16_t size = encoded_size_%.*s(d);\n"
-           "uint8_t *data = (uint8_t *) malloc(size);\n",
+    fprintf(f, "#ifdef %.*s_UNBOUNDED\n", MD_StringExpand(upper_snake_case(node->string)));
+    fprintf(f, "size_t size = encoded_size_%.*s(d);\n", MD_StringExpand(snake_case(node->string)));
+    fprintf(f, "if (size > cap || size > FORMPACK_MAX_SIZE) return 0;\n");
+    fprintf(f, "#else\n");
+    /* a buffer of the max size needs no checking */
+    fprintf(f, "if (cap < %.*s_MAX_ENCODED_SIZE && cap < encoded_size_%.*s(d)) return 0;\n",
+           MD_StringExpand(upper_snake_case(node->string)),
            MD_StringExpand(snake_case(node->string)));
-    fprintf(f, "uint8_t *writer = data;\n");
+    fprintf(f, "#endif\n");
+    print_stat_start();
+    fprintf(f, "uint8_t *writer = buf;\n");
     /* next is the variant of the message */
     fprintf(f, "*writer++ = (uint8_t) d->kind;\n");
     fprintf(f, "switch (d->kind) {\n");
     for (MD_EachNode(variant, node->first_child)) {
         fprintf(f, "case (%.*s):\n",
                MD_StringExpand(variant_kind(node, variant)));
-        fprintf(f, " writer = encode_%.*s(writer, &d->%.*s);\n break;\n",
+        fprintf(f, " writer = encode_%.*s(writer, &d->%.*s, intern);\n break;\n",
                MD_StringExpand(snake_case(variant_struct_name(node, variant))),
                MD_StringExpand(snake_case(variant->string)));
     }
     fprintf(f, "}\n"); // end switch
-    fprintf(f, "return (Pack) { .data = data, .size = size };\n}\n\n"); // end pack<tagged union>
+    print_stat("packed", MD_S8Lit("d->kind"), "buf", "writer");
+    fprintf(f, "return (uint32_t) (writer - buf);\n}\n\n"); // end pack_into<tagged union>
+
+    /* returns entire tagged union encoded, in memory that needs freeing,
+       or an empty Pack if it's over FORMPACK_MAX_SIZE */
+    fprintf(f, "Pack pack_%.*s(%.*s *d) {\n",
+           MD_StringExpand(snake_case(node->string)),
+           MD_StringExpand(node->string));
+    fprintf(f, "size_t size = encoded_size_%.*s(d);\n"
+           "if (size > FORMPACK_MAX_SIZE) return (Pack) { 0 };\n"
+           "uint8_t *data = (uint8_t *) malloc(size);\n",
+           MD_StringExpand(snake_case(node->string)));
+    fprintf(f, "uint32_t len = pack_%.*s_into(d, data, size, NULL);\n",
+           MD_StringExpand(snake_case(node->string)));
+    fprintf(f, "return (Pack) { .data = data, .size = len };\n}\n\n"); // end pack<tagged union>
+
+    /* appends the encoded tagged union to `b`,
+       returns false, leaving `b` as it was, if there isn't room */
+    fprintf(f, "bool batch_%.*s(Batch *b, %.*s *d) {\n",
+           MD_StringExpand(snake_case(node->string)),
+           MD_StringExpand(node->string));
+    fprintf(f, "if (b->data == NULL) b->data = (uint8_t *) malloc(1 + BATCH_CAP);\n");
+    fprintf(f, "uint32_t size = pack_%.*s_into(d, b->data + 1 + b->len, BATCH_CAP - b->len, b->intern);\n",
+           MD_StringExpand(snake_case(node->string)));
+    fprintf(f, "b->len += size;\n");
+    fprintf(f, "return size != 0;\n}\n\n"); // end batch<tagged union>
 }
 
 
 // -------------------------- DECODE ----------------------------------
 void gen_struct_decode(MD_Node *stru) {
-    fprintf(f, "%.*s decode_%.*s(uint8_t **data) {\n",
+    fprintf(f, "%.*s decode_%.*s(Reader *r) {\n",
            MD_StringExpand(stru->string),
            MD_StringExpand(snake_case(stru->string)));
-    fprintf(f, "return (%.*s) {\n", MD_StringExpand(stru->string));
+    /* one statement per field, because the order the expressions in an
+       initializer list are evaluated in is unspecified */
+    if (struct_fixed(stru)) {
+        /* one bounds check for the whole thing, then the fields are read
+           straight out of it */
+        fprintf(f, "%.*s v = { 0 };\n", MD_StringExpand(stru->string));
+        fprintf(f, "uint8_t *b = reader_take(r, %.*s_ENCODED_SIZE);\n",
+               MD_StringExpand(upper_snake_case(stru->string)));
+        fprintf(f, "if (b == NULL) return v;\n");
+        uint64_t offset = 0;
+        gen_fixed_fields(stru->first_child, MD_S8Lit("v."), &offset, false);
+        fprintf(f, "return v;\n}\n\n");
+        return;
+    }
+    fprintf(f, "%.*s v;\n", MD_StringExpand(stru->string));
+    if (MD_NodeIsNil(stru->first_child)) fprintf(f, "(void) r;\n");
     for (MD_EachNode(field, stru->first_child)) {
-        assert_field_just_type(field);
-        MD_Node *type = field->first_child;
-        fprintf(f, ".%.*s = decode_%.*s(data),\n",
-               MD_StringExpand(field->string),
-               MD_StringExpand(snake_case(type->string)));
+        Field fl = parse_field(field);
+        if (fl.kind == FieldKind_QFloat) {
+            fprintf(f, "v.%.*s = decode_qfloat(r, ", MD_StringExpand(field->string));
+            print_qfloat_args(&fl);
+            fprintf(f, ");\n");
+        } else if (fl.kind == FieldKind_Array) {
+            MD_String8 name = field->string;
+            fprintf(f, "v.%.*s.len = decode_array_len(r, %" PRIu64 ");\n",
+                   MD_StringExpand(name), fl.type->min_size);
+            fprintf(f, "v.%.*s.items = reader_alloc(r, v.%.*s.len, sizeof(%.*s));\n",
+                   MD_StringExpand(name), MD_StringExpand(name),
+                   MD_StringExpand(fl.type->name));
+            if (fl.type->raw)
+                fprintf(f, "if (formpack_is_raw(%.*s, %" PRIu64 "))"
+                       " decode_raw_array(r, v.%.*s.items, v.%.*s.len, %" PRIu64 ");\n"
+                       "else ",
+                       MD_StringExpand(fl.type->name), fl.type->max_size,
+                       MD_StringExpand(name), MD_StringExpand(name), fl.type->max_size);
+            fprintf(f, "for (uint32_t i = 0; i < v.%.*s.len; i++)"
+                   " v.%.*s.items[i] = decode_%.*s(r);\n",
+                   MD_StringExpand(name), MD_StringExpand(name),
+                   MD_StringExpand(snake_case(fl.type->name)));
+        } else
+            fprintf(f, "v.%.*s = decode_%.*s(r);\n",
+                   MD_StringExpand(field->string),
+                   MD_StringExpand(snake_case(fl.type->name)));
     }
-    fprintf(f, "};\n}\n\n"); // end encode<variant> function
+    fprintf(f, "return v;\n}\n\n"); // end decode<stru> function
 }
 
 void gen_tagun_decode(MD_Node *node) {
-    /* deserialization entry point, returns entire tagged union decoded */
-    fprintf(f, "%.*s unpack_%.*s(uint8_t *data) {\n", 
+    /* decodes one tagged union from `r`, setting `r->err` if it can't */
+    fprintf(f, "%.*s decode_%.*s(Reader *r) {\n",
            MD_StringExpand(node->string),
            MD_StringExpand(snake_case(node->string)));
-
-    fprintf(f, "%.*sKind kind = (%.*sKind) *data++;\n",
+    print_stat_start();
+    fprintf(f, "uint8_t *start = r->at;\n");
+    fprintf(f, "%.*s d = { .kind = (%.*sKind) reader_byte(r) };\n",
           MD_StringExpand(node->string),
           MD_StringExpand(node->string));
     /* next is the variant of the message */
-    fprintf(f, "switch (kind) {\n");
+    fprintf(f, "switch (d.kind) {\n");
     for (MD_EachNode(variant, node->first_child)) {
         fprintf(f, "case (%.*s):\n", MD_StringExpand(variant_kind(node, variant)));
-        fprintf(f, " return (%.*s) {\n", MD_StringExpand(node->string));
-        fprintf(f, "  .kind = kind,\n");
-        fprintf(f, "  .%.*s = decode_%.*s(&data),\n",
+        fprintf(f, " d.%.*s = decode_%.*s(r);\n break;\n",
                MD_StringExpand(snake_case(variant->string)),
                MD_StringExpand(snake_case(variant_struct_name(node, variant))));
-        fprintf(f, " };\n"); // end return
     }
-    fprintf(f, "default: abort();\n");
+    fprintf(f, "default: reader_fail(r, FormpackErr_BadKind);\n");
     fprintf(f, "}\n"); // end switch
+    fprintf(f, "(void) start;\n");
+    fprintf(f, "if (r->err == FormpackErr_None) {\n");
+    print_stat("unpacked", MD_S8Lit("d.kind"), "start", "r->at");
+    fprintf(f, "}\n");
+    fprintf(f, "return d;\n}\n\n"); // end decode<tagged union>
+
+    /* deserialization entry point, decodes the `size` bytes at `data` into `out`.
+       Strings in `out` point into `data`, arrays into `scratch`.
+       returns FormpackErr_None, or what's wrong with the message */
+    fprintf(f, "FormpackErr unpack_%.*s(uint8_t *data, size_t size, Scratch *scratch, %.*s *out) {\n",
+           MD_StringExpand(snake_case(node->string)),
+           MD_StringExpand(node->string));
+    fprintf(f, "Reader r = { .at = data, .end = data + size, .scratch = scratch };\n");
+    fprintf(f, "*out = decode_%.*s(&r);\n", MD_StringExpand(snake_case(node->string)));
+    fprintf(f, "if (r.err == FormpackErr_None && r.at != r.end) r.err = FormpackErr_TrailingBytes;\n");
+    fprintf(f, "return r.err;\n");
     fprintf(f, "}\n\n"); // end unpack<tagged union>
+
+    /* for frames sent from a Batch, which are messages back to back.
+       decodes the next one into `out`, returns false once there are none left
+       or one couldn't be decoded, in which case `r->err` says why */
+    fprintf(f, "bool unpack_next_%.*s(Reader *r, %.*s *out) {\n",
+           MD_StringExpand(snake_case(node->string)),
+           MD_StringExpand(node->string));
+    fprintf(f, "if (r->err != FormpackErr_None || r->at == r->end) return false;\n");
+    fprintf(f, "*out = decode_%.*s(r);\n", MD_StringExpand(snake_case(node->string)));
+    fprintf(f, "return r->err == FormpackErr_None;\n");
+    fprintf(f, "}\n\n"); // end unpack_next<tagged union>
+}
+
+
+// -------------------------- SKIP ----------------------------------
+/* a statement moving `r` past a value of the field's type without decoding
+   it, for dispatch to step over messages nobody handles */
+void print_skip_value(TypeInfo *type) {
+    if (type->min_size == type->max_size)
+        fprintf(f, "reader_take(r, %" PRIu64 ");", type->max_size);
+    else if (type->is_struct || type->interned)
+        fprintf(f, "skip_%.*s(r);", MD_StringExpand(snake_case(type->name)));
+    else
+        /* the variable sized basic types decode without allocating */
+        fprintf(f, "(void) decode_%.*s(r);", MD_StringExpand(snake_case(type->name)));
+}
+
+void print_skip_field(Field *fl) {
+    switch (fl->kind) {
+    case (FieldKind_QFloat):
+        fprintf(f, "reader_take(r, %d);", fl->bytes);
+        break;
+    case (FieldKind_Array):
+        fprintf(f, "{ uint32_t len = decode_array_len(r, %" PRIu64 "); ", fl->type->min_size);
+        if (fl->type->min_size == fl->type->max_size)
+            fprintf(f, "reader_take(r, (size_t) len * %" PRIu64 "); }", fl->type->max_size);
+        else {
+            fprintf(f, "for (uint32_t i = 0; i < len; i++) ");
+            print_skip_value(fl->type);
+            fprintf(f, " }");
+        }
+        break;
+    default:
+        print_skip_value(fl->type);
+    }
+}
+
+void gen_struct_skip(MD_Node *stru) {
+    fprintf(f, "void skip_%.*s(Reader *r) {\n", MD_StringExpand(snake_case(stru->string)));
+    if (MD_NodeIsNil(stru->first_child)) fprintf(f, "(void) r;\n");
+    for (MD_EachNode(field, stru->first_child)) {
+        Field fl = parse_field(field);
+        print_skip_field(&fl);
+        fprintf(f, "\n");
+    }
+    fprintf(f, "}\n\n"); // end skip<stru> function
+}
+
+
+// -------------------------- DISPATCH ----------------------------------
+/* a table with a handler for each variant, and a function that decodes
+   the messages in a frame and calls the right one for each, so consumers
+   needn't switch on `kind` themselves */
+void gen_tagun_dispatch(MD_Node *node) {
+    MD_String8 snake = snake_case(node->string);
+    fprintf(f, "typedef struct {\n");
+    for (MD_EachNode(variant, node->first_child))
+        fprintf(f, "void (*%.*s)(void *ctx, %.*s *msg);\n",
+               MD_StringExpand(snake_case(variant->string)),
+               MD_StringExpand(variant_struct_name(node, variant)));
+    fprintf(f, "} %.*sHandlers;\n\n", MD_StringExpand(node->string));
+
+    /* hands each message left in `r` to its handler, along with `ctx`.
+       messages without a handler are skipped over rather than decoded.
+       stops at the first malformed one, which `r->err` says what's wrong with.
+       returns how many messages were handled */
+    fprintf(f, "int dispatch_%.*s(Reader *r, %.*sHandlers *handlers, void *ctx) {\n",
+           MD_StringExpand(snake), MD_StringExpand(node->string));
+    fprintf(f, "int handled = 0;\n");
+    fprintf(f, "while (r->err == FormpackErr_None && r->at != r->end) {\n");
+    print_stat_start();
+    fprintf(f, "uint8_t *start = r->at;\n");
+    fprintf(f, "(void) start;\n");
+    fprintf(f, "switch ((%.*sKind) reader_byte(r)) {\n", MD_StringExpand(node->string));
+    for (MD_EachNode(variant, node->first_child)) {
+        MD_String8 vsnake = snake_case(variant_struct_name(node, variant));
+        MD_String8 field = snake_case(variant->string);
+        fprintf(f, "case (%.*s):\n", MD_StringExpand(variant_kind(node, variant)));
+        fprintf(f, " if (handlers->%.*s == NULL) skip_%.*s(r);\n",
+               MD_StringExpand(field), MD_StringExpand(vsnake));
+        fprintf(f, " else {\n");
+        fprintf(f, "  %.*s msg = decode_%.*s(r);\n",
+               MD_StringExpand(variant_struct_name(node, variant)), MD_StringExpand(vsnake));
+        fprintf(f, "  if (r->err != FormpackErr_None) break;\n");
+        /* recorded before the handler runs, which isn't formpack's time */
+        print_stat("unpacked", variant_kind(node, variant), "start", "r->at");
+        fprintf(f, "  handlers->%.*s(ctx, &msg), handled++;\n", MD_StringExpand(field));
+        fprintf(f, "  break;\n");
+        fprintf(f, " }\n");
+        fprintf(f, " if (r->err != FormpackErr_None) break;\n");
+        print_stat("unpacked", variant_kind(node, variant), "start", "r->at");
+        fprintf(f, " break;\n");
+    }
+    fprintf(f, "default: reader_fail(r, FormpackErr_BadKind);\n");
+    fprintf(f, "}\n"); // end switch
+    fprintf(f, "}\n"); // end while
+    fprintf(f, "return handled;\n");
+    fprintf(f, "}\n\n"); // end dispatch<tagged union>
+}
+
+
+// -------------------------- TESTS ----------------------------------
+/* random values of every struct and tagged union, and equality as it comes
+   out the other side of a round trip, built on the basic types' in
+   test/random.h. these go in test_f, for test/ alone. qfloats are only
+   made on their steps, so they come back exactly. */
+void gen_struct_test(MD_Node *stru) {
+    MD_String8 snake = snake_case(stru->string);
+    fprintf(test_f, "%.*s random_%.*s(Scratch *s) {\n",
+           MD_StringExpand(stru->string), MD_StringExpand(snake));
+    fprintf(test_f, "%.*s v = { 0 };\n", MD_StringExpand(stru->string));
+    if (MD_NodeIsNil(stru->first_child)) fprintf(test_f, "(void) s;\n");
+    for (MD_EachNode(field, stru->first_child)) {
+        Field fl = parse_field(field);
+        MD_String8 name = field->string;
+        if (fl.kind == FieldKind_QFloat)
+            fprintf(test_f, "v.%.*s = qfloat_value((uint32_t) (random_u64(s) %% %" PRIu64 "ull), %.17g, %.17g);\n",
+                   MD_StringExpand(name), fl.steps + 1, fl.min, fl.precision);
+        else if (fl.kind == FieldKind_Array) {
+            fprintf(test_f, "v.%.*s.len = rand_u32() %% 6;\n", MD_StringExpand(name));
+            fprintf(test_f, "v.%.*s.items = v.%.*s.len ? scratch_alloc(s, v.%.*s.len * sizeof(%.*s)) : NULL;\n",
+                   MD_StringExpand(name), MD_StringExpand(name), MD_StringExpand(name),
+                   MD_StringExpand(fl.type->name));
+            fprintf(test_f, "for (uint32_t i = 0; i < v.%.*s.len; i++) v.%.*s.items[i] = random_%.*s(s);\n",
+                   MD_StringExpand(name), MD_StringExpand(name),
+                   MD_StringExpand(snake_case(fl.type->name)));
+        } else
+            fprintf(test_f, "v.%.*s = random_%.*s(s);\n",
+                   MD_StringExpand(name), MD_StringExpand(snake_case(fl.type->name)));
+    }
+    fprintf(test_f, "return v;\n}\n\n");
+
+    fprintf(test_f, "bool eq_%.*s(%.*s *a, %.*s *b) {\n", MD_StringExpand(snake),
+           MD_StringExpand(stru->string), MD_StringExpand(stru->string));
+    if (MD_NodeIsNil(stru->first_child)) fprintf(test_f, "(void) a, (void) b;\n");
+    for (MD_EachNode(field, stru->first_child)) {
+        Field fl = parse_field(field);
+        MD_String8 name = field->string;
+        if (fl.kind == FieldKind_QFloat)
+            fprintf(test_f, "if (a->%.*s != b->%.*s) return false;\n",
+                   MD_StringExpand(name), MD_StringExpand(name));
+        else if (fl.kind == FieldKind_Array) {
+            fprintf(test_f, "if (a->%.*s.len != b->%.*s.len) return false;\n",
+                   MD_StringExpand(name), MD_StringExpand(name));
+            fprintf(test_f, "for (uint32_t i = 0; i < a->%.*s.len; i++)"
+                   " if (!eq_%.*s(&a->%.*s.items[i], &b->%.*s.items[i])) return false;\n",
+                   MD_StringExpand(name), MD_StringExpand(snake_case(fl.type->name)),
+                   MD_StringExpand(name), MD_StringExpand(name));
+        } else
+            fprintf(test_f, "if (!eq_%.*s(&a->%.*s, &b->%.*s)) return false;\n",
+                   MD_StringExpand(snake_case(fl.type->name)),
+                   MD_StringExpand(name), MD_StringExpand(name));
+    }
+    fprintf(test_f, "return true;\n}\n\n");
+}
+
+void gen_tagun_test(MD_Node *node) {
+    MD_String8 snake = snake_case(node->string);
+    fprintf(test_f, "#define %.*s_KIND_COUNT %d\n", MD_StringExpand(upper_snake_case(node->string)),
+           (int) MD_ChildCountFromNode(node));
+    fprintf(test_f, "%.*s random_%.*s(Scratch *s) {\n",
+           MD_StringExpand(node->string), MD_StringExpand(snake));
+    fprintf(test_f, "%.*s d = { .kind = (%.*sKind) (rand_u32() %% %d) };\n",
+           MD_StringExpand(node->string), MD_StringExpand(node->string),
+           (int) MD_ChildCountFromNode(node));
+    fprintf(test_f, "switch (d.kind) {\n");
+    for (MD_EachNode(variant, node->first_child))
+        fprintf(test_f, "case (%.*s): d.%.*s = random_%.*s(s); break;\n",
+               MD_StringExpand(variant_kind(node, variant)),
+               MD_StringExpand(snake_case(variant->string)),
+               MD_StringExpand(snake_case(variant_struct_name(node, variant))));
+    fprintf(test_f, "}\n"); // end switch
+    fprintf(test_f, "return d;\n}\n\n");
+
+    fprintf(test_f, "bool eq_%.*s(%.*s *a, %.*s *b) {\n", MD_StringExpand(snake),
+           MD_StringExpand(node->string), MD_StringExpand(node->string));
+    fprintf(test_f, "if (a->kind != b->kind) return false;\n");
+    fprintf(test_f, "switch (a->kind) {\n");
+    for (MD_EachNode(variant, node->first_child))
+        fprintf(test_f, "case (%.*s): return eq_%.*s(&a->%.*s, &b->%.*s);\n",
+               MD_StringExpand(variant_kind(node, variant)),
+               MD_StringExpand(snake_case(variant_struct_name(node, variant))),
+               MD_StringExpand(snake_case(variant->string)),
+               MD_StringExpand(snake_case(variant->string)));
+    fprintf(test_f, "}\n"); // end switch
+    fprintf(test_f, "return false;\n}\n\n");
+}
+
+
+// -------------------------- STATS ----------------------------------
+/* the per thread table of counters for every kind of message in every tagged
+   union, and their names for printing it. it goes before all the code that
+   adds to it, so the kinds are counted up front. */
+void gen_stats_table(MD_Node *code) {
+    int count = 0;
+    for (MD_EachNode(node, code->first_child))
+        if (MD_NodeHasTag(node, MD_S8Lit("tagun")))
+            count += (int) MD_ChildCountFromNode(node);
+
+    fprintf(f, "#ifdef FORMPACK_STATS\n");
+    fprintf(f, "#define FORMPACK_KIND_COUNT %d\n", count);
+    fprintf(f, "static const char *formpack_kind_names[FORMPACK_KIND_COUNT] = {\n");
+    for (MD_EachNode(node, code->first_child))
+        if (MD_NodeHasTag(node, MD_S8Lit("tagun")))
+            for (MD_EachNode(variant, node->first_child))
+                fprintf(f, "\"%.*s\",\n", MD_StringExpand(variant_struct_name(node, variant)));
+    fprintf(f, "};\n");
+    fprintf(f, "THREAD_LOCAL FormpackKindStats formpack_stats[FORMPACK_KIND_COUNT];\n");
+    fprintf(f, "#endif\n\n");
 }
@@ -0,0 +1,530 @@
+/* the account store: every pfile lives in one append-only log,
+   and an in-memory index says where each account's latest record is.
+
+   registering appends one record (a burst of them shares one write and one
+   fsync), logging in is one pread at an offset the index already knows,
+   and asking whether a username is taken never touches the disk.
+   the index is an open-addressed hash table shared by all shards behind
+   a reader/writer lock, and is rebuilt at startup by mapping the log
+   and walking its records.
+
+   a record is laid out as
+       u32 check      FNV-1a of everything after it in the record
+       u8  user_len
+       u16 data_len   little endian
+       user_len bytes of username, then data_len bytes of pfile
+   a later record for the same user supersedes earlier ones, and
+   accounts_compact rewrites the log without the superseded records. */
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <io.h>
+    #include <direct.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#else
+    #include <dirent.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#define PFILE_EXT ".pfile"
+/* what a pfile is renamed to once it's in the log */
+#define PFILE_IMPORTED_EXT ".imported"
+#define ACCOUNTS_LOG "accounts.log"
+#define ACCOUNTS_HEADER_SIZE 7
+/* offset of an account that has been reserved, but isn't on disk yet */
+#define ACCOUNTS_PENDING UINT64_MAX
+
+typedef struct {
+    uint8_t len; /* 0 for an empty bucket */
+    char user[MAX_USER_LEN];
+    uint16_t data_len;
+    uint64_t offset; /* of this account's latest record in the log */
+} accounts_Entry;
+
+typedef struct {
+    accounts_Entry *buckets;
+    uint32_t cap, count; /* cap is always a power of two */
+} accounts_Index;
+
+typedef struct {
+    RwLock lock; /* guards index */
+    accounts_Index index;
+
+    Mutex append_lock; /* guards everything below */
+    int fd;
+    uint64_t end; /* of the log, where the next record goes */
+    uint64_t live_bytes; /* taken up by records that aren't superseded */
+    char path[256];
+} accounts_Store;
+
+
+/* -------------------------- INDEX ---------------------------------- */
+
+/* FNV-1a */
+INLINE uint32_t _accounts_hash(uint32_t h, const void *bytes, int len) {
+    for (int i = 0; i < len; i++) h = (h ^ ((uint8_t *) bytes)[i]) * 16777619u;
+    return h;
+}
+#define ACCOUNTS_HASH_SEED 2166136261u
+
+/* returns the bucket holding `user`, or the empty bucket it would go in */
+uint32_t _accounts_bucket(accounts_Index *idx, int len, const char *user) {
+    uint32_t mask = idx->cap - 1,
+             b = _accounts_hash(ACCOUNTS_HASH_SEED, user, len) & mask;
+    for (;; b = (b + 1) & mask) {
+        accounts_Entry *e = &idx->buckets[b];
+        if (e->len == 0 || (e->len == len && memcmp(e->user, user, len) == 0))
+            return b;
+    }
+}
+
+void _accounts_grow(accounts_Index *idx) {
+    accounts_Index old = *idx;
+    idx->cap = old.cap ? old.cap * 2 : 1024;
+    idx->buckets = calloc(idx->cap, sizeof(accounts_Entry));
+    for (uint32_t i = 0; i < old.cap; i++) {
+        accounts_Entry *e = &old.buckets[i];
+        if (e->len) idx->buckets[_accounts_bucket(idx, e->len, e->user)] = *e;
+    }
+    free(old.buckets);
+}
+
+/* returns the entry for `user`, adding an empty one if there isn't any.
+   `added` is set if the entry is new. */
+accounts_Entry *_accounts_upsert(accounts_Index *idx, int len, const char *user, bool *added) {
+    /* stay at most half full, so probe chains stay short */
+    if ((idx->count + 1) * 2 > idx->cap) _accounts_grow(idx);
+
+    accounts_Entry *e = &idx->buckets[_accounts_bucket(idx, len, user)];
+    *added = e->len == 0;
+    if (*added) {
+        *e = (accounts_Entry) { .len = (uint8_t) len, .offset = ACCOUNTS_PENDING };
+        memcpy(e->user, user, len);
+        idx->count++;
+    }
+    return e;
+}
+
+void _accounts_remove(accounts_Index *idx, int len, const char *user) {
+    uint32_t mask = idx->cap - 1, hole = _accounts_bucket(idx, len, user);
+    if (idx->buckets[hole].len == 0) return;
+
+    idx->count--;
+    /* shift later entries of the probe chain back into the hole,
+       so lookups never stop early at an empty bucket */
+    for (uint32_t b = (hole + 1) & mask; idx->buckets[b].len; b = (b + 1) & mask) {
+        accounts_Entry *e = &idx->buckets[b];
+        uint32_t home = _accounts_hash(ACCOUNTS_HASH_SEED, e->user, e->len) & mask;
+        if (((b - home) & mask) >= ((b - hole) & mask)) {
+            idx->buckets[hole] = *e;
+            hole = b;
+        }
+    }
+    idx->buckets[hole].len = 0;
+}
+
+
+/* -------------------------- LOG FILE ---------------------------------- */
+
+#ifdef _WIN32
+    #define _accounts_open(path) _open(path, _O_RDWR|_O_CREAT|_O_APPEND|_O_BINARY, _S_IREAD|_S_IWRITE)
+    #define _accounts_close _close
+    #define _accounts_truncate _chsize_s
+    #define _accounts_sync _commit
+    #define _accounts_mkdir _mkdir
+#else
+    #define _accounts_open(path) open(path, O_RDWR|O_CREAT|O_APPEND, 0644)
+    #define _accounts_close close
+    #define _accounts_truncate ftruncate
+    #define _accounts_sync fsync
+    #define _accounts_mkdir(dir) mkdir(dir, 0755)
+#endif
+
+/* writes all of `buf` to the end of the log, returns false on failure */
+bool _accounts_write(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+#ifdef _WIN32
+        int n = _write(fd, buf, (unsigned) len);
+#else
+        ssize_t n = write(fd, buf, len);
+#endif
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n, len -= n;
+    }
+    return true;
+}
+
+/* reads `len` bytes at `offset` into `buf`, returns false on failure */
+bool _accounts_pread(accounts_Store *s, void *buf, size_t len, uint64_t offset) {
+#ifdef _WIN32
+    /* no pread on windows, so the file position has to be shared carefully */
+    mutex_lock(&s->append_lock);
+    bool ok = _lseeki64(s->fd, offset, SEEK_SET) >= 0
+           && _read(s->fd, buf, (unsigned) len) == (int) len;
+    mutex_unlock(&s->append_lock);
+    return ok;
+#else
+    return pread(s->fd, buf, len, (off_t) offset) == (ssize_t) len;
+#endif
+}
+
+/* the whole log, for reading at startup. returns NULL if it's empty. */
+uint8_t *_accounts_map(accounts_Store *s, uint64_t size) {
+    if (size == 0) return NULL;
+#ifdef _WIN32
+    uint8_t *log = malloc(size);
+    if (log && !_accounts_pread(s, log, size, 0)) {
+        free(log);
+        return NULL;
+    }
+    return log;
+#else
+    void *log = mmap(NULL, size, PROT_READ, MAP_PRIVATE, s->fd, 0);
+    return (log == MAP_FAILED) ? NULL : log;
+#endif
+}
+void _accounts_unmap(uint8_t *log, uint64_t size) {
+    if (log == NULL) return;
+#ifdef _WIN32
+    (void) size;
+    free(log);
+#else
+    munmap(log, size);
+#endif
+}
+
+/* fills `rec` with a record for `user` holding `data`, returns its size */
+int _accounts_record(uint8_t *rec, int user_len, const char *user,
+                                   int data_len, const char *data) {
+    rec[4] = (uint8_t) user_len;
+    rec[5] = (uint8_t) data_len;
+    rec[6] = (uint8_t) (data_len >> 8);
+    memcpy(rec + ACCOUNTS_HEADER_SIZE, user, user_len);
+    memcpy(rec + ACCOUNTS_HEADER_SIZE + user_len, data, data_len);
+
+    int size = ACCOUNTS_HEADER_SIZE + user_len + data_len;
+    uint32_t check = _accounts_hash(ACCOUNTS_HASH_SEED, rec + 4, size - 4);
+    for (int i = 0; i < 4; i++) rec[i] = (uint8_t) (check >> (i * 8));
+    return size;
+}
+
+/* returns the size of the record at `rec`, or 0 if it's torn or corrupt */
+int _accounts_check_record(uint8_t *rec, uint64_t space) {
+    if (space < ACCOUNTS_HEADER_SIZE) return 0;
+    int user_len = rec[4], data_len = rec[5] | (rec[6] << 8),
+        size = ACCOUNTS_HEADER_SIZE + user_len + data_len;
+    if (user_len == 0 || user_len > MAX_USER_LEN || (uint64_t) size > space) return 0;
+
+    uint32_t check = rec[0] | (rec[1] << 8) | (rec[2] << 16) | ((uint32_t) rec[3] << 24);
+    if (check != _accounts_hash(ACCOUNTS_HASH_SEED, rec + 4, size - 4)) return 0;
+    return size;
+}
+
+/* adds every record in the log to the index */
+bool _accounts_scan(accounts_Store *s) {
+    struct stat st;
+    if (fstat(s->fd, &st) != 0) return false;
+    uint64_t size = (uint64_t) st.st_size;
+    uint8_t *log = _accounts_map(s, size);
+    if (size > 0 && log == NULL) return false;
+
+    uint64_t at = 0;
+    int rec_size;
+    while (at < size && (rec_size = _accounts_check_record(log + at, size - at))) {
+        int user_len = log[at + 4];
+        char *user = (char *) log + at + ACCOUNTS_HEADER_SIZE;
+
+        bool added;
+        accounts_Entry *e = _accounts_upsert(&s->index, user_len, user, &added);
+        if (!added) s->live_bytes -= ACCOUNTS_HEADER_SIZE + e->len + e->data_len;
+        e->offset = at;
+        e->data_len = (uint16_t) (rec_size - ACCOUNTS_HEADER_SIZE - user_len);
+        s->live_bytes += rec_size;
+        at += rec_size;
+    }
+    _accounts_unmap(log, size);
+
+    /* a crash mid-append leaves a torn record at the end, cut it off */
+    if (at < size) {
+        printf("%s: dropping %llu bytes of torn records\n",
+               s->path, (unsigned long long) (size - at));
+        if (_accounts_truncate(s->fd, at) != 0) return false;
+    }
+    s->end = at;
+    return true;
+}
+
+
+/* -------------------------- STORE ---------------------------------- */
+
+/* opens (or creates) the log in `dir`, creating that too if need be,
+   and indexes it. returns false with errno set if the log can't be used. */
+bool accounts_open(accounts_Store *s, const char *dir) {
+    *s = (accounts_Store) {0};
+    rwlock_init(&s->lock);
+    mutex_init(&s->append_lock);
+    _accounts_grow(&s->index);
+
+    _accounts_mkdir(dir); /* fails harmlessly if it's there */
+    snprintf(s->path, sizeof(s->path), "%s/" ACCOUNTS_LOG, dir);
+    s->fd = _accounts_open(s->path);
+    return s->fd >= 0 && _accounts_scan(s);
+}
+
+uint32_t accounts_count(accounts_Store *s) {
+    rwlock_read(&s->lock);
+    uint32_t count = s->index.count;
+    rwlock_read_unlock(&s->lock);
+    return count;
+}
+
+bool accounts_has(accounts_Store *s, int len, const char *user) {
+    if (len <= 0 || len > MAX_USER_LEN) return false;
+    rwlock_read(&s->lock);
+    bool has = s->index.buckets[_accounts_bucket(&s->index, len, user)].len != 0;
+    rwlock_read_unlock(&s->lock);
+    return has;
+}
+
+/* claims `user` before its record is written, so that registrations racing
+   on another shard see it as taken. returns false if it already was. */
+bool accounts_reserve(accounts_Store *s, int len, const char *user) {
+    if (len <= 0 || len > MAX_USER_LEN) return false;
+    rwlock_write(&s->lock);
+    bool added;
+    _accounts_upsert(&s->index, len, user, &added);
+    rwlock_write_unlock(&s->lock);
+    return added;
+}
+
+/* gives up a reservation whose record never made it to the log */
+void accounts_unreserve(accounts_Store *s, int len, const char *user) {
+    rwlock_write(&s->lock);
+    accounts_Entry *e = &s->index.buckets[_accounts_bucket(&s->index, len, user)];
+    if (e->len && e->offset == ACCOUNTS_PENDING) _accounts_remove(&s->index, len, user);
+    rwlock_write_unlock(&s->lock);
+}
+
+/* records waiting to be appended to the log together, so that a burst
+   of registrations costs one write and one fsync instead of one each */
+typedef struct {
+    uint8_t *buf; /* the records, back to back */
+    int len, cap;
+    accounts_Entry *entries; /* offsets here are into `buf` */
+    int count, entries_cap;
+} accounts_Batch;
+
+/* adds a record holding `data` as `user`'s pfile to the batch.
+   `user` must already be reserved or on file by the time it's committed. */
+void accounts_batch_add(accounts_Batch *b, int user_len, const char *user,
+                                           int data_len, const char *data) {
+    int size = ACCOUNTS_HEADER_SIZE + user_len + data_len;
+    if (b->len + size > b->cap) {
+        b->cap = max(b->cap * 2, b->len + size);
+        b->buf = realloc(b->buf, b->cap);
+    }
+    if (b->count == b->entries_cap) {
+        b->entries_cap = b->entries_cap ? b->entries_cap * 2 : 16;
+        b->entries = realloc(b->entries, b->entries_cap * sizeof(accounts_Entry));
+    }
+
+    accounts_Entry *e = &b->entries[b->count++];
+    *e = (accounts_Entry) {
+        .len = (uint8_t) user_len,
+        .data_len = (uint16_t) data_len,
+        .offset = (uint64_t) b->len,
+    };
+    memcpy(e->user, user, user_len);
+    b->len += _accounts_record(b->buf + b->len, user_len, user, data_len, data);
+}
+
+/* empties the batch, keeping its memory for the next one */
+void accounts_batch_clear(accounts_Batch *b) {
+    b->len = b->count = 0;
+}
+
+/* appends every record in the batch to the log with one write, and waits
+   for them to reach the disk with one fsync. only once they have does the
+   index point at them, so an account is never readable before it's durable.
+   returns false with errno set if the log couldn't be written, in which
+   case none of the batch is kept. the batch is left as it was either way. */
+bool accounts_commit(accounts_Store *s, accounts_Batch *b) {
+    if (b->count == 0) return true;
+
+    /* held through the fsync, so a failed batch can be cut back off
+       without taking anyone else's records with it */
+    mutex_lock(&s->append_lock);
+    uint64_t base = s->end;
+    bool ok = _accounts_write(s->fd, b->buf, b->len) && _accounts_sync(s->fd) == 0;
+    if (ok) s->end += b->len;
+    else {
+        /* don't leave half a batch for the next one to follow */
+        int err = errno;
+        _accounts_truncate(s->fd, s->end);
+        errno = err;
+    }
+    mutex_unlock(&s->append_lock);
+    if (!ok) return false;
+
+    rwlock_write(&s->lock);
+    for (int i = 0; i < b->count; i++) {
+        accounts_Entry *rec = &b->entries[i];
+        bool added;
+        accounts_Entry *e = _accounts_upsert(&s->index, rec->len, rec->user, &added);
+        if (e->offset != ACCOUNTS_PENDING)
+            s->live_bytes -= ACCOUNTS_HEADER_SIZE + e->len + e->data_len;
+        e->offset = base + rec->offset;
+        e->data_len = rec->data_len;
+        s->live_bytes += ACCOUNTS_HEADER_SIZE + rec->len + rec->data_len;
+    }
+    rwlock_write_unlock(&s->lock);
+    return true;
+}
+
+/* reads up to `cap` bytes of `user`'s pfile into `buf` with one pread.
+   returns how many bytes that was, or -1 with errno set on failure. */
+int accounts_read(accounts_Store *s, int user_len, const char *user, int cap, char *buf) {
+    rwlock_read(&s->lock);
+    accounts_Entry e = s->index.buckets[_accounts_bucket(&s->index, user_len, user)];
+    rwlock_read_unlock(&s->lock);
+
+    if (e.len == 0 || e.offset == ACCOUNTS_PENDING) {
+        errno = ENOENT;
+        return -1;
+    }
+    int len = min(cap, e.data_len);
+    if (!_accounts_pread(s, buf, len, e.offset + ACCOUNTS_HEADER_SIZE + e.len)) {
+        if (errno == 0) errno = EIO;
+        return -1;
+    }
+    return len;
+}
+
+/* rewrites the log with only the latest record for each account.
+   not safe to call while other threads are using the store. */
+bool accounts_compact(accounts_Store *s) {
+    char tmp_path[sizeof(s->path) + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", s->path);
+    remove(tmp_path);
+    int tmp = _accounts_open(tmp_path);
+    if (tmp < 0) return false;
+
+    /* the index keeps pointing into the old log until it's been replaced */
+    uint64_t *offsets = malloc(s->index.cap * sizeof(uint64_t)), end = 0;
+    uint8_t rec[ACCOUNTS_HEADER_SIZE + MAX_USER_LEN + UINT16_MAX];
+    bool ok = offsets != NULL;
+    for (uint32_t i = 0; ok && i < s->index.cap; i++) {
+        accounts_Entry *e = &s->index.buckets[i];
+        if (e->len == 0 || e->offset == ACCOUNTS_PENDING) continue;
+
+        int size = ACCOUNTS_HEADER_SIZE + e->len + e->data_len;
+        ok = _accounts_pread(s, rec, size, e->offset) && _accounts_write(tmp, rec, size);
+        offsets[i] = end;
+        end += size;
+    }
+    ok = ok && _accounts_sync(tmp) == 0;
+    _accounts_close(tmp);
+
+#ifdef _WIN32
+    /* can't replace a file windows still has open. if the move fails,
+       the old log is reopened below */
+    if (ok) {
+        _accounts_close(s->fd);
+        s->fd = -1;
+    }
+    ok = ok && MoveFileExA(tmp_path, s->path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmp_path, s->path) == 0;
+    if (ok) _accounts_close(s->fd);
+#endif
+    if (ok) {
+        for (uint32_t i = 0; i < s->index.cap; i++) {
+            accounts_Entry *e = &s->index.buckets[i];
+            if (e->len && e->offset != ACCOUNTS_PENDING) e->offset = offsets[i];
+        }
+        s->end = s->live_bytes = end;
+    } else
+        remove(tmp_path);
+    free(offsets);
+
+    /* whether it's the new log or the old one, it's at s->path */
+    if (ok || s->fd < 0) s->fd = _accounts_open(s->path);
+    return ok && s->fd >= 0;
+}
+
+/* renames `user`'s old pfile in `dir` out of accounts_import_dir's way */
+void _accounts_retire_pfile(const char *dir, int len, const char *user) {
+    char from[512], to[512];
+    snprintf(from, sizeof(from), "%s/%.*s" PFILE_EXT, dir, len, user);
+    snprintf(to, sizeof(to), "%s/%.*s" PFILE_EXT PFILE_IMPORTED_EXT, dir, len, user);
+#ifdef _WIN32
+    MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING);
+#else
+    rename(from, to);
+#endif
+}
+
+/* adds the old one-file-per-account pfiles ("<user>.pfile") in `dir`
+   to the log, skipping any account the log already has. each one is
+   renamed to "<user>.pfile.imported" once the log holds it, so the
+   next startup doesn't read them all again.
+   returns how many were added, or -1 with errno set if the log couldn't be written. */
+int accounts_import_dir(accounts_Store *s, const char *dir) {
+    int ext_len = sizeof(PFILE_EXT) - 1;
+    accounts_Batch batch = {0};
+#ifdef _WIN32
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s/*" PFILE_EXT, dir);
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(pattern, &entry);
+    if (find == INVALID_HANDLE_VALUE) return 0;
+    do {
+        char *name = entry.cFileName;
+#else
+    DIR *d = opendir(dir);
+    if (d == NULL) return 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        char *name = entry->d_name;
+#endif
+        int len = (int) strlen(name) - ext_len;
+        if (len <= 0 || len > MAX_USER_LEN || strcmp(name + len, PFILE_EXT) != 0) continue;
+        /* in the log already, by a startup that stopped before renaming it */
+        if (!accounts_reserve(s, len, name)) {
+            _accounts_retire_pfile(dir, len, name);
+            continue;
+        }
+
+        char path[512], data[UINT16_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        FILE *f = fopen(path, "rb");
+        int data_len = f ? (int) fread(data, 1, sizeof(data), f) : 0;
+        if (f) fclose(f);
+
+        if (f) accounts_batch_add(&batch, len, name, min(data_len, UINT16_MAX), data);
+        else accounts_unreserve(s, len, name);
+#ifdef _WIN32
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    }
+    closedir(d);
+#endif
+
+    int imported = batch.count;
+    if (!accounts_commit(s, &batch)) {
+        for (int i = 0; i < batch.count; i++)
+            accounts_unreserve(s, batch.entries[i].len, batch.entries[i].user);
+        imported = -1;
+    } else
+        for (int i = 0; i < batch.count; i++)
+            _accounts_retire_pfile(dir, batch.entries[i].len, batch.entries[i].user);
+    free(batch.buf);
+    free(batch.entries);
+    return imported;
+}
@@ -0,0 +1,407 @@
+/* readiness-based socket polling for the server.
+   epoll on Linux, kqueue on macOS/BSD, and plain poll() (WSAPoll on Windows)
+   everywhere else. sockets are identified by a caller-chosen u32 `id`,
+   which is handed back in the evloop_Event for each ready socket. */
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+    #define NOMINMAX
+    #endif
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    typedef SOCKET evloop_Fd;
+    #define EVLOOP_BAD_FD INVALID_SOCKET
+    #define EVLOOP_POLL
+#else
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <time.h>
+    #include <sys/resource.h>
+    typedef int evloop_Fd;
+    #define EVLOOP_BAD_FD (-1)
+    #if defined(__linux__)
+        #define EVLOOP_EPOLL
+        #include <sys/epoll.h>
+        #include <sys/eventfd.h>
+    #elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+        #define EVLOOP_KQUEUE
+        #include <sys/event.h>
+    #else
+        #define EVLOOP_POLL
+    #endif
+    #ifdef EVLOOP_POLL
+        #include <poll.h>
+    #endif
+#endif
+
+typedef struct {
+    uint32_t id;
+    bool readable, writable;
+} evloop_Event;
+
+/* lets other threads interrupt an evloop_wait, see evloop_wake */
+typedef struct {
+    evloop_Fd rx, tx;
+} evloop_Waker;
+
+typedef struct {
+#if defined(EVLOOP_EPOLL) || defined(EVLOOP_KQUEUE)
+    int backend;
+#else
+    struct pollfd *fds;
+    uint32_t *ids;
+    int count, cap;
+#endif
+} evloop_Loop;
+
+#ifndef _WIN32
+/* a descriptor held back for evloop_accept to give up, see there */
+static int _evloop_spare_fd = -1;
+#endif
+
+/* monotonic milliseconds, only useful for measuring intervals */
+uint64_t evloop_now_ms(void) {
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+#endif
+}
+
+void evloop_close_fd(evloop_Fd fd) {
+#ifdef _WIN32
+    closesocket(fd);
+#else
+    close(fd);
+#endif
+}
+
+bool _evloop_would_block(void) {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+/* makes a socket non-blocking, and turns off Nagle's algorithm
+   so small replies aren't held back waiting for more data */
+void _evloop_tune_fd(evloop_Fd fd, bool nodelay) {
+#ifdef _WIN32
+    u_long on = 1;
+    ioctlsocket(fd, FIONBIO, &on);
+#else
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    #ifdef SO_NOSIGPIPE
+    int nosigpipe = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+    #endif
+#endif
+    if (nodelay) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *) &on, sizeof(on));
+    }
+}
+
+/* lets this process keep at least `count` sockets open at once, if the OS allows */
+void evloop_raise_fd_limit(int count) {
+#ifdef _WIN32
+    (void) count; /* sockets aren't counted against a limit on windows */
+#else
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) != 0 || lim.rlim_cur >= (rlim_t) count) return;
+    lim.rlim_cur = (lim.rlim_max == RLIM_INFINITY || lim.rlim_max >= (rlim_t) count)
+                 ? (rlim_t) count
+                 : lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+#endif
+}
+
+/* returns a non-blocking socket listening on all interfaces (IPv6 and IPv4
+   where available), or EVLOOP_BAD_FD */
+evloop_Fd evloop_listen(uint16_t port) {
+    evloop_Fd fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (fd != EVLOOP_BAD_FD) {
+        int off = 0, on = 1;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (const char *) &off, sizeof(off));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *) &on, sizeof(on));
+
+        struct sockaddr_in6 addr = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+        addr.sin6_addr = in6addr_any;
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            evloop_close_fd(fd);
+            fd = EVLOOP_BAD_FD;
+        }
+    }
+
+    /* no IPv6 on this machine, IPv4 only it is */
+    if (fd == EVLOOP_BAD_FD) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == EVLOOP_BAD_FD) return EVLOOP_BAD_FD;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *) &on, sizeof(on));
+
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            evloop_close_fd(fd);
+            return EVLOOP_BAD_FD;
+        }
+    }
+
+    if (listen(fd, 128) != 0) {
+        evloop_close_fd(fd);
+        return EVLOOP_BAD_FD;
+    }
+    _evloop_tune_fd(fd, false);
+#ifndef _WIN32
+    if (_evloop_spare_fd < 0) _evloop_spare_fd = open("/dev/null", O_RDONLY);
+#endif
+    return fd;
+}
+
+/* returns a new non-blocking connection, or EVLOOP_BAD_FD if none are pending.
+   with no descriptors left, connections are accepted on the spare one and
+   closed straight away. left in the backlog they'd keep the listener readable,
+   and whoever waits on it spinning, until a client went away */
+evloop_Fd evloop_accept(evloop_Fd listener) {
+    for (;;) {
+        evloop_Fd fd = accept(listener, NULL, NULL);
+        if (fd != EVLOOP_BAD_FD) {
+            _evloop_tune_fd(fd, true);
+            return fd;
+        }
+#ifndef _WIN32
+        if ((errno == EMFILE || errno == ENFILE) && _evloop_spare_fd >= 0) {
+            close(_evloop_spare_fd);
+            fd = accept(listener, NULL, NULL);
+            if (fd != EVLOOP_BAD_FD) close(fd);
+            _evloop_spare_fd = open("/dev/null", O_RDONLY);
+            if (fd != EVLOOP_BAD_FD) continue;
+        }
+#endif
+        return EVLOOP_BAD_FD;
+    }
+}
+
+/* returns the number of bytes moved, 0 if the socket would block,
+   or -1 if the connection is broken or was closed by the peer */
+long evloop_send(evloop_Fd fd, const void *data, size_t size) {
+#if defined(_WIN32)
+    long n = send(fd, data, (int) size, 0);
+#elif defined(MSG_NOSIGNAL)
+    long n = (long) send(fd, data, size, MSG_NOSIGNAL);
+#else
+    long n = (long) send(fd, data, size, 0);
+#endif
+    if (n < 0) return _evloop_would_block() ? 0 : -1;
+    return n;
+}
+long evloop_recv(evloop_Fd fd, void *data, size_t size) {
+#ifdef _WIN32
+    long n = recv(fd, data, (int) size, 0);
+#else
+    long n = (long) recv(fd, data, size, 0);
+#endif
+    if (n == 0) return -1;
+    if (n < 0) return _evloop_would_block() ? 0 : -1;
+    return n;
+}
+
+bool evloop_init(evloop_Loop *l) {
+    *l = (evloop_Loop) {0};
+#if defined(EVLOOP_EPOLL)
+    l->backend = epoll_create1(0);
+    return l->backend >= 0;
+#elif defined(EVLOOP_KQUEUE)
+    l->backend = kqueue();
+    return l->backend >= 0;
+#else
+    #ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return false;
+    #endif
+    return true;
+#endif
+}
+
+void evloop_free(evloop_Loop *l) {
+#if defined(EVLOOP_EPOLL) || defined(EVLOOP_KQUEUE)
+    close(l->backend);
+#else
+    free(l->fds);
+    free(l->ids);
+#endif
+    *l = (evloop_Loop) {0};
+}
+
+/* starts watching `fd` for readability (and writability, if `want_write`).
+   calling this again for a watched fd changes what it's watched for. */
+bool evloop_watch(evloop_Loop *l, evloop_Fd fd, uint32_t id, bool want_write, bool add) {
+#if defined(EVLOOP_EPOLL)
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLRDHUP | (want_write ? EPOLLOUT : 0),
+        .data.u32 = id,
+    };
+    return epoll_ctl(l->backend, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev) == 0;
+#elif defined(EVLOOP_KQUEUE)
+    void *udata = (void *) (uintptr_t) id;
+    struct kevent ev[2];
+    EV_SET(&ev[0], fd, EVFILT_READ, EV_ADD, 0, 0, udata);
+    EV_SET(&ev[1], fd, EVFILT_WRITE, want_write ? EV_ADD : EV_DELETE, 0, 0, udata);
+    /* deleting a write filter that was never added fails harmlessly */
+    kevent(l->backend, &ev[1], 1, NULL, 0, NULL);
+    return kevent(l->backend, &ev[0], 1, NULL, 0, NULL) == 0;
+#else
+    short events = POLLIN | (want_write ? POLLOUT : 0);
+    if (!add) {
+        for (int i = 0; i < l->count; i++)
+            if (l->fds[i].fd == fd) {
+                l->fds[i].events = events;
+                return true;
+            }
+        return false;
+    }
+    if (l->count == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        struct pollfd *fds = realloc(l->fds, cap * sizeof(*fds));
+        if (fds == NULL) return false;
+        l->fds = fds;
+        uint32_t *ids = realloc(l->ids, cap * sizeof(*ids));
+        if (ids == NULL) return false;
+        l->ids = ids;
+        l->cap = cap;
+    }
+    l->fds[l->count] = (struct pollfd) { .fd = fd, .events = events };
+    l->ids[l->count] = id;
+    l->count++;
+    return true;
+#endif
+}
+
+/* stops watching `fd`, call before closing it */
+void evloop_unwatch(evloop_Loop *l, evloop_Fd fd) {
+#if defined(EVLOOP_EPOLL)
+    epoll_ctl(l->backend, EPOLL_CTL_DEL, fd, NULL);
+#elif defined(EVLOOP_KQUEUE)
+    struct kevent ev[2];
+    EV_SET(&ev[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&ev[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(l->backend, &ev[0], 1, NULL, 0, NULL);
+    kevent(l->backend, &ev[1], 1, NULL, 0, NULL);
+#else
+    for (int i = 0; i < l->count; i++)
+        if (l->fds[i].fd == fd) {
+            l->count--;
+            l->fds[i] = l->fds[l->count];
+            l->ids[i] = l->ids[l->count];
+            break;
+        }
+#endif
+}
+
+/* blocks until at least one watched socket is ready or `timeout_ms` passes,
+   fills `out` with up to `max` ready sockets and returns how many there were */
+int evloop_wait(evloop_Loop *l, evloop_Event *out, int max, int timeout_ms) {
+    int n = 0;
+#if defined(EVLOOP_EPOLL)
+    struct epoll_event evs[64];
+    int got = epoll_wait(l->backend, evs, min(max, LEN(evs)), timeout_ms);
+    for (int i = 0; i < got; i++)
+        out[n++] = (evloop_Event) {
+            .id = evs[i].data.u32,
+            /* errors and hangups show up as readable,
+               so that the read fails and the socket is cleaned up */
+            .readable = (evs[i].events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)) != 0,
+            .writable = (evs[i].events & EPOLLOUT) != 0,
+        };
+#elif defined(EVLOOP_KQUEUE)
+    struct kevent evs[64];
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000 };
+    int got = kevent(l->backend, NULL, 0, evs, min(max, LEN(evs)), &ts);
+    for (int i = 0; i < got; i++)
+        out[n++] = (evloop_Event) {
+            .id = (uint32_t) (uintptr_t) evs[i].udata,
+            .readable = evs[i].filter == EVFILT_READ || (evs[i].flags & EV_EOF),
+            .writable = evs[i].filter == EVFILT_WRITE,
+        };
+#else
+    #ifdef _WIN32
+    int got = WSAPoll(l->fds, l->count, timeout_ms);
+    #else
+    int got = poll(l->fds, l->count, timeout_ms);
+    #endif
+    for (int i = 0; i < l->count && n < min(got, max); i++) {
+        short re = l->fds[i].revents;
+        if (re == 0) continue;
+        out[n++] = (evloop_Event) {
+            .id = l->ids[i],
+            .readable = (re & (POLLIN|POLLHUP|POLLERR)) != 0,
+            .writable = (re & POLLOUT) != 0,
+        };
+    }
+#endif
+    return n;
+}
+
+/* makes a waker and watches it under `id`. whenever another thread calls
+   evloop_wake, evloop_wait returns a readable event for `id`;
+   call evloop_waker_drain when handling it. */
+bool evloop_waker_init(evloop_Loop *l, evloop_Waker *w, uint32_t id) {
+#if defined(EVLOOP_EPOLL)
+    w->rx = w->tx = eventfd(0, EFD_NONBLOCK);
+    if (w->rx < 0) return false;
+#elif defined(_WIN32)
+    /* WSAPoll only understands sockets, so the waker is
+       a UDP socket on the loopback interface that sends to itself */
+    w->rx = w->tx = socket(AF_INET, SOCK_DGRAM, 0);
+    if (w->rx == EVLOOP_BAD_FD) return false;
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int addr_len = sizeof(addr);
+    if (bind(w->rx, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || getsockname(w->rx, (struct sockaddr *) &addr, &addr_len) != 0
+        || connect(w->rx, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        evloop_close_fd(w->rx);
+        return false;
+    }
+    _evloop_tune_fd(w->rx, false);
+#else
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    w->rx = fds[0], w->tx = fds[1];
+    _evloop_tune_fd(w->rx, false);
+    _evloop_tune_fd(w->tx, false);
+#endif
+    return evloop_watch(l, w->rx, id, false, true);
+}
+
+/* safe to call from any thread */
+void evloop_wake(evloop_Waker *w) {
+#if defined(EVLOOP_EPOLL)
+    uint64_t one = 1;
+    ssize_t n = write(w->tx, &one, sizeof(one));
+    (void) n;
+#elif defined(_WIN32)
+    send(w->tx, "!", 1, 0);
+#else
+    ssize_t n = write(w->tx, "!", 1);
+    (void) n;
+#endif
+}
+
+void evloop_waker_drain(evloop_Waker *w) {
+    char buf[64];
+#if defined(_WIN32)
+    while (recv(w->rx, buf, sizeof(buf), 0) > 0);
+#else
+    while (read(w->rx, buf, sizeof(buf)) > 0);
+#endif
+}
@@ -10,6 +10,9 @@
 #include <memory.h>
 #include <assert.h>
 #include <errno.h>
+#ifdef FORMPACK_STATS
+#include <signal.h>
+#endif
 
 #define MAX_USER_LEN (20)
 #define MAX_PASS_LEN (80)
@@ -18,111 +21,632 @@
 #ifndef EMBED_SERV
 #include "../common/common.h"
 #include "../bq_websocket/bq_websocket.h"
-#include "../bq_websocket/bq_websocket_platform.h"
 #endif
 
-/* tracks how logged in a client is */
-typedef enum { _srv_Login_No, _srv_Login_Trial, _srv_Login_Full } _srv_Login;
+#include "evloop.h"
+#include "accounts.h"
+#include "scrypt.h"
+
+/* tracks how logged in a client is.
+   `Reading` waits on their pfile to be read and checked against a login,
+   `Registering` waits for their password to be hashed and their new pfile
+   to be durably on disk */
+typedef enum {
+    _srv_Login_No,
+    _srv_Login_Trial,
+    _srv_Login_Reading,
+    _srv_Login_Registering,
+    _srv_Login_Full,
+} _srv_Login;
+typedef struct _srv_Shard _srv_Shard;
 typedef struct {
     _srv_Login login;
     char user[MAX_USER_LEN], pass[MAX_PASS_LEN];
     bqws_socket *ws;
+    _srv_Shard *shard;
+
+    /* the OS socket underneath `ws`. `want_write` is raised when the kernel
+       couldn't take everything bqws gave it, `watching_write` tracks
+       whether the event loop has been told to wake us when it can. */
+    evloop_Fd fd;
+    bool want_write, watching_write;
+
+    /* replies go out together as one frame, when the client is next flushed */
+    Batch out;
+    Intern sent_strings; /* the istrings in `out`, and in what's gone before */
+
+    /* this client's slot in its shard, and its place in the shard's live list.
+       `generation` counts how many clients have had the slot, so that work
+       finishing after a client leaves isn't mistaken as being for the next. */
+    uint32_t id, live_index, generation;
 } _srv_Client;
 
-#define MAX_CLIENTS 128
+/* names a client in a way that stays valid after it disconnects */
+typedef struct {
+    uint32_t id, generation;
+} _srv_ClientRef;
+
+/* a client waiting on some pfile i/o, and the login to put them back to
+   if it fails */
+typedef struct {
+    _srv_ClientRef ref;
+    _srv_Login was;
+} _srv_Waiter;
+
+/* a pfile is either a password hash, laid out as
+       u8 0 (no plaintext password starts with NUL)
+       u8 SRV_PFILE_SCRYPT
+       u8 log_n, u8 r, u8 p
+       SRV_SALT_LEN bytes of salt, SRV_HASH_LEN bytes of hash
+   or, if it's from before passwords were hashed, the password itself */
+#define SRV_PFILE_SCRYPT 1
+#define SRV_SALT_LEN 16
+#define SRV_HASH_LEN 32
+#define SRV_PFILE_LEN (5 + SRV_SALT_LEN + SRV_HASH_LEN)
+/* 1 KiB of memory per hash per unit of N, 16 MiB and ~60ms at log_n = 14 */
+#define SRV_DEFAULT_HASH_COST 14
+#define SRV_SCRYPT_R 8
+#define SRV_SCRYPT_P 1
+/* past this many hashes waiting for a thread, logins and registrations
+   are turned away until the backlog clears */
+#define SRV_DEFAULT_HASH_QUEUE 256
+
+/* a login attempt's pfile, read on an i/o thread,
+   then checked against the attempt on a hash thread */
+typedef struct {
+    _srv_Shard *shard;
+    _srv_Waiter waiter;
+    uint8_t user_len, pass_len;
+    char user[MAX_USER_LEN], pass[MAX_PASS_LEN];
+
+    int stored_len; /* -1 if the read failed, with `err` holding errno */
+    int err;
+    char stored[MAX_PASS_LEN]; /* also roomy enough for SRV_PFILE_LEN */
+    bool hashed, matches; /* `matches` is only set for hashed pfiles */
+    bool busy; /* if there wasn't room to queue it for checking */
+} _srv_PfileRead;
+
+/* a new account's password, hashed on a hash thread */
+typedef struct {
+    _srv_Shard *shard;
+    _srv_Waiter waiter;
+    uint8_t user_len, pass_len;
+    char user[MAX_USER_LEN], pass[MAX_PASS_LEN];
+
+    bool ok; /* if not, `err` holds errno */
+    int err;
+    uint8_t pfile[SRV_PFILE_LEN];
+} _srv_PassHash;
+
+/* registrations committed to the log together on an i/o thread.
+   `waiters[i]` is who registered `batch.entries[i]` */
+typedef struct {
+    _srv_Shard *shard;
+    accounts_Batch batch;
+    _srv_Waiter *waiters;
+    int waiters_cap;
+
+    bool ok; /* if not, `err` holds errno */
+    int err;
+} _srv_Commit;
+
+/* what other threads can send a shard */
+typedef enum {
+    _srv_MailKind_Socket, /* freshly accepted */
+    _srv_MailKind_PfileRead, /* finished */
+    _srv_MailKind_Commit, /* finished */
+    _srv_MailKind_PassHash, /* finished */
+} _srv_MailKind;
+typedef struct {
+    _srv_MailKind kind;
+    union {
+        evloop_Fd fd;
+        _srv_PfileRead *read;
+        _srv_Commit *commit;
+        _srv_PassHash *hash;
+    };
+} _srv_Mail;
+
+/* clients are allocated a page at a time, so the pool can grow
+   without moving any of them (bqws keeps a pointer to its client) */
+#define SRV_CLIENT_PAGE 256
+#define SRV_DEFAULT_MAX_CLIENTS 16384
+/* pfile i/o is mostly waiting on the disk, so this needn't match the cores */
+#define SRV_DEFAULT_IO_THREADS 4
+#define SRV_PORT 80
+/* how often the status line is redrawn */
+#define SRV_TIMER_MS 100
+/* how often every socket gets a bqws_update, so that bqws can act on its
+   own timeouts, and shards publish their stats */
+#define SRV_HOUSEKEEPING_MS 1000
+/* how often formpack's stats are printed, when it keeps them.
+   on unix, they can also be asked for with SIGUSR1 */
+#define SRV_STATS_DUMP_MS 60000
+/* sent to connections we can't take, instead of silently hanging up */
+#define SRV_OVERLOADED_RESPONSE "HTTP/1.1 503 Service Unavailable\r\n" \
+                                "Retry-After: 10\r\n"                    \
+                                "Content-Length: 0\r\n"                  \
+                                "Connection: close\r\n\r\n"
+/* event loop ids for the non-client sockets, client ids are their index */
+#define SRV_LISTENER_ID UINT32_MAX
+#define SRV_WAKER_ID (UINT32_MAX - 1)
+
+/* a shard's activity, published about once a second for the status line */
+typedef struct {
+    int connections, messages_per_sec;
+} _srv_ShardStats;
+
+/* each shard is a worker thread with its own event loop and its own clients.
+   the accept thread and the i/o threads talk to it through `mail`, which
+   along with `stats` is all it shares, so the lock is never held for long. */
+struct _srv_Shard {
+    Thread thread;
+    evloop_Loop loop;
+    evloop_Waker waker;
+    int messages; /* handled since stats were last published */
+    Scratch scratch; /* for whichever message is being decoded */
+
+    /* accounts registered since the last commit was started. only one commit
+       is in flight at a time, so registrations pile up while the disk is busy
+       and the next fsync covers all of them. */
+    _srv_Commit *registrations;
+    bool committing;
+
+    /* client pool. `free_ids` is a stack of unused slots,
+       `live` densely packs the ids of every connected client */
+    _srv_Client **pages;
+    int page_count, max_clients;
+    uint32_t *free_ids, *live;
+    int free_len, live_len;
+
+    Mutex lock; /* guards everything below */
+    _srv_Mail *mail;
+    int mail_len, mail_cap;
+    _srv_ShardStats stats;
+#ifdef FORMPACK_STATS
+    /* everything the shard has packed and unpacked since the server started */
+    FormpackKindStats wire[FORMPACK_KIND_COUNT];
+#endif
+};
+
 /* internal server state */
 static struct {
-    _srv_Client clients[MAX_CLIENTS];
+    _srv_Shard *shards;
+    int shard_count, max_clients;
+    accounts_Store accounts;
+    workers_Pool io; /* for pfile reads and writes */
+    workers_Pool hash; /* for hashing passwords, bounded by --hash-queue */
+    int hash_cost; /* log2 of scrypt's N for new passwords */
 } _srv;
 
-/* call once per tick, handles client input */
-void _srv_update_client_socket(_srv_Client*);
+void *_srv_shard_run(void *shard);
+void _srv_handoff(evloop_Fd fd);
+void _srv_post(_srv_Shard *shard, _srv_Mail mail);
+#ifdef FORMPACK_STATS
+void _srv_dump_stats(void);
+static volatile sig_atomic_t _srv_stats_requested;
+void _srv_request_stats(int sig) { (void) sig; _srv_stats_requested = 1; }
+#endif
 
 #ifdef EMBED_SERV
 void srv_start() {
+    int argc = 0;
+    char **argv = NULL;
 #else
-int main() {
+int main(int argc, char **argv) {
 #endif
-    bqws_pt_init(NULL);
-    bqws_pt_server *sv = bqws_pt_listen(&(bqws_pt_listen_opts) { .port = 80 });
+    _srv.shard_count = thread_core_count();
+    _srv.max_clients = SRV_DEFAULT_MAX_CLIENTS;
+    int io_threads = SRV_DEFAULT_IO_THREADS,
+        hash_threads = thread_core_count(),
+        hash_queue = SRV_DEFAULT_HASH_QUEUE;
+    _srv.hash_cost = SRV_DEFAULT_HASH_COST;
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+            _srv.shard_count = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc)
+            _srv.max_clients = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc)
+            io_threads = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--hash-threads") == 0 && i + 1 < argc)
+            hash_threads = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--hash-queue") == 0 && i + 1 < argc)
+            hash_queue = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--hash-cost") == 0 && i + 1 < argc)
+            _srv.hash_cost = min(24, max(1, atoi(argv[++i])));
+        else {
+            printf("usage: %s [--shards N] [--max-clients N] [--io-threads N]\n"
+                   "       [--hash-threads N] [--hash-queue N] [--hash-cost LOG2_N]\n", argv[0]);
+            exit(1);
+        }
+    evloop_raise_fd_limit(_srv.max_clients + 64);
 
+    if (!accounts_open(&_srv.accounts, PFILE_PATH)) {
+        perror("couldn't open " PFILE_PATH ACCOUNTS_LOG);
+        exit(1);
+    }
+    int imported = accounts_import_dir(&_srv.accounts, PFILE_PATH);
+    if (imported < 0) perror("couldn't import old pfiles into " ACCOUNTS_LOG);
+    if (imported > 0)
+        printf("imported %d old pfiles into " ACCOUNTS_LOG ", renamed to *" PFILE_EXT PFILE_IMPORTED_EXT "\n",
+               imported);
+    /* nothing else is using the store yet, so this is the time to tidy it */
+    if (_srv.accounts.end > _srv.accounts.live_bytes * 2 && !accounts_compact(&_srv.accounts))
+        perror("couldn't compact " PFILE_PATH ACCOUNTS_LOG);
+    printf("%u accounts on file\n", accounts_count(&_srv.accounts));
+    if (!workers_start(&_srv.io, io_threads, 0)) {
+        perror("couldn't start i/o threads");
+        exit(1);
+    }
+    if (!workers_start(&_srv.hash, hash_threads, hash_queue)) {
+        perror("couldn't start hash threads");
+        exit(1);
+    }
+
+    evloop_Loop loop;
+    if (!evloop_init(&loop)) {
+        perror("couldn't start event loop");
+        exit(1);
+    }
+    evloop_Fd listener = evloop_listen(SRV_PORT);
+    if (listener == EVLOOP_BAD_FD) {
+        perror("couldn't listen");
+        exit(1);
+    }
+    evloop_watch(&loop, listener, SRV_LISTENER_ID, false, true);
+#if defined(FORMPACK_STATS) && !defined(_WIN32)
+    signal(SIGUSR1, _srv_request_stats);
+#endif
+
+    _srv.shards = calloc(_srv.shard_count, sizeof(_srv_Shard));
+    for (int i = 0; i < _srv.shard_count; i++) {
+        _srv_Shard *shard = &_srv.shards[i];
+        shard->max_clients = (_srv.max_clients + _srv.shard_count - 1) / _srv.shard_count;
+        mutex_init(&shard->lock);
+        if (!evloop_init(&shard->loop)
+            || !evloop_waker_init(&shard->loop, &shard->waker, SRV_WAKER_ID)
+            || !thread_start(&shard->thread, _srv_shard_run, shard)) {
+            perror("couldn't start shard");
+            exit(1);
+        }
+    }
+
+    /* this thread only accepts connections and reports on the shards */
     int tick = 0;
+    uint64_t next_timer = evloop_now_ms() + SRV_TIMER_MS;
     for (;;) {
+        uint64_t now = evloop_now_ms();
+        int timeout = (next_timer > now) ? (int) (next_timer - now) : 0;
+        evloop_Event events[1];
+        if (evloop_wait(&loop, events, LEN(events), timeout)) {
+            evloop_Fd fd;
+            while ((fd = evloop_accept(listener)) != EVLOOP_BAD_FD)
+                _srv_handoff(fd);
+        }
+
+        if (evloop_now_ms() < next_timer) continue;
+        /* from now, so ticks a slow one held up don't all come due at once */
+        next_timer = evloop_now_ms() + SRV_TIMER_MS;
         tick++;
 
-        /* Accept new connections */
-        bqws_socket *new_ws = bqws_pt_accept(sv, NULL, NULL);
-        if (new_ws) {
-            for (size_t i = 0; i < MAX_CLIENTS; i++) {
-                if (_srv.clients[i].ws == NULL) {
-                    bqws_server_accept(new_ws, NULL);
-                    _srv.clients[i] = (_srv_Client) {
-                        .ws = new_ws,
-                    };
-                    new_ws = NULL;
-                    break;
-                }
-            }
-            bqws_free_socket(new_ws);
-        }
+        char shard_str[1024] = "";
+        int connection_count = 0, len = 0;
+        for (int i = 0; i < _srv.shard_count; i++) {
+            _srv_Shard *shard = &_srv.shards[i];
+            mutex_lock(&shard->lock);
+            _srv_ShardStats stats = shard->stats;
+            mutex_unlock(&shard->lock);
 
-        /* Update existing clients */
-        int connection_count = 0;
-        for (size_t i = 0; i < MAX_CLIENTS; i++)
-            if (_srv.clients[i].ws) {
-                connection_count++;
-                _srv_update_client_socket(&_srv.clients[i]);
-            }
+            connection_count += stats.connections;
+            if (len < (int) sizeof(shard_str) - 64)
+                len += sprintf(shard_str + len, " #%d: %d users %d msg/s;",
+                               i, stats.connections, stats.messages_per_sec);
+        }
 
         /* tacky ASCII animation ensures you the server is updating */
-        char anim = "|\\-/"[tick / 10 % 4];
-        printf("\r[%c %d users online %c]     ", anim, connection_count, anim);
+        char anim = "|\\-/"[tick % 4];
+        printf("\r[%c %d users online %c]%s     ", anim, connection_count, anim, shard_str);
         fflush(stdout);
 
-        bqws_pt_sleep_ms(10);
+#ifdef FORMPACK_STATS
+        if (_srv_stats_requested || tick % (SRV_STATS_DUMP_MS / SRV_TIMER_MS) == 0) {
+            _srv_stats_requested = 0;
+            _srv_dump_stats();
+        }
+#endif
     }
 
     /* technically unreachable :( */
-    // bqws_pt_free_server(sv);
-    // bqws_pt_shutdown();
+    // evloop_close_fd(listener);
+    // evloop_free(&loop);
+}
+
+#ifdef FORMPACK_STATS
+/* prints what every shard has sent and received, as of their last housekeeping */
+void _srv_dump_stats(void) {
+    FormpackKindStats wire[FORMPACK_KIND_COUNT] = { 0 };
+    for (int i = 0; i < _srv.shard_count; i++) {
+        _srv_Shard *shard = &_srv.shards[i];
+        mutex_lock(&shard->lock);
+        formpack_stats_add(wire, shard->wire);
+        mutex_unlock(&shard->lock);
+    }
+    printf("\n");
+    formpack_stats_print(stdout, wire);
+    fflush(stdout);
+}
+#endif
+
+/* gives a freshly accepted socket to the shard after the last one */
+void _srv_handoff(evloop_Fd fd) {
+    static int next_shard;
+    _srv_Shard *shard = &_srv.shards[next_shard++ % _srv.shard_count];
+    _srv_post(shard, (_srv_Mail) { .kind = _srv_MailKind_Socket, .fd = fd });
+}
+
+/* queues mail for a shard and wakes it up to read it. any thread can call this */
+void _srv_post(_srv_Shard *shard, _srv_Mail mail) {
+    mutex_lock(&shard->lock);
+    if (shard->mail_len == shard->mail_cap) {
+        shard->mail_cap = shard->mail_cap ? shard->mail_cap * 2 : 16;
+        shard->mail = realloc(shard->mail, shard->mail_cap * sizeof(_srv_Mail));
+    }
+    shard->mail[shard->mail_len++] = mail;
+    mutex_unlock(&shard->lock);
+
+    evloop_wake(&shard->waker);
+}
+
+/* call when a client's socket has activity, handles client input */
+void _srv_update_client_socket(_srv_Client*);
+void _srv_flush_client(_srv_Client*);
+void _srv_add_client(_srv_Shard *shard, evloop_Fd fd);
+void _srv_commit_registrations(_srv_Shard *shard);
+void _srv_finish_registrations(_srv_Shard *shard, _srv_Commit *commit);
+void _srv_finish_login(_srv_Shard *shard, _srv_PfileRead *read);
+void _srv_finish_hash(_srv_Shard *shard, _srv_PassHash *hash);
+
+INLINE _srv_Client *_srv_client_from_id(_srv_Shard *shard, uint32_t id) {
+    return &shard->pages[id / SRV_CLIENT_PAGE][id % SRV_CLIENT_PAGE];
+}
+
+void *_srv_shard_run(void *arg) {
+    _srv_Shard *shard = arg;
+    _srv_Mail *taken = NULL;
+    int taken_cap = 0;
+
+    uint64_t next_timer = evloop_now_ms() + SRV_HOUSEKEEPING_MS;
+    for (;;) {
+        /* sleep until a socket has something for us, or the timer is due */
+        uint64_t now = evloop_now_ms();
+        int timeout = (next_timer > now) ? (int) (next_timer - now) : 0;
+        evloop_Event events[64];
+        int event_count = evloop_wait(&shard->loop, events, LEN(events), timeout);
+
+        for (int i = 0; i < event_count; i++) {
+            evloop_Event *ev = &events[i];
+            if (ev->id == SRV_WAKER_ID) {
+                evloop_waker_drain(&shard->waker);
+
+                /* swap the mail out, so nobody posting is
+                   kept waiting while we act on it */
+                mutex_lock(&shard->lock);
+                _srv_Mail *mail = shard->mail;
+                int mail_len = shard->mail_len, mail_cap = shard->mail_cap;
+                shard->mail = taken, shard->mail_cap = taken_cap;
+                shard->mail_len = 0;
+                taken = mail, taken_cap = mail_cap;
+                mutex_unlock(&shard->lock);
+
+                for (int m = 0; m < mail_len; m++)
+                    switch (taken[m].kind) {
+                    case (_srv_MailKind_Socket):
+                        _srv_add_client(shard, taken[m].fd);
+                        break;
+                    case (_srv_MailKind_PfileRead):
+                        _srv_finish_login(shard, taken[m].read);
+                        break;
+                    case (_srv_MailKind_Commit):
+                        _srv_finish_registrations(shard, taken[m].commit);
+                        break;
+                    case (_srv_MailKind_PassHash):
+                        _srv_finish_hash(shard, taken[m].hash);
+                        break;
+                    }
+            }
+            else {
+                _srv_Client *client = _srv_client_from_id(shard, ev->id);
+                if (client->ws) _srv_update_client_socket(client);
+            }
+        }
+
+        if (evloop_now_ms() >= next_timer) {
+            next_timer = evloop_now_ms() + SRV_HOUSEKEEPING_MS;
+
+            /* Update existing clients, backwards because
+               a client that disconnects is swapped with the last one */
+            for (int i = shard->live_len - 1; i >= 0; i--)
+                _srv_update_client_socket(_srv_client_from_id(shard, shard->live[i]));
+
+            mutex_lock(&shard->lock);
+            shard->stats = (_srv_ShardStats) {
+                .connections = shard->live_len,
+                .messages_per_sec = shard->messages * 1000 / SRV_HOUSEKEEPING_MS,
+            };
+#ifdef FORMPACK_STATS
+            formpack_stats_take(shard->wire);
+#endif
+            mutex_unlock(&shard->lock);
+            shard->messages = 0;
+        }
+
+        /* everyone who registered this tick goes to disk together,
+           unless the last lot still are, in which case they'll join the next */
+        _srv_commit_registrations(shard);
+    }
+    return NULL;
+}
+
+/* bqws i/o callbacks, moving bytes between bqws and a client's OS socket */
+size_t _srv_io_send(void *user, bqws_socket *ws, const void *data, size_t size) {
+    (void) ws;
+    _srv_Client *client = user;
+    long sent = evloop_send(client->fd, data, size);
+    if (sent < 0) return SIZE_MAX;
+    if ((size_t) sent < size) client->want_write = true;
+    return (size_t) sent;
+}
+size_t _srv_io_recv(void *user, bqws_socket *ws, void *data, size_t max_size, size_t min_size) {
+    (void) ws; (void) min_size;
+    _srv_Client *client = user;
+    long got = evloop_recv(client->fd, data, max_size);
+    return (got < 0) ? SIZE_MAX : (size_t) got;
+}
+void _srv_io_close(void *user, bqws_socket *ws) {
+    (void) ws;
+    _srv_Client *client = user;
+    if (client->fd == EVLOOP_BAD_FD) return;
+    evloop_unwatch(&client->shard->loop, client->fd);
+    evloop_close_fd(client->fd);
+    client->fd = EVLOOP_BAD_FD;
+}
+
+/* returns a free client slot, growing the pool by a page if there are none.
+   the slot is put on the live list, but otherwise left for the caller to fill */
+_srv_Client *_srv_alloc_client(_srv_Shard *shard) {
+    if (shard->free_len == 0) {
+        int page_count = shard->page_count + 1;
+        shard->pages = realloc(shard->pages, page_count * sizeof(_srv_Client *));
+        shard->pages[shard->page_count] = calloc(SRV_CLIENT_PAGE, sizeof(_srv_Client));
+
+        int cap = page_count * SRV_CLIENT_PAGE;
+        shard->free_ids = realloc(shard->free_ids, cap * sizeof(uint32_t));
+        shard->live = realloc(shard->live, cap * sizeof(uint32_t));
+        /* pushed in reverse, so the lowest ids are handed out first */
+        for (uint32_t id = cap; id-- > (uint32_t) shard->page_count * SRV_CLIENT_PAGE;)
+            shard->free_ids[shard->free_len++] = id;
+        shard->page_count = page_count;
+    }
+
+    uint32_t id = shard->free_ids[--shard->free_len];
+    _srv_Client *client = _srv_client_from_id(shard, id);
+    *client = (_srv_Client) {
+        .id = id,
+        .live_index = shard->live_len,
+        .generation = client->generation + 1,
+        /* whoever had the slot last leaves their buffer behind */
+        .out = { .data = client->out.data, .intern = &client->sent_strings },
+    };
+    shard->live[shard->live_len++] = id;
+    return client;
 }
 
-void _srv_apply_client_request(_srv_Client *client, NetToServer req);
+/* takes a client off the live list and returns its slot to the pool */
+void _srv_free_client(_srv_Shard *shard, _srv_Client *client) {
+    uint32_t last = shard->live[--shard->live_len];
+    shard->live[client->live_index] = last;
+    _srv_client_from_id(shard, last)->live_index = client->live_index;
+
+    shard->free_ids[shard->free_len++] = client->id;
+    client->ws = NULL;
+}
+
+/* gives a newly accepted socket a free client slot in this shard */
+void _srv_add_client(_srv_Shard *shard, evloop_Fd fd) {
+    if (shard->live_len >= shard->max_clients) {
+        /* best effort, the socket is non-blocking and about to be closed */
+        evloop_send(fd, SRV_OVERLOADED_RESPONSE, sizeof(SRV_OVERLOADED_RESPONSE) - 1);
+        evloop_close_fd(fd);
+        return;
+    }
+
+    _srv_Client *client = _srv_alloc_client(shard);
+    if (!evloop_watch(&shard->loop, fd, client->id, false, true)) {
+        _srv_free_client(shard, client);
+        evloop_close_fd(fd);
+        return;
+    }
+
+    client->fd = fd;
+    client->shard = shard;
+    client->ws = bqws_new_server(&(bqws_opts) {
+        .io = {
+            .user = client,
+            .send_fn = _srv_io_send,
+            .recv_fn = _srv_io_recv,
+            .close_fn = _srv_io_close,
+        },
+    }, NULL);
+    bqws_server_accept(client->ws, NULL);
+}
+
+void _srv_on_account_exists(void *ctx, NetToServer_AccountExists *msg);
+void _srv_on_account_trial(void *ctx, NetToServer_AccountTrial *msg);
+void _srv_on_account_register(void *ctx, NetToServer_AccountRegister *msg);
+void _srv_on_account_login(void *ctx, NetToServer_AccountLogin *msg);
+static NetToServerHandlers _srv_handlers = {
+    .account_exists = _srv_on_account_exists,
+    .account_trial = _srv_on_account_trial,
+    .account_register = _srv_on_account_register,
+    .account_login = _srv_on_account_login,
+};
 /* prints text websocket messages to stdout,
-   deserializes and applies to binary ones,
+   hands the messages in binary ones to _srv_handlers,
    and closes empty sockets. */
 void _srv_update_client_socket(_srv_Client *client) {
     bqws_socket *ws = client->ws;
 
+    client->want_write = false;
     bqws_update(ws);
     bqws_msg *msg;
     while ((msg = bqws_recv(ws)) != NULL) {
         if (msg->type == BQWS_MSG_TEXT) {
             printf("msg: %.*s\n", (int) msg->size, msg->data);
         } else if (msg->type == BQWS_MSG_BINARY) {
-            uint8_t *data = (uint8_t *) msg->data;
-            _srv_apply_client_request(client, unpack_net_to_server(data));
+            /* a frame can hold any number of messages */
+            _srv_Shard *shard = client->shard;
+            scratch_reset(&shard->scratch);
+            Reader r = frame_reader((uint8_t *) msg->data, msg->size, &shard->scratch, NULL);
+            shard->messages += dispatch_net_to_server(&r, &_srv_handlers, client);
+            if (r.err != FormpackErr_None) {
+                /* only this client's connection is worth giving up on */
+                printf("bad msg (%s), closing\n", formpack_err_str(r.err));
+                bqws_close(ws, BQWS_CLOSE_GENERIC_ERROR, NULL, 0);
+            }
         } else {
             bqws_close(ws, BQWS_CLOSE_GENERIC_ERROR, NULL, 0);
         }
         bqws_free_msg(msg);
     }
+    /* flush any replies now, rather than waiting for the next wakeup */
+    _srv_flush_client(client);
+}
+
+/* sends the client's batched replies and whatever else bqws has queued for
+   them, and frees the client if it's closed */
+void _srv_flush_client(_srv_Client *client) {
+    bqws_socket *ws = client->ws;
+    batch_flush(&client->out, ws);
+    bqws_update(ws);
 
     if (bqws_is_closed(ws)) {
         /* Free the socket and slot */
         bqws_free_socket(ws);
-        client->ws = NULL;
+        _srv_io_close(client, NULL);
+        _srv_free_client(client->shard, client);
+        return;
+    }
+
+    /* only ask to hear about writability while we have bytes stuck */
+    if (client->want_write != client->watching_write) {
+        evloop_watch(&client->shard->loop, client->fd, client->id, client->want_write, false);
+        client->watching_write = client->want_write;
     }
 }
 
-/* returns true if a player file with the given name already exists.
-   in the event of file i/o problems, still returns true, to prevent
-   potentially allowing someone to reserve an in-use username. */
+/* returns true if a player file with the given name already exists */
 bool _srv_pfile_exists(int user_len, char *user) {
-    char fpath[40 + MAX_USER_LEN];
-    sprintf(fpath, "%s/%.*s.pfile", PFILE_PATH, user_len, user);
-
-    return !(fopen(fpath, "rb") == NULL && errno == ENOENT);
+    return accounts_has(&_srv.accounts, user_len, user);
 }
 
 /* sends a NetToClient_AccountServerError */
@@ -131,41 +655,266 @@ void _srv_send_pfile_io_err(_srv_Client *client) {
     int err_str_len = (int) min(235, strlen(err_str));
     sprintf(desc, "pfile i/o: %d (%.*s)", errno, err_str_len, err_str);
     NetToClient_AccountServerError res = { .desc = string_from_nulterm(desc) };
-    send_net_to_client_account_server_error(res, client->ws);
+    batch_net_to_client_account_server_error(res, &client->out, client->ws);
+}
+
+/* sends a NetToClient_AccountServerError saying to try again later */
+void _srv_send_busy(_srv_Client *client) {
+    NetToClient_AccountServerError res = {
+        .desc = string_from_nulterm("too many logins at once, try again in a moment"),
+    };
+    batch_net_to_client_account_server_error(res, &client->out, client->ws);
 }
 
-/* makes a new player file of up to `len` chars, filled with content from `buf`.
-   the username becomes the name of the new pfile.
-   returns false and sends a NetToClient_AccountServerError
-   if file i/o won't work well enough to facilitate this. */
-bool _srv_make_pfile(_srv_Client *client, int user_len, char *user, int len, char *buf) {
-    char fpath[40 + MAX_USER_LEN];
-    sprintf(fpath, "%s/%.*s.pfile", PFILE_PATH, user_len, user);
+/* returns the client `waiter` refers to, or NULL if they've left since.
+   if they're still here, their login is put back to what it was */
+_srv_Client *_srv_resume_client(_srv_Shard *shard, _srv_Waiter waiter) {
+    _srv_Client *client = _srv_client_from_id(shard, waiter.ref.id);
+    if (client->ws == NULL || client->generation != waiter.ref.generation) return NULL;
+    client->login = waiter.was;
+    return client;
+}
 
-    FILE* f = fopen(fpath, "w");
-    if (f != NULL) {
-        fwrite(buf, 1, len, f);
-        return true;
-    } else {
-        _srv_send_pfile_io_err(client);
-        return false;
+/* queues a new player file of up to `len` chars, filled with content from `buf`,
+   to be written under the (already reserved) username.
+   `waiter` is told how it went once the pfile is safely on disk. */
+void _srv_make_pfile(_srv_Shard *shard, _srv_Waiter waiter,
+                     int user_len, char *user, int len, char *buf) {
+    if (shard->registrations == NULL) {
+        shard->registrations = calloc(1, sizeof(_srv_Commit));
+        shard->registrations->shard = shard;
     }
+    _srv_Commit *commit = shard->registrations;
+    accounts_batch_add(&commit->batch, user_len, user, len, buf);
+
+    int i = commit->batch.count - 1;
+    if (i == commit->waiters_cap) {
+        commit->waiters_cap = commit->waiters_cap ? commit->waiters_cap * 2 : 16;
+        commit->waiters = realloc(commit->waiters, commit->waiters_cap * sizeof(_srv_Waiter));
+    }
+    commit->waiters[i] = waiter;
+}
+
+/* fills `out` with cryptographically random bytes, returns false if it can't */
+bool _srv_random_bytes(uint8_t *out, int len) {
+#ifdef _WIN32
+    /* RtlGenRandom, which advapi32 exports under this name */
+    BOOLEAN NTAPI SystemFunction036(PVOID buf, ULONG len);
+    return SystemFunction036(out, (ULONG) len);
+#else
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (f == NULL) return false;
+    bool ok = fread(out, 1, len, f) == (size_t) len;
+    fclose(f);
+    return ok;
+#endif
+}
+
+/* runs on a hash thread */
+void _srv_pass_hash_job(void *arg) {
+    _srv_PassHash *hash = arg;
+    uint8_t *pfile = hash->pfile, *salt = pfile + 5;
+    pfile[0] = 0;
+    pfile[1] = SRV_PFILE_SCRYPT;
+    pfile[2] = (uint8_t) _srv.hash_cost;
+    pfile[3] = SRV_SCRYPT_R;
+    pfile[4] = SRV_SCRYPT_P;
+
+    hash->ok = _srv_random_bytes(salt, SRV_SALT_LEN)
+            && scrypt((uint8_t *) hash->pass, hash->pass_len, salt, SRV_SALT_LEN,
+                      pfile[2], pfile[3], pfile[4], salt + SRV_SALT_LEN, SRV_HASH_LEN);
+    hash->err = hash->ok ? 0 : (errno ? errno : ENOMEM);
+    _srv_post(hash->shard, (_srv_Mail) { .kind = _srv_MailKind_PassHash, .hash = hash });
 }
 
-/* reads up to `len` chars of a player file into `buf`.
-   `user` specifies whose pfile to find.
-   returns false and sends a NetToClient_AccountServerError
-   if file i/o won't work well enough to facilitate this. */
-int _srv_read_pfile(_srv_Client *client, int user_len, char *user, int len, char *buf) {
-    char fpath[40 + MAX_USER_LEN];
-    sprintf(fpath, "%s/%.*s.pfile", PFILE_PATH, user_len, user);
+/* hashes `pass` on a hash thread, then queues a pfile holding that hash
+   to be written under the (already reserved) username.
+   if the hash threads are too backed up, the name is given back
+   and the client is told to try again later. */
+void _srv_register(_srv_Client *client, int user_len, char *user, int pass_len, char *pass) {
+    _srv_PassHash *hash = malloc(sizeof(_srv_PassHash));
+    *hash = (_srv_PassHash) {
+        .shard = client->shard,
+        .waiter = { { client->id, client->generation }, client->login },
+        .user_len = (uint8_t) user_len,
+        .pass_len = (uint8_t) pass_len,
+    };
+    memcpy(hash->user, user, user_len);
+    memcpy(hash->pass, pass, pass_len);
+
+    if (!workers_submit(&_srv.hash, _srv_pass_hash_job, hash)) {
+        accounts_unreserve(&_srv.accounts, user_len, user);
+        _srv_send_busy(client);
+        free(hash);
+        return;
+    }
+    client->login = _srv_Login_Registering;
+}
 
-    FILE* f = fopen(fpath, "r+b");
-    if (f != NULL) return (int) fread(buf, 1, len, f);
+/* queues the freshly hashed password to be written out,
+   or lets the client know it couldn't be hashed */
+void _srv_finish_hash(_srv_Shard *shard, _srv_PassHash *hash) {
+    if (hash->ok)
+        /* even if they've left, they did register */
+        _srv_make_pfile(shard, hash->waiter, hash->user_len, hash->user,
+                        SRV_PFILE_LEN, (char *) hash->pfile);
     else {
+        accounts_unreserve(&_srv.accounts, hash->user_len, hash->user);
+        _srv_Client *client = _srv_resume_client(shard, hash->waiter);
+        if (client) {
+            errno = hash->err;
+            _srv_send_pfile_io_err(client);
+            _srv_flush_client(client);
+        }
+    }
+    free(hash);
+}
+
+/* runs on an i/o thread */
+void _srv_commit_job(void *arg) {
+    _srv_Commit *commit = arg;
+    commit->ok = accounts_commit(&_srv.accounts, &commit->batch);
+    commit->err = errno;
+    _srv_post(commit->shard, (_srv_Mail) { .kind = _srv_MailKind_Commit, .commit = commit });
+}
+
+/* hands the pfiles queued so far to an i/o thread to write out
+   with one write and one fsync, if it isn't busy with the last lot.
+   if they can't be handed off, the registrants are told it failed */
+void _srv_commit_registrations(_srv_Shard *shard) {
+    if (shard->committing || shard->registrations == NULL) return;
+    _srv_Commit *commit = shard->registrations;
+    shard->registrations = NULL;
+    shard->committing = true;
+    if (!workers_submit(&_srv.io, _srv_commit_job, commit)) {
+        commit->ok = false;
+        commit->err = EAGAIN;
+        _srv_finish_registrations(shard, commit);
+    }
+}
+
+/* lets each registrant that's still around know how their commit went */
+void _srv_finish_registrations(_srv_Shard *shard, _srv_Commit *commit) {
+    accounts_Batch *batch = &commit->batch;
+    for (int i = 0; i < batch->count; i++) {
+        accounts_Entry *e = &batch->entries[i];
+        if (!commit->ok) accounts_unreserve(&_srv.accounts, e->len, e->user);
+
+        _srv_Client *client = _srv_resume_client(shard, commit->waiters[i]);
+        if (client == NULL) continue;
+
+        if (commit->ok) {
+            client->login = _srv_Login_Full;
+            String user = { .str = e->user, .len = e->len };
+            batch_net_to_client_account_login_accept(
+                (NetToClient_AccountLoginAccept) { .user = user },
+                &client->out, client->ws
+            );
+        } else {
+            errno = commit->err;
+            _srv_send_pfile_io_err(client);
+        }
+        _srv_flush_client(client);
+    }
+
+    free(batch->buf);
+    free(batch->entries);
+    free(commit->waiters);
+    free(commit);
+    shard->committing = false;
+}
+
+/* runs on a hash thread */
+void _srv_pass_check_job(void *arg) {
+    _srv_PfileRead *read = arg;
+    uint8_t *pfile = (uint8_t *) read->stored, *salt = pfile + 5, hash[SRV_HASH_LEN];
+    if (scrypt((uint8_t *) read->pass, read->pass_len, salt, SRV_SALT_LEN,
+               pfile[2], pfile[3], pfile[4], hash, SRV_HASH_LEN))
+        read->matches = scrypt_equal(hash, salt + SRV_SALT_LEN, SRV_HASH_LEN);
+    else
+        read->stored_len = -1, read->err = ENOMEM;
+    _srv_post(read->shard, (_srv_Mail) { .kind = _srv_MailKind_PfileRead, .read = read });
+}
+
+/* runs on an i/o thread */
+void _srv_pfile_read_job(void *arg) {
+    _srv_PfileRead *read = arg;
+    read->stored_len = accounts_read(&_srv.accounts, read->user_len, read->user,
+                                     sizeof(read->stored), read->stored);
+    read->err = errno;
+
+    uint8_t *pfile = (uint8_t *) read->stored;
+    read->hashed = read->stored_len > 0 && pfile[0] == 0;
+    if (read->hashed) {
+        bool valid = read->stored_len == SRV_PFILE_LEN && pfile[1] == SRV_PFILE_SCRYPT
+                  && pfile[2] >= 1 && pfile[2] <= 30 && pfile[3] >= 1 && pfile[4] >= 1;
+        if (!valid)
+            read->stored_len = -1, read->err = EINVAL;
+        /* checking it is too slow for an i/o thread, so pass it along */
+        else if (workers_submit(&_srv.hash, _srv_pass_check_job, read))
+            return;
+        else
+            read->busy = true;
+    }
+    _srv_post(read->shard, (_srv_Mail) { .kind = _srv_MailKind_PfileRead, .read = read });
+}
+
+/* reads `user`'s pfile on an i/o thread to check `pass` against it.
+   the client is told whether they're in once it's been read,
+   or to try again later if the i/o threads won't take it. */
+void _srv_read_pfile(_srv_Client *client, int user_len, char *user, int pass_len, char *pass) {
+    _srv_PfileRead *read = malloc(sizeof(_srv_PfileRead));
+    *read = (_srv_PfileRead) {
+        .shard = client->shard,
+        .waiter = { { client->id, client->generation }, client->login },
+        .user_len = (uint8_t) user_len,
+        .pass_len = (uint8_t) pass_len,
+    };
+    memcpy(read->user, user, user_len);
+    memcpy(read->pass, pass, pass_len);
+
+    if (!workers_submit(&_srv.io, _srv_pfile_read_job, read)) {
+        _srv_send_busy(client);
+        free(read);
+        return;
+    }
+    client->login = _srv_Login_Reading;
+}
+
+/* lets the client know whether the login attempt matched their pfile,
+   which is only compared here if it's from before passwords were hashed.
+   sends a NetToClient_AccountServerError if it couldn't be read. */
+void _srv_finish_login(_srv_Shard *shard, _srv_PfileRead *read) {
+    _srv_Client *client = _srv_resume_client(shard, read->waiter);
+    if (client == NULL) {
+        free(read);
+        return;
+    }
+
+    String user = { .str = read->user, .len = read->user_len },
+           pass = { .str = read->pass, .len = read->pass_len },
+           stored_pass = { .str = read->stored, .len = (uint8_t) read->stored_len };
+    if (read->stored_len < 0) {
+        errno = read->err;
         _srv_send_pfile_io_err(client);
-        return 0;
+    } else if (read->busy) {
+        _srv_send_busy(client);
+    } else if (read->hashed ? read->matches : string_eq(&stored_pass, &pass)) {
+        client->login = _srv_Login_Full;
+        batch_net_to_client_account_login_accept(
+            (NetToClient_AccountLoginAccept) { .user = user },
+            &client->out, client->ws
+        );
+    } else {
+        NetToClient_AccountBadPass bad_pass = {
+            .pass = pass,
+            .reason = string_from_nulterm("doesn't match what we have; incorrect"),
+        };
+        batch_net_to_client_account_bad_pass(bad_pass, &client->out, client->ws);
     }
+
+    _srv_flush_client(client);
+    free(read);
 }
 
 /* checks if a username is invalid,
@@ -188,7 +937,7 @@ bool _srv_user_valid(_srv_Client *client, String *user) {
             .user = *user,
             .reason = string_from_nulterm(wrong),
         };
-        send_net_to_client_account_bad_user(res, client->ws);
+        batch_net_to_client_account_bad_user(res, &client->out, client->ws);
         return false;
     }
 }
@@ -210,85 +959,66 @@ bool _srv_pass_valid(_srv_Client *client, String *pass) {
             .pass = *pass,
             .reason = string_from_nulterm(wrong),
         };
-        send_net_to_client_account_bad_pass(res, client->ws);
+        batch_net_to_client_account_bad_pass(res, &client->out, client->ws);
         return false;
     }
 }
 
-void _srv_apply_client_request(_srv_Client *client, NetToServer nts) {
-    String *user, *pass;
-    switch (nts.kind) {
-    case (NetToServerKind_AccountExists):;
-        user = &nts.account_exists.user;
-        /* let them know if the username is invalid and quit if so */
-        if (!_srv_user_valid(client, user)) break;
+/* handlers for each kind of message clients send, `ctx` is the _srv_Client */
+void _srv_on_account_exists(void *ctx, NetToServer_AccountExists *msg) {
+    _srv_Client *client = ctx;
+    String *user = &msg->user;
+    /* let them know if the username is invalid and quit if so */
+    if (!_srv_user_valid(client, user)) return;
 
-        NetToClient_AccountStatus res = {
-            .user = *user,
-            .exists = _srv_pfile_exists(unspool(*user)),
-        };
-        send_net_to_client_account_status(res, client->ws);
-        break;
-    case (NetToServerKind_AccountTrial):;
-        user = &nts.account_trial.user;
-
-        /* error handling */
-        if (client->login == _srv_Login_Full) break;
-        if (!_srv_user_valid(client, user)) break;
-        if (_srv_pfile_exists(unspool(*user))) break;
-
-        client->login = _srv_Login_Trial;
-        send_net_to_client_account_trial_accept(
-            (NetToClient_AccountTrialAccept) { .user = *user },
-            client->ws
-        );
-        break;
-    case (NetToServerKind_AccountRegister):;
-        user = &nts.account_register.user;
-        pass = &nts.account_register.pass;
-
-        /* error handling */
-        if (client->login == _srv_Login_Full) break;
-        if (!_srv_user_valid(client, user)) break;
-        if (!_srv_pass_valid(client, pass)) break;
-        if (_srv_pfile_exists(unspool(*user))) break;
-
-        if (!_srv_make_pfile(client, unspool(*user), unspool(*pass))) break;
-        client->login = _srv_Login_Full;
-        send_net_to_client_account_login_accept(
-            (NetToClient_AccountLoginAccept) { .user = *user },
-            client->ws
-        );
-        break;
-    case (NetToServerKind_AccountLogin):;
-        user = &nts.account_login.user;
-        pass = &nts.account_login.pass;
-
-        /* error handling */
-        if (client->login == _srv_Login_Full) break;
-        if (!_srv_user_valid(client, user)) break;
-        if (!_srv_pass_valid(client, pass)) break;
-        if (!_srv_pfile_exists(unspool(*user))) break;
-
-        char stored_pass_str[MAX_PASS_LEN];
-        int len = _srv_read_pfile(client, unspool(*user), MAX_PASS_LEN, stored_pass_str);
-        if (len == 0) break;
-        String stored_pass = { .str = stored_pass_str, .len = (uint8_t) len };
-
-        if (string_eq(&stored_pass, pass)) {
-            client->login = _srv_Login_Full;
-            send_net_to_client_account_login_accept(
-                (NetToClient_AccountLoginAccept) { .user = *user },
-                client->ws
-            );
-        } else {
-            NetToClient_AccountBadPass bad_pass = {
-                .pass = *pass,
-                .reason = string_from_nulterm("doesn't match what we have; incorrect"),
-            };
-            send_net_to_client_account_bad_pass(bad_pass, client->ws);
-        }
+    NetToClient_AccountStatus res = {
+        .user = *user,
+        .exists = _srv_pfile_exists(unspool(*user)),
+    };
+    batch_net_to_client_account_status(res, &client->out, client->ws);
+}
 
-        break;
-    }
+void _srv_on_account_trial(void *ctx, NetToServer_AccountTrial *msg) {
+    _srv_Client *client = ctx;
+    String *user = &msg->user;
+
+    /* error handling */
+    if (client->login >= _srv_Login_Reading) return;
+    if (!_srv_user_valid(client, user)) return;
+    if (_srv_pfile_exists(unspool(*user))) return;
+
+    client->login = _srv_Login_Trial;
+    batch_net_to_client_account_trial_accept(
+        (NetToClient_AccountTrialAccept) { .user = *user },
+        &client->out, client->ws
+    );
+}
+
+void _srv_on_account_register(void *ctx, NetToServer_AccountRegister *msg) {
+    _srv_Client *client = ctx;
+    String *user = &msg->user, *pass = &msg->pass;
+
+    /* error handling */
+    if (client->login >= _srv_Login_Reading) return;
+    if (!_srv_user_valid(client, user)) return;
+    if (!_srv_pass_valid(client, pass)) return;
+    /* reserves the name, so a registration racing on another shard loses */
+    if (!accounts_reserve(&_srv.accounts, unspool(*user))) return;
+
+    /* accepted once it's hashed and on disk, see _srv_finish_registrations */
+    _srv_register(client, unspool(*user), unspool(*pass));
+}
+
+void _srv_on_account_login(void *ctx, NetToServer_AccountLogin *msg) {
+    _srv_Client *client = ctx;
+    String *user = &msg->user, *pass = &msg->pass;
+
+    /* error handling */
+    if (client->login >= _srv_Login_Reading) return;
+    if (!_srv_user_valid(client, user)) return;
+    if (!_srv_pass_valid(client, pass)) return;
+    if (!_srv_pfile_exists(unspool(*user))) return;
+
+    /* answered once the pfile's been read, see _srv_finish_login */
+    _srv_read_pfile(client, unspool(*user), unspool(*pass));
 }
@@ -0,0 +1,238 @@
+/* scrypt (RFC 7914), and the SHA-256, HMAC and PBKDF2 it's built from.
+   used to hash passwords, so that a leaked account log doesn't leak them.
+   scrypt is deliberately slow and memory hungry: with r = 8 one hash
+   touches 1 KiB * 2^log_n of memory, so call it off the network threads. */
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t len; /* bytes hashed so far */
+    uint8_t block[64];
+} scrypt_Sha256;
+
+static const uint32_t _scrypt_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define _scrypt_rotr(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define _scrypt_rotl(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+INLINE uint32_t _scrypt_be32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+INLINE void _scrypt_put_be32(uint8_t *p, uint32_t x) {
+    p[0] = (uint8_t) (x >> 24), p[1] = (uint8_t) (x >> 16), p[2] = (uint8_t) (x >> 8), p[3] = (uint8_t) x;
+}
+INLINE uint32_t _scrypt_le32(const uint8_t *p) {
+    return p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+INLINE void _scrypt_put_le32(uint8_t *p, uint32_t x) {
+    p[0] = (uint8_t) x, p[1] = (uint8_t) (x >> 8), p[2] = (uint8_t) (x >> 16), p[3] = (uint8_t) (x >> 24);
+}
+
+void _scrypt_sha256_block(scrypt_Sha256 *h, const uint8_t *block) {
+    uint32_t w[64], s[8];
+    for (int i = 0; i < 16; i++) w[i] = _scrypt_be32(block + i*4);
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = _scrypt_rotr(w[i-15], 7) ^ _scrypt_rotr(w[i-15], 18) ^ (w[i-15] >> 3),
+                 s1 = _scrypt_rotr(w[i-2], 17) ^ _scrypt_rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    memcpy(s, h->state, sizeof(s));
+    for (int i = 0; i < 64; i++) {
+        uint32_t e = s[4], a = s[0],
+                 ch = (e & s[5]) ^ (~e & s[6]),
+                 maj = (a & s[1]) ^ (a & s[2]) ^ (s[1] & s[2]),
+                 t1 = s[7] + (_scrypt_rotr(e, 6) ^ _scrypt_rotr(e, 11) ^ _scrypt_rotr(e, 25))
+                           + ch + _scrypt_sha256_k[i] + w[i],
+                 t2 = (_scrypt_rotr(a, 2) ^ _scrypt_rotr(a, 13) ^ _scrypt_rotr(a, 22)) + maj;
+        memmove(s + 1, s, 7 * sizeof(uint32_t));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++) h->state[i] += s[i];
+}
+
+void scrypt_sha256_init(scrypt_Sha256 *h) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(h->state, iv, sizeof(iv));
+    h->len = 0;
+}
+
+void scrypt_sha256_update(scrypt_Sha256 *h, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    while (len > 0) {
+        int used = (int) (h->len % 64), take = (int) min((size_t) (64 - used), len);
+        memcpy(h->block + used, bytes, take);
+        h->len += take, bytes += take, len -= take;
+        if (used + take == 64) _scrypt_sha256_block(h, h->block);
+    }
+}
+
+void scrypt_sha256_final(scrypt_Sha256 *h, uint8_t out[32]) {
+    uint64_t bits = h->len * 8;
+    uint8_t pad[72] = { 0x80 };
+    int pad_len = (int) ((h->len % 64 < 56) ? (56 - h->len % 64) : (120 - h->len % 64));
+    for (int i = 0; i < 8; i++) pad[pad_len + i] = (uint8_t) (bits >> (56 - i*8));
+    scrypt_sha256_update(h, pad, pad_len + 8);
+    for (int i = 0; i < 8; i++) _scrypt_put_be32(out + i*4, h->state[i]);
+}
+
+/* HMAC-SHA256, split up so PBKDF2 can key it once and reuse it */
+typedef struct {
+    scrypt_Sha256 inner, outer;
+} scrypt_Hmac;
+
+void scrypt_hmac_init(scrypt_Hmac *m, const uint8_t *key, size_t key_len) {
+    uint8_t k[64] = {0}, pad[64];
+    if (key_len > 64) {
+        scrypt_Sha256 h;
+        scrypt_sha256_init(&h);
+        scrypt_sha256_update(&h, key, key_len);
+        scrypt_sha256_final(&h, k);
+    } else
+        memcpy(k, key, key_len);
+
+    for (int i = 0; i < 64; i++) pad[i] = k[i] ^ 0x36;
+    scrypt_sha256_init(&m->inner);
+    scrypt_sha256_update(&m->inner, pad, 64);
+    for (int i = 0; i < 64; i++) pad[i] = k[i] ^ 0x5c;
+    scrypt_sha256_init(&m->outer);
+    scrypt_sha256_update(&m->outer, pad, 64);
+}
+
+void scrypt_hmac_final(scrypt_Hmac *m, uint8_t out[32]) {
+    uint8_t inner[32];
+    scrypt_sha256_final(&m->inner, inner);
+    scrypt_sha256_update(&m->outer, inner, 32);
+    scrypt_sha256_final(&m->outer, out);
+}
+
+/* PBKDF2-HMAC-SHA256 (RFC 8018) */
+void scrypt_pbkdf2_sha256(const uint8_t *pass, size_t pass_len,
+                          const uint8_t *salt, size_t salt_len,
+                          uint64_t iterations, uint8_t *out, size_t out_len) {
+    scrypt_Hmac keyed, m;
+    scrypt_hmac_init(&keyed, pass, pass_len);
+
+    for (uint32_t block = 1; out_len > 0; block++) {
+        uint8_t be_block[4], u[32], t[32];
+        _scrypt_put_be32(be_block, block);
+        m = keyed;
+        scrypt_sha256_update(&m.inner, salt, salt_len);
+        scrypt_sha256_update(&m.inner, be_block, 4);
+        scrypt_hmac_final(&m, u);
+        memcpy(t, u, 32);
+
+        for (uint64_t i = 1; i < iterations; i++) {
+            m = keyed;
+            scrypt_sha256_update(&m.inner, u, 32);
+            scrypt_hmac_final(&m, u);
+            for (int j = 0; j < 32; j++) t[j] ^= u[j];
+        }
+
+        size_t take = min(out_len, (size_t) 32);
+        memcpy(out, t, take);
+        out += take, out_len -= take;
+    }
+}
+
+/* the salsa20/8 core, applied to `b` in place */
+void _scrypt_salsa20_8(uint32_t b[16]) {
+    uint32_t x[16];
+    memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        /* columns */
+        x[ 4] ^= _scrypt_rotl(x[ 0] + x[12],  7);  x[ 8] ^= _scrypt_rotl(x[ 4] + x[ 0],  9);
+        x[12] ^= _scrypt_rotl(x[ 8] + x[ 4], 13);  x[ 0] ^= _scrypt_rotl(x[12] + x[ 8], 18);
+        x[ 9] ^= _scrypt_rotl(x[ 5] + x[ 1],  7);  x[13] ^= _scrypt_rotl(x[ 9] + x[ 5],  9);
+        x[ 1] ^= _scrypt_rotl(x[13] + x[ 9], 13);  x[ 5] ^= _scrypt_rotl(x[ 1] + x[13], 18);
+        x[14] ^= _scrypt_rotl(x[10] + x[ 6],  7);  x[ 2] ^= _scrypt_rotl(x[14] + x[10],  9);
+        x[ 6] ^= _scrypt_rotl(x[ 2] + x[14], 13);  x[10] ^= _scrypt_rotl(x[ 6] + x[ 2], 18);
+        x[ 3] ^= _scrypt_rotl(x[15] + x[11],  7);  x[ 7] ^= _scrypt_rotl(x[ 3] + x[15],  9);
+        x[11] ^= _scrypt_rotl(x[ 7] + x[ 3], 13);  x[15] ^= _scrypt_rotl(x[11] + x[ 7], 18);
+        /* rows */
+        x[ 1] ^= _scrypt_rotl(x[ 0] + x[ 3],  7);  x[ 2] ^= _scrypt_rotl(x[ 1] + x[ 0],  9);
+        x[ 3] ^= _scrypt_rotl(x[ 2] + x[ 1], 13);  x[ 0] ^= _scrypt_rotl(x[ 3] + x[ 2], 18);
+        x[ 6] ^= _scrypt_rotl(x[ 5] + x[ 4],  7);  x[ 7] ^= _scrypt_rotl(x[ 6] + x[ 5],  9);
+        x[ 4] ^= _scrypt_rotl(x[ 7] + x[ 6], 13);  x[ 5] ^= _scrypt_rotl(x[ 4] + x[ 7], 18);
+        x[11] ^= _scrypt_rotl(x[10] + x[ 9],  7);  x[ 8] ^= _scrypt_rotl(x[11] + x[10],  9);
+        x[ 9] ^= _scrypt_rotl(x[ 8] + x[11], 13);  x[10] ^= _scrypt_rotl(x[ 9] + x[ 8], 18);
+        x[12] ^= _scrypt_rotl(x[15] + x[14],  7);  x[13] ^= _scrypt_rotl(x[12] + x[15],  9);
+        x[14] ^= _scrypt_rotl(x[13] + x[12], 13);  x[15] ^= _scrypt_rotl(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; i++) b[i] += x[i];
+}
+
+/* scryptBlockMix: `in` and `out` are 2r 64 byte blocks, as words */
+void _scrypt_block_mix(const uint32_t *in, uint32_t *out, int r) {
+    uint32_t x[16];
+    memcpy(x, in + (2*r - 1) * 16, sizeof(x));
+    for (int i = 0; i < 2*r; i++) {
+        for (int j = 0; j < 16; j++) x[j] ^= in[i*16 + j];
+        _scrypt_salsa20_8(x);
+        /* even blocks go in the first half, odd ones in the second */
+        memcpy(out + ((i / 2) + (i % 2) * r) * 16, x, sizeof(x));
+    }
+}
+
+/* scryptROMix, on one 128r byte block `b` in place.
+   `v` has room for 2^log_n such blocks, `xy` for two */
+void _scrypt_ro_mix(uint8_t *b, int r, int log_n, uint32_t *v, uint32_t *xy) {
+    int words = 32 * r;
+    uint64_t n = (uint64_t) 1 << log_n;
+    uint32_t *x = xy, *y = xy + words;
+
+    for (int i = 0; i < words; i++) x[i] = _scrypt_le32(b + i*4);
+    for (uint64_t i = 0; i < n; i++) {
+        memcpy(v + i * words, x, words * sizeof(uint32_t));
+        _scrypt_block_mix(x, y, r);
+        uint32_t *t = x; x = y, y = t;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        /* integerify: the first word of the last 64 byte block */
+        uint64_t j = x[(2*r - 1) * 16] & (n - 1);
+        for (int k = 0; k < words; k++) x[k] ^= v[j * words + k];
+        _scrypt_block_mix(x, y, r);
+        uint32_t *t = x; x = y, y = t;
+    }
+    for (int i = 0; i < words; i++) _scrypt_put_le32(b + i*4, x[i]);
+}
+
+/* derives `out_len` bytes from `pass` and `salt` with N = 2^log_n.
+   returns false if the 128 * r * N bytes of scratch memory couldn't be had. */
+bool scrypt(const uint8_t *pass, size_t pass_len, const uint8_t *salt, size_t salt_len,
+            int log_n, int r, int p, uint8_t *out, size_t out_len) {
+    size_t block = 128 * (size_t) r;
+    uint8_t *b = malloc(block * p);
+    uint32_t *v = malloc(block << log_n), *xy = malloc(block * 2);
+    bool ok = b && v && xy;
+
+    if (ok) {
+        scrypt_pbkdf2_sha256(pass, pass_len, salt, salt_len, 1, b, block * p);
+        for (int i = 0; i < p; i++) _scrypt_ro_mix(b + i * block, r, log_n, v, xy);
+        scrypt_pbkdf2_sha256(pass, pass_len, b, block * p, 1, out, out_len);
+    }
+    free(b);
+    free(v);
+    free(xy);
+    return ok;
+}
+
+/* compares without returning early, so how long it takes
+   says nothing about where `a` and `b` first differ */
+bool scrypt_equal(const uint8_t *a, const uint8_t *b, size_t len) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
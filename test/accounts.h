@@ -0,0 +1,350 @@
+/* the account log, and how its in-memory index answers whether a username
+   is taken against the fopen of a pfile the server used to do for it */
+
+void test_account_name(char *user, int i) {
+    snprintf(user, MAX_USER_LEN, "user%07d", i);
+}
+
+/* there's no closing a store in the server, it's open for as long as it runs */
+void _test_accounts_close(accounts_Store *s) {
+    _accounts_close(s->fd);
+    free(s->index.buckets);
+}
+
+/* registers users 0..count in batches, as the shards' group commits do */
+bool _test_register(accounts_Store *s, int count, int per_commit) {
+    accounts_Batch batch = {0};
+    bool ok = true;
+    for (int i = 0; i < count && ok; i++) {
+        char user[MAX_USER_LEN], data[64];
+        test_account_name(user, i);
+        int len = (int) strlen(user);
+        int data_len = snprintf(data, sizeof(data), "pass of %s", user);
+        ok = accounts_reserve(s, len, user);
+        accounts_batch_add(&batch, len, user, data_len, data);
+        if (batch.count == per_commit || i == count - 1) {
+            ok = ok && accounts_commit(s, &batch);
+            accounts_batch_clear(&batch);
+        }
+    }
+    free(batch.buf);
+    free(batch.entries);
+    return ok;
+}
+
+/* every account there is, each holding what it was last given,
+   and none that aren't. the first `changed` of them were given a new pfile */
+void _test_accounts_all_there(accounts_Store *s, int count, int changed, const char *when) {
+    CHECK(accounts_count(s) == (uint32_t) count, "%s: %u accounts, not %d",
+          when, accounts_count(s), count);
+    for (int i = 0; i < count + 10; i++) {
+        char user[MAX_USER_LEN], want[64], got[64];
+        test_account_name(user, i);
+        int len = (int) strlen(user);
+        CHECK(accounts_has(s, len, user) == (i < count), "%s: %s is %s", when, user,
+              i < count ? "missing" : "there");
+        if (i >= count) continue;
+        int want_len = snprintf(want, sizeof(want), "%spass of %s", i < changed ? "new " : "", user);
+        int got_len = accounts_read(s, len, user, sizeof(got), got);
+        CHECK(got_len == want_len && memcmp(got, want, want_len) == 0,
+              "%s: %s read back %d bytes", when, user, got_len);
+    }
+}
+
+/* gives users 0..count, already on file, a new pfile in one commit */
+bool _test_change(accounts_Store *s, int count) {
+    accounts_Batch batch = {0};
+    for (int i = 0; i < count; i++) {
+        char user[MAX_USER_LEN], data[64];
+        test_account_name(user, i);
+        int data_len = snprintf(data, sizeof(data), "new pass of %s", user);
+        accounts_batch_add(&batch, (int) strlen(user), user, data_len, data);
+    }
+    bool ok = accounts_commit(s, &batch);
+    free(batch.buf);
+    free(batch.entries);
+    return ok;
+}
+
+uint64_t _test_file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t) st.st_size : 0;
+}
+
+void test_accounts_store(void) {
+    char dir[256];
+    if (!test_temp_dir(dir, sizeof(dir))) {
+        CHECK(false, "couldn't make a directory to test in");
+        return;
+    }
+    accounts_Store s;
+    CHECK(accounts_open(&s, dir), "couldn't open a new log in %s", dir);
+    CHECK(_test_register(&s, 1000, 64), "couldn't register");
+    CHECK(!accounts_reserve(&s, 11, "user0000005"), "an existing user could be reserved");
+    _test_accounts_all_there(&s, 1000, 0, "registered");
+
+    /* the index is rebuilt from the log, then from the log compacted */
+    _test_accounts_close(&s);
+    CHECK(accounts_open(&s, dir), "couldn't reopen the log");
+    _test_accounts_all_there(&s, 1000, 0, "reopened");
+    CHECK(accounts_compact(&s), "couldn't compact the log");
+    _test_accounts_all_there(&s, 1000, 0, "compacted");
+    _test_accounts_close(&s);
+    CHECK(accounts_open(&s, dir), "couldn't reopen the compacted log");
+    _test_accounts_all_there(&s, 1000, 0, "reopened compacted");
+    _test_accounts_close(&s);
+    test_remove_dir(dir);
+}
+
+/* an index entry taken out of the middle of a probe chain leaves the rest
+   of the chain where lookups still find it, even where it wraps round */
+void test_accounts_index_remove(void) {
+    accounts_Index idx = {0};
+    _accounts_grow(&idx);
+    uint32_t mask = idx.cap - 1;
+
+    /* a chain of names all at home in the table's second to last bucket,
+       with others at home in and after it mixed in, then plenty more */
+    char (*users)[MAX_USER_LEN] = malloc(400 * MAX_USER_LEN);
+    int count = 0, chain = 0;
+    for (int i = 0; count < 400; i++) {
+        char user[MAX_USER_LEN];
+        test_account_name(user, i);
+        uint32_t home = _accounts_hash(ACCOUNTS_HASH_SEED, user, (int) strlen(user)) & mask;
+        bool near_end = home >= mask - 1 || home < 4;
+        if (count < 12 && !near_end) continue;
+        chain += home == mask - 1;
+        memcpy(users[count++], user, MAX_USER_LEN);
+    }
+    for (int i = 0; i < count; i++) {
+        bool added;
+        _accounts_upsert(&idx, (int) strlen(users[i]), users[i], &added);
+    }
+    CHECK(idx.cap == mask + 1, "the index grew");
+    CHECK(chain >= 3, "only %d names in the chain", chain);
+
+    /* middle of the chain first, then the rest in no particular order */
+    int order[400];
+    for (int i = 0; i < count; i++) order[i] = i;
+    order[0] = 5, order[5] = 0;
+    for (int i = count - 1; i > 1; i--) {
+        int j = 1 + (int) test_rand_below(i), t = order[i];
+        order[i] = order[j], order[j] = t;
+    }
+    bool gone[400] = {0};
+    for (int r = 0; r < count; r++) {
+        char *user = users[order[r]];
+        _accounts_remove(&idx, (int) strlen(user), user);
+        gone[order[r]] = true;
+        int wrong = 0;
+        for (int i = 0; i < count; i++) {
+            int len = (int) strlen(users[i]);
+            wrong += (idx.buckets[_accounts_bucket(&idx, len, users[i])].len != 0) == gone[i];
+        }
+        CHECK(wrong == 0, "after removing %s, %d names are wrongly there or not", user, wrong);
+        CHECK(idx.count == (uint32_t) (count - r - 1), "%u entries left, not %d", idx.count, count - r - 1);
+        if (wrong) break;
+    }
+    free(users);
+    free(idx.buckets);
+}
+
+/* a record cut short or corrupted at the end of the log, as a crash
+   mid-append leaves it, is cut off at startup and the rest kept */
+void test_accounts_torn_tail(void) {
+    char dir[256];
+    if (!test_temp_dir(dir, sizeof(dir))) {
+        CHECK(false, "couldn't make a directory to test in");
+        return;
+    }
+    accounts_Store s;
+    CHECK(accounts_open(&s, dir), "couldn't open a new log in %s", dir);
+    CHECK(_test_register(&s, 100, 64), "couldn't register");
+    uint64_t end = s.end;
+    _test_accounts_close(&s);
+
+    /* half of the next record */
+    uint8_t rec[ACCOUNTS_HEADER_SIZE + 64];
+    int size = _accounts_record(rec, 11, "user0000100", 20, "pass of user0000100");
+    FILE *f = fopen(s.path, "ab");
+    if (f) fwrite(rec, 1, size / 2, f), fclose(f);
+    CHECK(accounts_open(&s, dir), "couldn't reopen after a torn record");
+    _test_accounts_all_there(&s, 100, 0, "after a torn record");
+    CHECK(_test_file_size(s.path) == end, "the log is %llu bytes, not %llu",
+          (unsigned long long) _test_file_size(s.path), (unsigned long long) end);
+    uint64_t last = s.index.buckets[_accounts_bucket(&s.index, 11, "user0000099")].offset;
+    _test_accounts_close(&s);
+
+    /* a byte of the last whole record's pfile changed */
+    f = fopen(s.path, "r+b");
+    if (f) fseek(f, (long) end - 1, SEEK_SET), fputc('!', f), fclose(f);
+    CHECK(accounts_open(&s, dir), "couldn't reopen after a corrupt record");
+    _test_accounts_all_there(&s, 99, 0, "after a corrupt record");
+    CHECK(s.end == last && _test_file_size(s.path) == last, "the corrupt record wasn't cut off");
+
+    /* and what's appended next follows straight on */
+    CHECK(accounts_reserve(&s, 11, "user0000099"), "couldn't reserve the dropped account");
+    accounts_Batch batch = {0};
+    accounts_batch_add(&batch, 11, "user0000099", 19, "pass of user0000099");
+    CHECK(accounts_commit(&s, &batch), "couldn't register the dropped account again");
+    free(batch.buf);
+    free(batch.entries);
+    _test_accounts_close(&s);
+    CHECK(accounts_open(&s, dir), "couldn't reopen");
+    _test_accounts_all_there(&s, 100, 0, "registered again");
+    _test_accounts_close(&s);
+    test_remove_dir(dir);
+}
+
+/* compacting drops every superseded record, keeping only the latest */
+void test_accounts_compact(void) {
+    char dir[256];
+    if (!test_temp_dir(dir, sizeof(dir))) {
+        CHECK(false, "couldn't make a directory to test in");
+        return;
+    }
+    accounts_Store s;
+    CHECK(accounts_open(&s, dir), "couldn't open a new log in %s", dir);
+    CHECK(_test_register(&s, 1000, 64), "couldn't register");
+    uint64_t registered = s.end;
+    CHECK(_test_change(&s, 300) && _test_change(&s, 500), "couldn't change pfiles");
+    _test_accounts_all_there(&s, 1000, 500, "changed");
+    CHECK(s.end > s.live_bytes, "nothing superseded");
+
+    /* a reservation not on disk yet stays reserved, and out of the log */
+    CHECK(accounts_reserve(&s, 11, "user0001000"), "couldn't reserve");
+    uint64_t live = s.live_bytes;
+    CHECK(accounts_compact(&s), "couldn't compact the log");
+    CHECK(s.end == live && s.live_bytes == live && _test_file_size(s.path) == live,
+          "compacted to %llu bytes, not %llu", (unsigned long long) s.end, (unsigned long long) live);
+    CHECK(live > registered, "the new pfiles are longer, so the log should be too");
+    CHECK(!accounts_reserve(&s, 11, "user0001000"), "the reservation was lost");
+    accounts_unreserve(&s, 11, "user0001000");
+    _test_accounts_all_there(&s, 1000, 500, "compacted");
+
+    _test_accounts_close(&s);
+    CHECK(accounts_open(&s, dir), "couldn't reopen the compacted log");
+    _test_accounts_all_there(&s, 1000, 500, "reopened compacted");
+    CHECK(s.live_bytes == live, "reopened with %llu live bytes, not %llu",
+          (unsigned long long) s.live_bytes, (unsigned long long) live);
+    _test_accounts_close(&s);
+    test_remove_dir(dir);
+}
+
+/* old pfiles go into the log once, and are renamed out of the way after */
+void test_accounts_import(void) {
+    char dir[256], path[512];
+    if (!test_temp_dir(dir, sizeof(dir))) {
+        CHECK(false, "couldn't make a directory to test in");
+        return;
+    }
+    for (int i = 0; i < 20; i++) {
+        char user[MAX_USER_LEN];
+        test_account_name(user, i);
+        snprintf(path, sizeof(path), "%s/%s" PFILE_EXT, dir, user);
+        FILE *f = fopen(path, "wb");
+        if (f) fprintf(f, "pass of %s", user), fclose(f);
+    }
+    accounts_Store s;
+    CHECK(accounts_open(&s, dir), "couldn't open a new log in %s", dir);
+    CHECK(accounts_import_dir(&s, dir) == 20, "didn't import 20 pfiles");
+    _test_accounts_all_there(&s, 20, 0, "imported");
+    snprintf(path, sizeof(path), "%s/user0000007" PFILE_EXT, dir);
+    CHECK(fopen(path, "rb") == NULL, "%s is still there", path);
+    snprintf(path, sizeof(path), "%s/user0000007" PFILE_EXT PFILE_IMPORTED_EXT, dir);
+    CHECK(_test_file_size(path) > 0, "%s isn't there", path);
+    _test_accounts_close(&s);
+
+    /* as a startup stopped between committing and renaming would leave it */
+    snprintf(path, sizeof(path), "%s/user0000007" PFILE_EXT, dir);
+    FILE *f = fopen(path, "wb");
+    if (f) fputs("stale", f), fclose(f);
+    CHECK(accounts_open(&s, dir), "couldn't reopen the log");
+    CHECK(accounts_import_dir(&s, dir) == 0, "imported pfiles again");
+    CHECK(fopen(path, "rb") == NULL, "%s wasn't renamed", path);
+    _test_accounts_all_there(&s, 20, 0, "imported again");
+    _test_accounts_close(&s);
+    test_remove_dir(dir);
+}
+
+/* as many accounts as a busy server has, unless TEST_ACCOUNTS says otherwise.
+   a million pfiles can take minutes to write and delete again */
+#define TEST_BENCH_ACCOUNTS 1000000
+#define TEST_BENCH_LOOKUPS 100000
+
+int test_bench_accounts(void) {
+    char *env = getenv("TEST_ACCOUNTS");
+    int count = env ? atoi(env) : 0;
+    return count > 0 ? count : TEST_BENCH_ACCOUNTS;
+}
+
+/* names to look up, made up front so only the lookups are timed.
+   half of them are taken, half not */
+char (*_test_lookups(int accounts))[MAX_USER_LEN] {
+    char (*users)[MAX_USER_LEN] = malloc(TEST_BENCH_LOOKUPS * MAX_USER_LEN);
+    for (int i = 0; i < TEST_BENCH_LOOKUPS; i++)
+        test_account_name(users[i], (int) test_rand_below(accounts * 2));
+    return users;
+}
+
+void bench_accounts(void) {
+    int accounts = test_bench_accounts();
+    char dir[256], label[64];
+    if (!test_temp_dir(dir, sizeof(dir))) {
+        printf("  couldn't make a directory to work in\n");
+        return;
+    }
+
+    double start = test_seconds();
+    for (int i = 0; i < accounts; i++) {
+        char path[512], user[MAX_USER_LEN];
+        test_account_name(user, i);
+        snprintf(path, sizeof(path), "%s/%s" PFILE_EXT, dir, user);
+        FILE *f = fopen(path, "wb");
+        if (f) fputs("pass", f), fclose(f);
+    }
+    snprintf(label, sizeof(label), "writing %d pfiles", accounts);
+    printf("  %-40s %8.1f ms\n", label, (test_seconds() - start) * 1e3);
+
+    /* as _srv_pfile_exists did, with the file closed again */
+    char (*users)[MAX_USER_LEN] = _test_lookups(accounts);
+    int found = 0;
+    start = test_seconds();
+    for (int i = 0; i < TEST_BENCH_LOOKUPS; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s" PFILE_EXT, dir, users[i]);
+        FILE *f = fopen(path, "rb");
+        found += f != NULL;
+        if (f) fclose(f);
+    }
+    double secs = test_seconds() - start;
+    snprintf(label, sizeof(label), "%d fopens", TEST_BENCH_LOOKUPS);
+    printf("  %-40s %8.1f ms, %6.0f ns each\n", label, secs * 1e3, secs / TEST_BENCH_LOOKUPS * 1e9);
+
+    /* the pfiles moved into the log, as the server does the first time */
+    accounts_Store s;
+    start = test_seconds();
+    if (!accounts_open(&s, dir) || accounts_import_dir(&s, dir) != accounts) {
+        printf("  couldn't import them into the log\n");
+        test_remove_dir(dir);
+        free(users);
+        return;
+    }
+    printf("  %-40s %8.1f ms\n", "importing them into the log", (test_seconds() - start) * 1e3);
+    _test_accounts_close(&s);
+    start = test_seconds();
+    accounts_open(&s, dir);
+    printf("  %-40s %8.1f ms\n", "indexing the log at startup", (test_seconds() - start) * 1e3);
+
+    start = test_seconds();
+    for (int i = 0; i < TEST_BENCH_LOOKUPS; i++)
+        found += accounts_has(&s, (int) strlen(users[i]), users[i]);
+    secs = test_seconds() - start;
+    snprintf(label, sizeof(label), "%d accounts_has", TEST_BENCH_LOOKUPS);
+    printf("  %-40s %8.1f ms, %6.0f ns each\n", label, secs * 1e3, secs / TEST_BENCH_LOOKUPS * 1e9);
+    printf("  (of %d accounts, set TEST_ACCOUNTS for another count)\n", accounts);
+    test_sink += found;
+    free(users);
+    _test_accounts_close(&s);
+    test_remove_dir(dir);
+}
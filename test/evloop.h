@@ -0,0 +1,161 @@
+/* evloop on its own, against the 10ms sleep-poll tick the server used to run,
+   timed from a request being sent to its reply coming back. both just echo
+   what one loopback connection sends them, so this is a microbenchmark of
+   waking up for a socket, not of the server's request path: bqws, decoding
+   and the handler aren't in it */
+
+typedef struct {
+    evloop_Fd listener;
+    bool sleep_poll; /* check the socket every 10ms, as the old loop did */
+} _test_Echo;
+
+void *_test_echo_serve(void *arg) {
+    _test_Echo *e = arg;
+    evloop_Loop loop;
+    evloop_init(&loop);
+    evloop_watch(&loop, e->listener, 0, false, true);
+    evloop_Fd conn = EVLOOP_BAD_FD;
+    char buf[256];
+    for (;;) {
+        bool readable = false;
+        if (e->sleep_poll) {
+            test_sleep_ms(10);
+            readable = true;
+        } else {
+            evloop_Event events[4];
+            int count = evloop_wait(&loop, events, LEN(events), -1);
+            for (int i = 0; i < count; i++) readable |= events[i].readable;
+        }
+        if (!readable) continue;
+
+        if (conn == EVLOOP_BAD_FD) {
+            conn = evloop_accept(e->listener);
+            if (conn != EVLOOP_BAD_FD && !e->sleep_poll) evloop_watch(&loop, conn, 1, false, true);
+            continue;
+        }
+        long n = evloop_recv(conn, buf, sizeof(buf));
+        if (n < 0) break;
+        if (n > 0) evloop_send(conn, buf, n);
+    }
+    evloop_unwatch(&loop, conn);
+    evloop_close_fd(conn);
+    evloop_free(&loop);
+    return NULL;
+}
+
+/* a blocking connection to `listener`, on loopback */
+evloop_Fd test_connect(evloop_Fd listener) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    getsockname(listener, (struct sockaddr *) &addr, &len);
+    uint16_t port = addr.ss_family == AF_INET6 ? ((struct sockaddr_in6 *) &addr)->sin6_port
+                                               : ((struct sockaddr_in *) &addr)->sin_port;
+    struct sockaddr_in to = { .sin_family = AF_INET, .sin_port = port };
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    evloop_Fd fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == EVLOOP_BAD_FD || connect(fd, (struct sockaddr *) &to, sizeof(to)) != 0) abort();
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *) &on, sizeof(on));
+    return fd;
+}
+
+/* sends `count` requests, at random points in the old loop's tick,
+   timing each one's reply in `samples`, as microseconds */
+bool _test_echo_requests(evloop_Fd fd, double *samples, int count) {
+    char request[64] = "AccountExists", reply[64];
+    for (int i = 0; i < count; i++) {
+        test_sleep_ms(test_rand_below(10));
+        double start = test_seconds();
+        if (send(fd, request, sizeof(request), 0) != sizeof(request)) return false;
+        for (int got = 0; got < (int) sizeof(reply);) {
+            int n = (int) recv(fd, reply + got, sizeof(reply) - got, 0);
+            if (n <= 0) return false;
+            got += n;
+        }
+        samples[i] = (test_seconds() - start) * 1e6;
+    }
+    return true;
+}
+
+/* runs an echo server, in whichever mode, and sends it `count` requests */
+bool _test_echo(bool sleep_poll, double *samples, int count) {
+    _test_Echo e = { .listener = evloop_listen(0), .sleep_poll = sleep_poll };
+    if (e.listener == EVLOOP_BAD_FD) return false;
+    Thread server;
+    thread_start(&server, _test_echo_serve, &e);
+    evloop_Fd fd = test_connect(e.listener);
+    bool ok = _test_echo_requests(fd, samples, count);
+    evloop_close_fd(fd);
+    thread_join(server);
+    evloop_close_fd(e.listener);
+    return ok;
+}
+
+void test_evloop_echo(void) {
+    double samples[20];
+    CHECK(_test_echo(false, samples, LEN(samples)), "no reply from the event loop");
+}
+
+/* out of descriptors, a connection is turned away rather than left pending,
+   where it would keep the listener readable and the accept loop spinning */
+void test_evloop_fd_limit(void) {
+#ifndef _WIN32
+    evloop_Fd listener = evloop_listen(0);
+    struct rlimit was;
+    if (listener == EVLOOP_BAD_FD || getrlimit(RLIMIT_NOFILE, &was) != 0) {
+        CHECK(false, "couldn't listen on loopback");
+        return;
+    }
+    evloop_Loop loop;
+    evloop_init(&loop);
+    evloop_watch(&loop, listener, 0, false, true);
+
+    /* a handful of descriptors to spare, used up all but one for the client */
+    struct rlimit lim = was;
+    lim.rlim_cur = 256;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    int fillers[256], filler_count = 0, fd;
+    while (filler_count < LEN(fillers) && (fd = dup(listener)) >= 0) fillers[filler_count++] = fd;
+    if (filler_count) close(fillers[--filler_count]);
+    evloop_Fd client = test_connect(listener);
+
+    evloop_Event events[4];
+    CHECK(evloop_wait(&loop, events, LEN(events), 1000) == 1, "the connection never came");
+    CHECK(evloop_accept(listener) == EVLOOP_BAD_FD, "accepted with no descriptors left");
+    CHECK(evloop_wait(&loop, events, LEN(events), 0) == 0, "the listener is still readable");
+    struct timeval wait = { .tv_sec = 1 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+    char c;
+    long got = (long) recv(client, &c, 1, 0);
+    CHECK(got == 0 || (got < 0 && errno == ECONNRESET), "the connection wasn't closed");
+    evloop_close_fd(client);
+
+    /* and once there are some again, connections go through as before */
+    while (filler_count) close(fillers[--filler_count]);
+    setrlimit(RLIMIT_NOFILE, &was);
+    client = test_connect(listener);
+    evloop_wait(&loop, events, LEN(events), 1000);
+    evloop_Fd conn = evloop_accept(listener);
+    CHECK(conn != EVLOOP_BAD_FD, "couldn't accept once descriptors were freed");
+    if (conn != EVLOOP_BAD_FD) evloop_close_fd(conn);
+    evloop_close_fd(client);
+    evloop_free(&loop);
+    evloop_close_fd(listener);
+#endif
+}
+
+#define TEST_ECHO_REQUESTS 300
+
+void bench_evloop(void) {
+    static double samples[TEST_ECHO_REQUESTS];
+    const char *names[] = { "evloop echo", "sleep-poll echo" };
+    for (int sleep_poll = 0; sleep_poll < 2; sleep_poll++) {
+        if (!_test_echo(sleep_poll, samples, TEST_ECHO_REQUESTS)) {
+            printf("  %s: couldn't serve on loopback\n", names[sleep_poll]);
+            continue;
+        }
+        printf("  %-16s p50 %8.1f us  p99 %8.1f us\n", names[sleep_poll],
+               test_percentile(samples, TEST_ECHO_REQUESTS, 50),
+               test_percentile(samples, TEST_ECHO_REQUESTS, 99));
+    }
+}
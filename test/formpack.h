@@ -0,0 +1,593 @@
+/* round trips every kind of message formpack generates, feeds its decoders
+   truncated, corrupted and made up messages, and times packing and unpacking.
+   the tests' own messages, in test/formpack.dd, have every kind of field. */
+
+/* the generated functions for each tagged union, wrapped up so the tests
+   can go through all of them the same way */
+typedef union {
+    NetToServer to_server;
+    NetToClient to_client;
+    TestMsg test;
+} test_AnyMsg;
+typedef struct {
+    const char *name;
+    int kind_count;
+    size_t max_size;
+    test_AnyMsg (*random)(Scratch *s);
+    bool (*eq)(test_AnyMsg *a, test_AnyMsg *b);
+    uint32_t (*pack_into)(test_AnyMsg *d, uint8_t *buf, size_t cap, Intern *intern);
+    Pack (*pack)(test_AnyMsg *d);
+    FormpackErr (*unpack)(uint8_t *data, size_t size, Scratch *scratch, test_AnyMsg *out);
+    bool (*batch)(Batch *b, test_AnyMsg *d);
+    bool (*unpack_next)(Reader *r, test_AnyMsg *out);
+} test_Tagun;
+
+#define _TEST_TAGUN_FNS(T, t, m)                                                     \
+    test_AnyMsg _test_random_##t(Scratch *s) {                                       \
+        return (test_AnyMsg) { .m = random_##t(s) };                                 \
+    }                                                                                \
+    bool _test_eq_##t(test_AnyMsg *a, test_AnyMsg *b) {                              \
+        return eq_##t(&a->m, &b->m);                                                 \
+    }                                                                                \
+    uint32_t _test_pack_into_##t(test_AnyMsg *d, uint8_t *buf, size_t cap,           \
+                                 Intern *intern) {                                   \
+        return pack_##t##_into(&d->m, buf, cap, intern);                             \
+    }                                                                                \
+    Pack _test_pack_##t(test_AnyMsg *d) {                                            \
+        return pack_##t(&d->m);                                                      \
+    }                                                                                \
+    FormpackErr _test_unpack_##t(uint8_t *data, size_t size, Scratch *scratch,       \
+                                 test_AnyMsg *out) {                                 \
+        return unpack_##t(data, size, scratch, &out->m);                             \
+    }                                                                                \
+    bool _test_batch_##t(Batch *b, test_AnyMsg *d) {                                 \
+        return batch_##t(b, &d->m);                                                  \
+    }                                                                                \
+    bool _test_unpack_next_##t(Reader *r, test_AnyMsg *out) {                        \
+        return unpack_next_##t(r, &out->m);                                          \
+    }
+_TEST_TAGUN_FNS(NetToServer, net_to_server, to_server)
+_TEST_TAGUN_FNS(NetToClient, net_to_client, to_client)
+_TEST_TAGUN_FNS(TestMsg, test_msg, test)
+
+#define TEST_TAGUN(T, t, T_UPPER) {                                                  \
+    .name = #T,                                                                      \
+    .kind_count = T_UPPER##_KIND_COUNT,                                              \
+    .max_size = T_UPPER##_MAX_ENCODED_SIZE,                                          \
+    .random = _test_random_##t,                                                      \
+    .eq = _test_eq_##t,                                                              \
+    .pack_into = _test_pack_into_##t,                                                \
+    .pack = _test_pack_##t,                                                          \
+    .unpack = _test_unpack_##t,                                                      \
+    .batch = _test_batch_##t,                                                        \
+    .unpack_next = _test_unpack_next_##t,                                            \
+}
+static test_Tagun test_taguns[] = {
+    TEST_TAGUN(NetToServer, net_to_server, NET_TO_SERVER),
+    TEST_TAGUN(NetToClient, net_to_client, NET_TO_CLIENT),
+    TEST_TAGUN(TestMsg, test_msg, TEST_MSG),
+};
+
+/* plenty for any of the tests' random messages */
+#define TEST_MSG_CAP (64 << 10)
+#define TEST_ROUND_TRIPS 20000
+
+void test_formpack_round_trip(void) {
+    Scratch made = { 0 }, scratch = { 0 };
+    uint8_t *buf = malloc(TEST_MSG_CAP + 1);
+    for (int t = 0; t < LEN(test_taguns); t++) {
+        test_Tagun *tagun = &test_taguns[t];
+        int seen[256] = { 0 };
+        for (int i = 0; i < TEST_ROUND_TRIPS; i++) {
+            scratch_reset(&made);
+            scratch_reset(&scratch);
+            test_AnyMsg msg = tagun->random(&made), out;
+            uint32_t size = tagun->pack_into(&msg, buf, TEST_MSG_CAP, NULL);
+            seen[buf[0]]++;
+            CHECK(size > 0 && size <= tagun->max_size, "%s packed to %u bytes", tagun->name, size);
+
+            FormpackErr err = tagun->unpack(buf, size, &scratch, &out);
+            CHECK(err == FormpackErr_None, "%s kind %d didn't unpack: %s",
+                  tagun->name, buf[0], formpack_err_str(err));
+            CHECK(err != FormpackErr_None || tagun->eq(&msg, &out),
+                  "%s kind %d unpacked to something else", tagun->name, buf[0]);
+
+            /* it's all or nothing, a message with a byte more or less is turned away */
+            buf[size] = 0;
+            err = tagun->unpack(buf, size + 1, &scratch, &out);
+            CHECK(err == FormpackErr_TrailingBytes, "%s with a byte extra: %s",
+                  tagun->name, formpack_err_str(err));
+
+            /* packing onto the heap gives the same bytes */
+            Pack pack = tagun->pack(&msg);
+            CHECK(pack.size == size && memcmp(pack.data, buf, size) == 0,
+                  "%s kind %d packed differently onto the heap", tagun->name, buf[0]);
+            free(pack.data);
+
+            /* a buffer that's too small is left for the caller to deal with */
+            if (size > 1) {
+                uint32_t small = tagun->pack_into(&msg, buf, size - 1, NULL);
+                CHECK(small == 0, "%s packed %u bytes into %u", tagun->name, small, size - 1);
+            }
+        }
+        for (int k = 0; k < tagun->kind_count; k++)
+            CHECK(seen[k] > 0, "%s kind %d was never packed", tagun->name, k);
+    }
+    free(buf);
+    scratch_reset(&made), free(made.block);
+    scratch_reset(&scratch), free(scratch.block);
+}
+
+#define TEST_FUZZ_MSGS 10000
+
+void test_formpack_fuzz(void) {
+    Scratch made = { 0 }, scratch = { 0 };
+    test_Guard guard;
+    test_guard_init(&guard, TEST_MSG_CAP);
+    uint8_t *buf = malloc(TEST_MSG_CAP);
+    for (int t = 0; t < LEN(test_taguns); t++) {
+        test_Tagun *tagun = &test_taguns[t];
+        for (int i = 0; i < TEST_FUZZ_MSGS; i++) {
+            scratch_reset(&made);
+            test_AnyMsg msg = tagun->random(&made), out;
+            uint32_t size = tagun->pack_into(&msg, buf, TEST_MSG_CAP, NULL);
+
+            /* messages say how long they are, so every prefix is missing something */
+            for (uint32_t len = 0; len < size; len++) {
+                scratch_reset(&scratch);
+                uint8_t *at = test_guard_put(&guard, buf, len);
+                FormpackErr err = tagun->unpack(at, len, &scratch, &out);
+                CHECK(err == FormpackErr_Truncated, "%s kind %d cut to %u of %u bytes: %s",
+                      tagun->name, buf[0], len, size, formpack_err_str(err));
+            }
+
+            /* corrupted, it can decode to anything, or nothing, but no further
+               than its end. the kind byte's left alone half the time, to get
+               past it into the fields */
+            for (int j = 0; j < 16; j++) {
+                scratch_reset(&scratch);
+                uint8_t *at = test_guard_put(&guard, buf, size);
+                int flips = 1 + test_rand_below(3);
+                for (int k = 0; k < flips; k++) {
+                    uint32_t pos = (j & 1) && size > 1 ? 1 + test_rand_below(size - 1)
+                                                       : test_rand_below(size);
+                    at[pos] ^= (uint8_t) (1 << test_rand_below(8));
+                }
+                FormpackErr err = tagun->unpack(at, size, &scratch, &out);
+                CHECK(err <= FormpackErr_TrailingBytes, "%s gave an unknown error %d",
+                      tagun->name, err);
+            }
+        }
+
+        /* and bytes that were never a message at all */
+        for (int i = 0; i < TEST_FUZZ_MSGS * 4; i++) {
+            scratch_reset(&scratch);
+            uint32_t len = test_rand_below(64);
+            for (uint32_t j = 0; j < len; j++) buf[j] = (uint8_t) rand_u32();
+            /* mostly kinds that exist, or it'd rarely get any further */
+            if (len && i % 4) buf[0] = (uint8_t) test_rand_below(tagun->kind_count);
+            uint8_t *at = test_guard_put(&guard, buf, len);
+            test_AnyMsg out;
+            FormpackErr err = tagun->unpack(at, len, &scratch, &out);
+            CHECK(err <= FormpackErr_TrailingBytes, "%s gave an unknown error %d",
+                  tagun->name, err);
+        }
+    }
+    free(buf);
+    scratch_reset(&made), free(made.block);
+    scratch_reset(&scratch), free(scratch.block);
+}
+
+/* the Reader's own decoders, called in any order on whatever bytes,
+   never go past the end, and once one fails all of them give back nothing */
+void test_reader_fuzz(void) {
+    Scratch scratch = { 0 };
+    test_Guard guard;
+    test_guard_init(&guard, 64);
+    uint8_t bytes[32];
+    for (int i = 0; i < TEST_FUZZ_MSGS * 10; i++) {
+        scratch_reset(&scratch);
+        uint32_t len = test_rand_below(sizeof(bytes) + 1);
+        for (uint32_t j = 0; j < len; j++) {
+            /* lengths and varints are more interesting when they're small or long */
+            u32 pick = test_rand_below(4);
+            bytes[j] = pick == 0 ? (uint8_t) test_rand_below(4) : pick == 1 ? 0x80 | (uint8_t) rand_u32()
+                                                                           : (uint8_t) rand_u32();
+        }
+        uint8_t *at = test_guard_put(&guard, bytes, len);
+        Reader r = { .at = at, .end = at + len, .scratch = &scratch };
+        for (int step = 0; step < 16; step++) {
+            FormpackErr was = r.err;
+            u64 got = 0;
+            switch (test_rand_below(9)) {
+            case (0): got = reader_byte(&r); break;
+            case (1): got = decode_string(&r).len; break;
+            case (2): got = decode_uint16_t(&r); break;
+            case (3): got = decode_bool(&r); break;
+            case (4): got = (u64) decode_f32(&r); break;
+            case (5): got = decode_u32(&r); break;
+            case (6): got = decode_u64(&r); break;
+            case (7): got = (u64) decode_i32(&r); break;
+            default: got = decode_array_len(&r, 1 + test_rand_below(8)); break;
+            }
+            CHECK(r.at >= at && r.at <= r.end, "the reader went %td bytes past its end",
+                  r.at - r.end);
+            CHECK(was == FormpackErr_None || (got == 0 && r.err == was),
+                  "a failed reader read %llu, error %s", (unsigned long long) got,
+                  formpack_err_str(r.err));
+            CHECK(r.err == FormpackErr_None || r.at == r.end, "a failed reader isn't at its end");
+        }
+    }
+    scratch_reset(&scratch), free(scratch.block);
+}
+
+/* seals a frame as frame_send would, then reads it back as the other end
+   would, checking it holds `count` messages, and that they're `sent` */
+void _test_receive(test_Tagun *tagun, uint8_t *frame, size_t len, test_AnyMsg *sent, int count,
+                   Intern *received, Scratch *scratch) {
+    uint8_t *sealed = frame_seal(frame, &len);
+    scratch_reset(scratch);
+    Reader r = frame_reader(sealed, len, scratch, received);
+    test_AnyMsg out;
+    int got = 0;
+    for (; tagun->unpack_next(&r, &out); got++) {
+        CHECK(got < count && tagun->eq(&sent[got], &out), "%s message %d of %d in a frame of %zu "
+              "bytes unpacked to something else", tagun->name, got, count, len);
+        if (got >= count) break;
+    }
+    CHECK(got == count && r.err == FormpackErr_None, "%s frame of %zu bytes gave %d of %d messages: %s",
+          tagun->name, len, got, count, formpack_err_str(r.err));
+    if (sealed != frame) free(sealed);
+}
+
+/* a connection's worth of ticks: what's batched up comes out the other end,
+   in order, each istring the same as it went in, interned or not */
+#define TEST_BATCH_TICKS 400
+#define TEST_BATCH_MAX 64
+
+void test_batch_round_trip(void) {
+    Scratch made = { 0 }, scratch = { 0 };
+    uint8_t *alone = malloc(1 + TEST_MSG_CAP);
+    test_AnyMsg pending[TEST_BATCH_MAX];
+    for (int t = 0; t < LEN(test_taguns); t++) {
+        test_Tagun *tagun = &test_taguns[t];
+        Intern sent = { 0 }, received = { 0 };
+        Batch b = { .intern = &sent };
+        int frames = 0;
+        for (int tick = 0; tick < TEST_BATCH_TICKS; tick++) {
+            scratch_reset(&made);
+            int count = test_rand_below(TEST_BATCH_MAX), batched = 0;
+            for (int i = 0; i < count; i++) {
+                test_AnyMsg msg = tagun->random(&made);
+                if (tagun->batch(&b, &msg)) {
+                    pending[batched++] = msg;
+                    continue;
+                }
+                /* as batch_send_ has it, the batch goes when it's full,
+                   and what doesn't fit in an empty one goes on its own */
+                if (b.len) _test_receive(tagun, b.data, b.len, pending, batched, &received, &scratch);
+                b.len = 0, batched = 0, frames++;
+                if (tagun->batch(&b, &msg)) {
+                    pending[batched++] = msg;
+                    continue;
+                }
+                uint32_t size = tagun->pack_into(&msg, alone + 1, TEST_MSG_CAP, NULL);
+                _test_receive(tagun, alone, size, &msg, 1, &received, &scratch);
+                frames++;
+            }
+            if (b.len) _test_receive(tagun, b.data, b.len, pending, batched, &received, &scratch);
+            b.len = 0, frames += batched > 0;
+        }
+        CHECK(frames > TEST_BATCH_TICKS / 2, "%s only sent %d frames", tagun->name, frames);
+        free(b.data);
+    }
+    free(alone);
+    scratch_reset(&made), free(made.block);
+    scratch_reset(&scratch), free(scratch.block);
+}
+
+/* messages to time, made up front */
+#define TEST_BENCH_MSGS 1024
+
+void bench_formpack(void) {
+    Scratch made = { 0 }, scratch = { 0 };
+    size_t cap = (size_t) TEST_BENCH_MSGS * TEST_MSG_CAP / 16;
+    uint8_t *buf = malloc(cap);
+    uint32_t *sizes = malloc(TEST_BENCH_MSGS * sizeof(uint32_t));
+    test_AnyMsg *msgs = malloc(TEST_BENCH_MSGS * sizeof(test_AnyMsg));
+    for (int t = 0; t < LEN(test_taguns); t++) {
+        test_Tagun *tagun = &test_taguns[t];
+        scratch_reset(&made);
+        for (int i = 0; i < TEST_BENCH_MSGS; i++) msgs[i] = tagun->random(&made);
+
+        size_t bytes = 0;
+        double start = test_seconds(), secs;
+        uint64_t packed = 0;
+        do {
+            bytes = 0;
+            for (int i = 0; i < TEST_BENCH_MSGS; i++) {
+                sizes[i] = tagun->pack_into(&msgs[i], buf + bytes, cap - bytes, NULL);
+                if (sizes[i] == 0) abort();
+                bytes += sizes[i];
+            }
+            packed += TEST_BENCH_MSGS;
+        } while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+        printf("  %-12s pack    %10.0f msgs/s %8.1f MB/s (%.1f bytes a message)\n",
+               tagun->name, packed / secs, packed * ((double) bytes / TEST_BENCH_MSGS) / secs / 1e6,
+               (double) bytes / TEST_BENCH_MSGS);
+
+        start = test_seconds();
+        uint64_t unpacked = 0;
+        do {
+            uint8_t *at = buf;
+            for (int i = 0; i < TEST_BENCH_MSGS; i++) {
+                test_AnyMsg out;
+                scratch_reset(&scratch);
+                if (tagun->unpack(at, sizes[i], &scratch, &out) != FormpackErr_None) abort();
+                at += sizes[i];
+            }
+            unpacked += TEST_BENCH_MSGS;
+        } while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+        printf("  %-12s unpack  %10.0f msgs/s %8.1f MB/s\n",
+               tagun->name, unpacked / secs, unpacked * ((double) bytes / TEST_BENCH_MSGS) / secs / 1e6);
+    }
+    free(buf), free(sizes), free(msgs);
+    scratch_reset(&made), free(made.block);
+    scratch_reset(&scratch), free(scratch.block);
+}
+
+/* packing into memory that's reused, as the send_ macros and batches do,
+   against a malloc and free for every message, as they used to */
+void bench_formpack_alloc(void) {
+    Scratch made = { 0 };
+    test_AnyMsg *msgs = malloc(TEST_BENCH_MSGS * sizeof(test_AnyMsg));
+    uint8_t *buf = malloc(TEST_MSG_CAP);
+    for (int t = 0; t < LEN(test_taguns); t++) {
+        test_Tagun *tagun = &test_taguns[t];
+        scratch_reset(&made);
+        for (int i = 0; i < TEST_BENCH_MSGS; i++) msgs[i] = tagun->random(&made);
+
+        for (int heap = 0; heap < 2; heap++) {
+            uint64_t packed = 0, sum = 0;
+            double start = test_seconds(), secs;
+            do {
+                for (int i = 0; i < TEST_BENCH_MSGS; i++) {
+                    if (heap) {
+                        Pack pack = tagun->pack(&msgs[i]);
+                        sum += pack.data[0];
+                        free(pack.data);
+                    } else
+                        sum += tagun->pack_into(&msgs[i], buf, TEST_MSG_CAP, NULL) + buf[0];
+                }
+                packed += TEST_BENCH_MSGS;
+            } while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+            test_sink += (double) sum;
+            printf("  %-12s %-16s %10.0f msgs/s\n", tagun->name,
+                   heap ? "pack (malloc)" : "pack_into", packed / secs);
+        }
+    }
+    free(msgs), free(buf);
+    scratch_reset(&made), free(made.block);
+}
+
+/* what decoding was before it checked anything: lengths taken at their word */
+String _test_unchecked_string(uint8_t **at) {
+    uint8_t len = *(*at)++;
+    String s = { .len = len, .str = (char *) *at };
+    *at += len;
+    return s;
+}
+FormpackErr _test_unchecked_unpack_net_to_server(uint8_t *data, size_t size, Scratch *scratch,
+                                                 NetToServer *out) {
+    (void) size, (void) scratch;
+    uint8_t *at = data + 1;
+    NetToServer d = { .kind = (NetToServerKind) data[0] };
+    switch (d.kind) {
+    case (NetToServerKind_AccountExists):
+        d.account_exists.user = _test_unchecked_string(&at);
+        break;
+    case (NetToServerKind_AccountTrial):
+        d.account_trial.user = _test_unchecked_string(&at);
+        break;
+    case (NetToServerKind_AccountRegister):
+        d.account_register.user = _test_unchecked_string(&at);
+        d.account_register.pass = _test_unchecked_string(&at);
+        break;
+    case (NetToServerKind_AccountLogin):
+        d.account_login.user = _test_unchecked_string(&at);
+        d.account_login.pass = _test_unchecked_string(&at);
+        break;
+    default: abort();
+    }
+    *out = d;
+    return FormpackErr_None;
+}
+
+/* what checking lengths as it goes costs unpack_net_to_server,
+   against decoding the same messages unchecked */
+void bench_formpack_checks(void) {
+    Scratch made = { 0 }, scratch = { 0 };
+    uint8_t *buf = malloc((size_t) TEST_BENCH_MSGS * NET_TO_SERVER_MAX_ENCODED_SIZE);
+    uint32_t *sizes = malloc(TEST_BENCH_MSGS * sizeof(uint32_t));
+    size_t bytes = 0;
+    for (int i = 0; i < TEST_BENCH_MSGS; i++) {
+        NetToServer msg = random_net_to_server(&made);
+        sizes[i] = pack_net_to_server_into(&msg, buf + bytes, NET_TO_SERVER_MAX_ENCODED_SIZE, NULL);
+        bytes += sizes[i];
+    }
+
+    /* the two take turns and each keeps its best, as the difference is
+       small enough for whatever else the machine's doing to swamp it */
+    double rates[2] = { 0 };
+    for (int round = 0; round < 6; round++) {
+        int checked = round & 1;
+        /* both called the same way, as the server would */
+        FormpackErr (*unpack)(uint8_t *, size_t, Scratch *, NetToServer *) =
+            checked ? unpack_net_to_server : _test_unchecked_unpack_net_to_server;
+        uint64_t unpacked = 0, sum = 0;
+        double start = test_seconds(), secs;
+        do {
+            uint8_t *at = buf;
+            for (int i = 0; i < TEST_BENCH_MSGS; i++) {
+                NetToServer out;
+                if (unpack(at, sizes[i], &scratch, &out) != FormpackErr_None) abort();
+                /* the last field's length, so neither can skip decoding it */
+                sum += out.kind >= NetToServerKind_AccountRegister ? out.account_login.pass.len
+                                                                   : out.account_exists.user.len;
+                at += sizes[i];
+            }
+            unpacked += TEST_BENCH_MSGS;
+        } while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS / 2);
+        test_sink += (double) sum;
+        rates[checked] = fmax(rates[checked], unpacked / secs);
+    }
+    for (int checked = 0; checked < 2; checked++)
+        printf("  NetToServer  %-10s %10.0f msgs/s %8.1f MB/s\n", checked ? "checked" : "unchecked",
+               rates[checked], rates[checked] * ((double) bytes / TEST_BENCH_MSGS) / 1e6);
+    printf("  checking costs %.1f%%\n", (rates[0] / rates[1] - 1.0) * 100.0);
+    free(buf), free(sizes);
+    scratch_reset(&made), free(made.block);
+    scratch_reset(&scratch), free(scratch.block);
+}
+
+/* a websocket frame's header, at its smallest, for `len` bytes of payload */
+INLINE size_t _test_ws_header(size_t len) {
+    return 2 + (len >= 126 ? 2 : 0) + (len >= 65536 ? 6 : 0);
+}
+
+/* a tick's worth of updates for one client, sent as a frame each
+   against batched, sealed and read back as the client would */
+#define TEST_BENCH_TICK 50
+
+void bench_batch(void) {
+    Scratch made = { 0 }, scratch = { 0 };
+    NetToClient msgs[TEST_BENCH_TICK];
+    for (int i = 0; i < TEST_BENCH_TICK; i++) msgs[i] = random_net_to_client(&made);
+    uint8_t one[1 + NET_TO_CLIENT_MAX_ENCODED_SIZE];
+
+    for (int batched = 0; batched < 2; batched++) {
+        uint64_t sent = 0, frames = 0, bytes = 0;
+        Intern out_strs = { 0 }, in_strs = { 0 };
+        Batch b = { .intern = &out_strs };
+        double start = test_seconds(), secs;
+        do {
+            for (int i = 0; i < TEST_BENCH_TICK; i++) {
+                uint8_t *frame = one;
+                size_t len;
+                if (batched) {
+                    if (batch_net_to_client(&b, &msgs[i]) && i < TEST_BENCH_TICK - 1) continue;
+                    frame = b.data, len = b.len, b.len = 0;
+                } else
+                    len = pack_net_to_client_into(&msgs[i], one + 1, sizeof(one) - 1, NULL);
+                uint8_t *sealed = frame_seal(frame, &len);
+                scratch_reset(&scratch);
+                Reader r = frame_reader(sealed, len, &scratch, &in_strs);
+                NetToClient got;
+                while (unpack_next_net_to_client(&r, &got)) sent++;
+                if (r.err != FormpackErr_None) abort();
+                if (sealed != frame) free(sealed);
+                frames++;
+                bytes += _test_ws_header(len) + len;
+            }
+        } while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+        printf("  %-9s %10.0f msgs/s %9.0f frames/s %8.1f MB/s (%.1f bytes a message, headers and all)\n",
+               batched ? "batched" : "unbatched", sent / secs, frames / secs, bytes / secs / 1e6,
+               (double) bytes / sent);
+        free(b.data);
+    }
+    scratch_reset(&made), free(made.block);
+    scratch_reset(&scratch), free(scratch.block);
+}
+
+/* TestMsg_Fixed as formpack packed it before working out fixed sizes:
+   the size added up field by field, and a call for each field's bytes */
+size_t _test_generic_size_test_msg_fixed(TestMsg_Fixed *v) {
+    size_t size = 0;
+    size += 3 + 3; /* pos.at's qfloats */
+    size += encoded_size_f32(&v->pos.facing);
+    size += encoded_size_bool(&v->pos.moving);
+    size += encoded_size_uint16_t(&v->hp);
+    size += encoded_size_bool(&v->alive);
+    return size;
+}
+uint8_t *_test_generic_encode_test_msg_fixed(uint8_t *data, TestMsg_Fixed *v, Intern *intern) {
+    (void) intern;
+    data = encode_qfloat(data, v->pos.at.x, -512, 0.01, 102400u, 3);
+    data = encode_qfloat(data, v->pos.at.y, -512, 0.01, 102400u, 3);
+    data = encode_f32(data, &v->pos.facing);
+    data = encode_bool(data, &v->pos.moving);
+    data = encode_uint16_t(data, &v->hp);
+    data = encode_bool(data, &v->alive);
+    return data;
+}
+TestMsg_Fixed _test_generic_decode_test_msg_fixed(Reader *r) {
+    TestMsg_Fixed v = { 0 };
+    v.pos.at.x = decode_qfloat(r, -512, 0.01, 102400u, 3);
+    v.pos.at.y = decode_qfloat(r, -512, 0.01, 102400u, 3);
+    v.pos.facing = decode_f32(r);
+    v.pos.moving = decode_bool(r);
+    v.hp = decode_uint16_t(r);
+    v.alive = decode_bool(r);
+    return v;
+}
+
+/* the straight line code formpack makes for fixed size variants, against
+   the field by field calls it made before. both are called the same way,
+   through pointers, so neither gets inlined into the loop and the other not */
+typedef struct {
+    const char *name;
+    size_t (*size)(TestMsg_Fixed *v);
+    uint8_t *(*encode)(uint8_t *data, TestMsg_Fixed *v, Intern *intern);
+    TestMsg_Fixed (*decode)(Reader *r);
+} _test_FixedCodec;
+
+void bench_formpack_fixed(void) {
+    _test_FixedCodec codecs[] = {
+        { "fixed", encoded_size_test_msg_fixed, encode_test_msg_fixed, decode_test_msg_fixed },
+        { "generic", _test_generic_size_test_msg_fixed, _test_generic_encode_test_msg_fixed,
+          _test_generic_decode_test_msg_fixed },
+    };
+    const size_t size = TEST_MSG_FIXED_ENCODED_SIZE;
+    TestMsg_Fixed msgs[TEST_BENCH_MSGS];
+    uint8_t *packed = malloc(TEST_BENCH_MSGS * size);
+    for (int i = 0; i < TEST_BENCH_MSGS; i++) {
+        msgs[i] = random_test_msg_fixed(NULL);
+        uint8_t *at = packed + i * size, generic[TEST_MSG_FIXED_ENCODED_SIZE];
+        encode_test_msg_fixed(at, &msgs[i], NULL);
+        _test_generic_encode_test_msg_fixed(generic, &msgs[i], NULL);
+        CHECK(memcmp(generic, at, size) == 0, "TestMsg_Fixed encodes differently field by field");
+    }
+
+    /* they take turns, each keeping its best, as they're close enough
+       for whatever else the machine's doing to swamp the difference */
+    double rates[2][2] = { 0 };
+    for (int round = 0; round < 3; round++) {
+        for (int c = 0; c < LEN(codecs); c++) {
+            _test_FixedCodec *codec = &codecs[c];
+            for (int decoding = 0; decoding < 2; decoding++) {
+                uint64_t done = 0, sum = 0;
+                double start = test_seconds(), secs;
+                do {
+                    for (int i = 0; i < TEST_BENCH_MSGS; i++) {
+                        uint8_t *at = packed + i * size;
+                        if (decoding) {
+                            Reader r = { .at = at, .end = at + size };
+                            sum += codec->decode(&r).hp + r.err;
+                        } else {
+                            if (codec->size(&msgs[i]) > size) abort();
+                            sum += codec->encode(at, &msgs[i], NULL) - at;
+                        }
+                    }
+                    done += TEST_BENCH_MSGS;
+                } while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS / 3);
+                test_sink += (double) sum;
+                rates[c][decoding] = fmax(rates[c][decoding], done / secs);
+            }
+        }
+    }
+    for (int c = 0; c < LEN(codecs); c++)
+        for (int decoding = 0; decoding < 2; decoding++)
+            printf("  TestMsg_Fixed %-8s %-6s %10.0f msgs/s\n", codecs[c].name,
+                   decoding ? "decode" : "encode", rates[c][decoding]);
+    free(packed);
+}
@@ -0,0 +1,179 @@
+/* round trips lz_compress and lz_decompress on the sorts of things frames
+   carry, feeds lz_decompress and frame_reader truncated and corrupted data,
+   and times both directions along with the ratio they get */
+
+typedef enum {
+    TestPayload_Zeros,
+    TestPayload_Text, /* chat and names: the same words again and again */
+    TestPayload_Tiles, /* a map's tiles: runs of a few kinds */
+    TestPayload_Messages, /* a batch of NetToClient messages */
+    TestPayload_Random, /* nothing to find, it ought to give up quickly */
+    TestPayload_COUNT,
+} TestPayload;
+static const char *test_payload_names[] = { "zeros", "text", "tiles", "messages", "random" };
+
+void test_payload(TestPayload kind, uint8_t *out, size_t len) {
+    static const char *words[] = { "the ", "dragon ", "slayer ", "has ", "logged ",
+                                   "in ", "out ", "bob ", "sword ", "of ", "fire ", "\n" };
+    Scratch made = { 0 };
+    size_t at = 0;
+    while (at < len) {
+        size_t n = 0;
+        switch (kind) {
+        case (TestPayload_Zeros):
+            out[at] = 0, n = 1;
+            break;
+        case (TestPayload_Text): {
+            const char *w = words[test_rand_below(LEN(words))];
+            n = min((int) strlen(w), (int) (len - at));
+            memcpy(out + at, w, n);
+        } break;
+        case (TestPayload_Tiles):
+            n = min(1 + test_rand_below(24), (int) (len - at));
+            memset(out + at, (int) test_rand_below(6), n);
+            break;
+        case (TestPayload_Messages): {
+            uint8_t buf[NET_TO_CLIENT_MAX_ENCODED_SIZE];
+            scratch_reset(&made);
+            NetToClient msg = random_net_to_client(&made);
+            n = min(pack_net_to_client_into(&msg, buf, sizeof(buf), NULL), (int) (len - at));
+            memcpy(out + at, buf, n);
+        } break;
+        default:
+            out[at] = (uint8_t) rand_u32(), n = 1;
+        }
+        at += n;
+    }
+    scratch_reset(&made), free(made.block);
+}
+
+/* from nothing up past the two byte offsets' reach, with the sizes around
+   where the token's lengths spill into extra bytes, and the last literals */
+static size_t test_lz_sizes[] = { 0, 1, 3, 4, 5, 8, 12, 13, 16, 17, 18, 19, 20, 33, 100, 270, 271,
+                                  1024, 4096, 65535, 65536, 70000, 300000 };
+#define TEST_LZ_MAX (300000)
+
+void test_lz_round_trip(void) {
+    uint8_t *raw = malloc(TEST_LZ_MAX);
+    uint8_t *packed = malloc(lz_bound(TEST_LZ_MAX));
+    test_Guard guard;
+    test_guard_init(&guard, TEST_LZ_MAX);
+    for (TestPayload kind = 0; kind < TestPayload_COUNT; kind++) {
+        for (int s = 0; s < LEN(test_lz_sizes); s++) {
+            size_t len = test_lz_sizes[s];
+            test_payload(kind, raw, len);
+            size_t size = lz_compress(raw, len, packed);
+            CHECK(size <= lz_bound(len), "%s of %zu compressed to %zu, over its bound of %zu",
+                  test_payload_names[kind], len, size, lz_bound(len));
+
+            /* decompressed right up against the guard page, so writing
+               even a byte too many crashes */
+            uint8_t *out = guard.end - len;
+            bool ok = lz_decompress(packed, size, out, len);
+            CHECK(ok && memcmp(out, raw, len) == 0, "%s of %zu didn't decompress to itself",
+                  test_payload_names[kind], len);
+            if (len > 0)
+                CHECK(!lz_decompress(packed, size, out + 1, len - 1),
+                      "%s of %zu decompressed into a byte less", test_payload_names[kind], len);
+            CHECK(!lz_decompress(packed, size, out - 1, len + 1),
+                  "%s of %zu decompressed into a byte more", test_payload_names[kind], len);
+        }
+    }
+    free(raw), free(packed);
+}
+
+#define TEST_LZ_FUZZ_LEN 3000
+#define TEST_LZ_FUZZ_ROUNDS 10000
+
+void test_lz_fuzz(void) {
+    uint8_t *raw = malloc(TEST_LZ_FUZZ_LEN);
+    uint8_t *packed = malloc(lz_bound(TEST_LZ_FUZZ_LEN));
+    test_Guard in_guard, out_guard;
+    test_guard_init(&in_guard, lz_bound(TEST_LZ_FUZZ_LEN));
+    test_guard_init(&out_guard, TEST_LZ_FUZZ_LEN);
+    for (int round = 0; round < TEST_LZ_FUZZ_ROUNDS; round++) {
+        TestPayload kind = test_rand_below(TestPayload_COUNT);
+        size_t len = 1 + test_rand_below(TEST_LZ_FUZZ_LEN);
+        test_payload(kind, raw, len);
+        size_t size = lz_compress(raw, len, packed);
+        uint8_t *out = out_guard.end - len;
+
+        /* anything cut short is missing something */
+        for (int j = 0; j < 8; j++) {
+            size_t cut = test_rand_below((u32) size);
+            uint8_t *at = test_guard_put(&in_guard, packed, cut);
+            CHECK(!lz_decompress(at, cut, out, len), "%s of %zu cut to %zu of %zu bytes decompressed",
+                  test_payload_names[kind], len, cut, size);
+        }
+
+        /* corrupted, it's whatever it decompresses to, if anything,
+           as long as it stays within what it's given either side */
+        for (int j = 0; j < 8; j++) {
+            uint8_t *at = test_guard_put(&in_guard, packed, size);
+            int flips = 1 + test_rand_below(3);
+            for (int k = 0; k < flips; k++)
+                at[test_rand_below((u32) size)] ^= (uint8_t) (1 << test_rand_below(8));
+            test_sink += lz_decompress(at, size, out, len);
+        }
+    }
+
+    /* and whole frames the same way: whatever frame_reader makes of them,
+       the messages it reads stay within it */
+    Scratch scratch = { 0 };
+    Intern received = { 0 };
+    for (int round = 0; round < TEST_LZ_FUZZ_ROUNDS; round++) {
+        size_t len = 1 + FRAME_COMPRESS_MIN;
+        len += test_rand_below(TEST_LZ_FUZZ_LEN - len);
+        test_payload(round % 2 ? TestPayload_Messages : TestPayload_Text, raw + 1, len - 1);
+        size_t sealed_len = len - 1;
+        uint8_t *sealed = frame_seal(raw, &sealed_len);
+        for (int j = 0; j < 8; j++) {
+            size_t cut = j < 4 ? test_rand_below((u32) sealed_len) : sealed_len;
+            uint8_t *at = test_guard_put(&in_guard, sealed, cut);
+            if (j >= 4) at[test_rand_below((u32) cut)] ^= (uint8_t) (1 << test_rand_below(8));
+            scratch_reset(&scratch);
+            Reader r = frame_reader(at, cut, &scratch, &received);
+            CHECK(j >= 4 || sealed == raw || r.err != FormpackErr_None,
+                  "a compressed frame cut to %zu of %zu bytes was read", cut, sealed_len);
+            NetToClient msg;
+            while (unpack_next_net_to_client(&r, &msg)) {}
+            CHECK(r.at <= r.end, "a frame was read past its end");
+        }
+        if (sealed != raw) free(sealed);
+    }
+    scratch_reset(&scratch), free(scratch.block);
+    free(raw), free(packed);
+}
+
+#define TEST_LZ_BENCH_LEN (256 << 10)
+
+void bench_lz(void) {
+    uint8_t *raw = malloc(TEST_LZ_BENCH_LEN);
+    uint8_t *packed = malloc(lz_bound(TEST_LZ_BENCH_LEN));
+    uint8_t *out = malloc(TEST_LZ_BENCH_LEN);
+    /* as big as a frame gets batched, and as big as a map or snapshot is */
+    size_t lens[] = { BATCH_CAP, TEST_LZ_BENCH_LEN };
+    for (int l = 0; l < LEN(lens); l++) {
+        size_t len = lens[l];
+        for (TestPayload kind = 0; kind < TestPayload_COUNT; kind++) {
+            test_payload(kind, raw, len);
+            size_t size = 0;
+            uint64_t compressed = 0, decompressed = 0;
+            double start = test_seconds(), compress_secs, decompress_secs;
+            do {
+                size = lz_compress(raw, len, packed);
+                compressed += len;
+            } while ((compress_secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+            start = test_seconds();
+            do {
+                if (!lz_decompress(packed, size, out, len)) abort();
+                decompressed += len;
+            } while ((decompress_secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+            test_sink += out[len - 1];
+            printf("  %6zuKB %-9s %6.1f%% of the size  compress %7.1f MB/s  decompress %7.1f MB/s\n",
+                   len >> 10, test_payload_names[kind], 100.0 * size / len,
+                   compressed / compress_secs / 1e6, decompressed / decompress_secs / 1e6);
+        }
+    }
+    free(raw), free(packed), free(out);
+}
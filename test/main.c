@@ -0,0 +1,113 @@
+/* checks and benchmarks for the code the client and server share, run headless.
+   with no arguments every check is run, which is what ctest does.
+   `bench` runs the benchmarks instead, `all` runs both, and anything else
+   runs whichever checks and benchmarks have names starting with it. */
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "../common/common.h"
+#include "random.h"
+#include "../formpack/build/formpack_random.h"
+#include "../formpack/build/formpack_test.h"
+#include "../formpack/build/formpack_test_random.h"
+#include "../server/evloop.h"
+#define MAX_USER_LEN (20) /* as the server has it */
+#include "../server/accounts.h"
+#include "../server/scrypt.h"
+
+#include "test.h"
+#include "formpack.h"
+#include "lz.h"
+#include "noise.h"
+#include "mapgen.h"
+#include "tiles.h"
+#include "evloop.h"
+#include "accounts.h"
+#include "scrypt.h"
+
+typedef struct {
+    const char *name;
+    void (*fn)(void);
+    bool bench;
+} test_Case;
+static test_Case test_cases[] = {
+    { "formpack_round_trip", test_formpack_round_trip },
+    { "formpack_fuzz", test_formpack_fuzz },
+    { "reader_fuzz", test_reader_fuzz },
+    { "batch_round_trip", test_batch_round_trip },
+    { "lz_round_trip", test_lz_round_trip },
+    { "lz_fuzz", test_lz_fuzz },
+    { "simplex_lanes", test_simplex_lanes },
+    { "blur_golden", test_blur_golden },
+    { "ground_threads", test_ground_threads },
+    { "field_reseed", test_field_reseed },
+    { "tiles_seams", test_tiles_seams },
+    { "tiles_lru", test_tiles_lru },
+    { "evloop_echo", test_evloop_echo },
+    { "evloop_fd_limit", test_evloop_fd_limit },
+    { "accounts_store", test_accounts_store },
+    { "accounts_index_remove", test_accounts_index_remove },
+    { "accounts_torn_tail", test_accounts_torn_tail },
+    { "accounts_compact", test_accounts_compact },
+    { "accounts_import", test_accounts_import },
+    { "scrypt_vectors", test_scrypt_vectors },
+    { "hash_queue_limit", test_hash_queue_limit },
+    { "formpack_bench", bench_formpack, .bench = true },
+    { "formpack_alloc_bench", bench_formpack_alloc, .bench = true },
+    { "formpack_checks_bench", bench_formpack_checks, .bench = true },
+    { "formpack_fixed_bench", bench_formpack_fixed, .bench = true },
+    { "batch_bench", bench_batch, .bench = true },
+    { "lz_bench", bench_lz, .bench = true },
+    { "simplex_bench", bench_simplex, .bench = true },
+    { "blur_bench", bench_blur, .bench = true },
+    { "ground_bench", bench_ground, .bench = true },
+    { "evloop_echo_bench", bench_evloop, .bench = true },
+    { "accounts_bench", bench_accounts, .bench = true },
+    { "scrypt_bench", bench_scrypt, .bench = true },
+};
+
+int main(int argument_count, char **arguments) {
+    int failed = 0, ran = 0;
+    for (int i = 0; i < LEN(test_cases); i++) {
+        test_Case *c = &test_cases[i];
+        bool run = argument_count == 1 && !c->bench;
+        for (int a = 1; a < argument_count; a++) {
+            char *arg = arguments[a];
+            if (strcmp(arg, "all") == 0 || (strcmp(arg, "bench") == 0 && c->bench) ||
+                strncmp(c->name, arg, strlen(arg)) == 0)
+                run = true;
+        }
+        if (!run) continue;
+
+        /* the same numbers every run, so a failure can be gone back to */
+        srandf(0x9e3779b9, 0x7f4a7c15, 0xf39cc060, 0x5ced1c4b + i);
+        printf("%s\n", c->name);
+        fflush(stdout);
+        test_failures = 0;
+        c->fn();
+        ran++;
+        if (test_failures) {
+            printf("  FAILED, %d check%s\n", test_failures, test_failures == 1 ? "" : "s");
+            failed++;
+        }
+    }
+
+    if (ran == 0) {
+        printf("nothing by that name, there's:\n");
+        for (int i = 0; i < LEN(test_cases); i++) printf("  %s\n", test_cases[i].name);
+        return 1;
+    }
+    printf("%d of %d passed\n", ran - failed, ran);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,209 @@
+/* mapgen's blur against the straightforward (2k+1)^2 one it replaced, and the
+   ground texture coming out the same however many threads generate it,
+   with how long each takes */
+
+/* the ground texture's size */
+#define TEST_GROUND_SIZE 640
+
+/* the blur as it was, reading every pixel around each one. it used to blur
+   in place, so pixels picked up their already blurred neighbours, here it
+   reads from a copy of the image as it was, as the running sums do */
+void test_naive_blur(uint8_t *img, int img_size, int k) {
+    #define P_IND(x, y) ((y * img_size + x) * 4)
+    uint8_t *src = malloc(img_size * img_size * 4);
+    memcpy(src, img, img_size * img_size * 4);
+    int max = img_size-1;
+    int neighbor_count = pow(k * 2 + 1, 2);
+    for (int x = 0; x < img_size; x++)
+    for (int y = 0; y < img_size; y++) {
+        int rgb[3] = {0};
+        for (int ox = -k; ox <= k; ox++)
+        for (int oy = -k; oy <= k; oy++) {
+            int i = P_IND(clamp(0, x + ox, max),
+                          clamp(0, y + oy, max));
+            rgb[0] += src[i + 0];
+            rgb[1] += src[i + 1];
+            rgb[2] += src[i + 2];
+        }
+        int i = (y * img_size + x) * 4;
+        img[i + 0] = rgb[0] / neighbor_count;
+        img[i + 1] = rgb[1] / neighbor_count;
+        img[i + 2] = rgb[2] / neighbor_count;
+    }
+    free(src);
+    #undef P_IND
+}
+
+/* noise, with the odd flat patch and hard edge blurs can get wrong */
+void test_blur_image(uint8_t *img, int img_size) {
+    for (int i = 0; i < img_size * img_size * 4; i++) img[i] = (uint8_t) rand_u32();
+    int patch = img_size / 3;
+    for (int y = 0; y < patch; y++)
+        for (int x = 0; x < patch; x++)
+            memset(img + (y * img_size + x) * 4, 255, 3);
+}
+
+void test_blur_golden(void) {
+    /* k=1 is the minimap's blur, k=3 the ground's, the rest for good measure.
+       images smaller than the blur, and sizes that don't split into whole bands */
+    int ks[] = { 1, 3, 0, 2, 6 };
+    int sizes[] = { 1, 2, 3, 7, 31, 32, 33, 65, 100, 256 };
+    for (int ki = 0; ki < LEN(ks); ki++)
+    for (int si = 0; si < LEN(sizes); si++)
+    for (int threads = 0; threads <= 3; threads++) {
+        int k = ks[ki], img_size = sizes[si];
+        size_t bytes = img_size * img_size * 4;
+        uint8_t *want = malloc(bytes), *got = malloc(bytes);
+        test_blur_image(want, img_size);
+        memcpy(got, want, bytes);
+
+        test_naive_blur(want, img_size, k);
+        _mapgen_blur(got, img_size, k, test_pool(threads));
+        size_t differ = 0, first = 0;
+        for (size_t i = 0; i < bytes; i++)
+            if (got[i] != want[i] && differ++ == 0) first = i;
+        CHECK(differ == 0, "k=%d on %dpx with %d workers: %zu bytes differ, the first pixel %zu",
+              k, img_size, threads, differ, first / 4);
+        free(want), free(got);
+    }
+}
+
+void bench_blur(void) {
+    size_t bytes = TEST_GROUND_SIZE * TEST_GROUND_SIZE * 4;
+    uint8_t *img = malloc(bytes);
+    test_blur_image(img, TEST_GROUND_SIZE);
+    int ks[] = { 1, 3 };
+    for (int ki = 0; ki < LEN(ks); ki++) {
+        int k = ks[ki], runs = 0;
+        double start = test_seconds(), secs;
+        do test_naive_blur(img, TEST_GROUND_SIZE, k), runs++;
+        while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+        printf("  k=%d %dpx naive                    %8.2f ms\n", k, TEST_GROUND_SIZE, secs / runs * 1e3);
+
+        int counts[] = { 0, 1, 2, 4, thread_core_count() };
+        for (int ci = 0; ci < LEN(counts); ci++) {
+            if (ci == LEN(counts) - 1 && counts[ci] <= 4) break;
+            runs = 0;
+            start = test_seconds();
+            do _mapgen_blur(img, TEST_GROUND_SIZE, k, test_pool(counts[ci])), runs++;
+            while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+            printf("  k=%d %dpx running sums, %2d workers %8.2f ms\n",
+                   k, TEST_GROUND_SIZE, counts[ci], secs / runs * 1e3);
+        }
+    }
+    test_sink += img[0];
+    free(img);
+}
+
+/* the whole map, or a chunk's worth of it on the coast, where there's
+   sand to texture as well as every other biome. simplex needs seeding first */
+#define TEST_GROUNDS 2
+mapgen_GroundOpts test_ground(int which) {
+    if (which == 0) return (mapgen_GroundOpts) { .tile_size = 1.0f };
+
+    mapgen_Field map = { 0 };
+    int res = 64;
+    mapgen_field_cover(&map, vec2f(0.0f), 1.0f, res, NULL);
+    int i = 0;
+    while (i < res * res - 1 && map.biomes[i] != _mapgen_Biome_Sand3) i++;
+    mapgen_field_free(&map);
+    Vec2 sand = vec2((f32) (i % res) / res, (f32) (i / res) / res);
+    return (mapgen_GroundOpts) { .tile_corner = sub2f(sand, 0.02f), .tile_size = 0.04f };
+}
+
+/* the ground comes out the same, heights and all, however many threads help */
+void test_ground_threads(void) {
+    seed_simplex();
+    /* sizes that don't split into whole bands too */
+    int sizes[] = { 1, 7, 33, 100 };
+    for (int gi = 0; gi < TEST_GROUNDS; gi++)
+    for (int si = 0; si < LEN(sizes); si++) {
+        int img_size = sizes[si];
+        size_t pixels = img_size * img_size;
+        uint8_t *want = malloc(pixels * 4), *want_heights = malloc(pixels);
+        uint8_t *got = malloc(pixels * 4), *got_heights = malloc(pixels);
+        mapgen_Field want_field = { 0 };
+
+        mapgen_GroundOpts opts = test_ground(gi);
+        opts.height_map = want_heights, opts.field = &want_field;
+        mapgen_ground_img(want, img_size, &opts);
+        for (int threads = 1; threads <= 3; threads++) {
+            mapgen_Field field = { 0 };
+            opts.height_map = got_heights, opts.field = &field, opts.workers = test_pool(threads);
+            mapgen_ground_img(got, img_size, &opts);
+            CHECK(memcmp(field.fbm, want_field.fbm, pixels * sizeof(float)) == 0,
+                  "ground %d at %dpx: the field differs with %d workers", gi, img_size, threads);
+            CHECK(memcmp(got, want, pixels * 4) == 0,
+                  "ground %d at %dpx: the image differs with %d workers", gi, img_size, threads);
+            CHECK(memcmp(got_heights, want_heights, pixels) == 0,
+                  "ground %d at %dpx: the heights differ with %d workers", gi, img_size, threads);
+
+            /* and again, with the field already worked out */
+            memset(got, 0, pixels * 4);
+            mapgen_ground_img(got, img_size, &opts);
+            CHECK(memcmp(got, want, pixels * 4) == 0,
+                  "ground %d at %dpx: the image differs from a field used again", gi, img_size);
+            mapgen_field_free(&field);
+        }
+        mapgen_field_free(&want_field);
+        free(want), free(want_heights), free(got), free(got_heights);
+    }
+}
+
+/* a field kept from before simplex was seeded again is worked out again,
+   not taken to still cover what it did */
+void test_field_reseed(void) {
+    int res = 32;
+    size_t bytes = res * res * sizeof(float);
+    mapgen_Field kept = { 0 }, fresh = { 0 };
+    seed_simplex();
+    mapgen_field_cover(&kept, vec2f(0.0f), 1.0f, res, NULL);
+    float *before = malloc(bytes);
+    memcpy(before, kept.fbm, bytes);
+    float at_before = mapgen_field_fbm(&kept, vec2(0.5f, 0.5f));
+
+    seed_simplex();
+    CHECK(mapgen_field_fbm(&kept, vec2(0.5f, 0.5f)) == _mapgen_island_weighted_fbm(vec2(0.5f, 0.5f)),
+          "a stale field was looked up in");
+    mapgen_field_cover(&kept, vec2f(0.0f), 1.0f, res, NULL);
+    mapgen_field_cover(&fresh, vec2f(0.0f), 1.0f, res, NULL);
+    CHECK(memcmp(kept.fbm, before, bytes) != 0, "the field wasn't worked out again");
+    CHECK(memcmp(kept.fbm, fresh.fbm, bytes) == 0, "the field differs from a fresh one");
+    CHECK(mapgen_field_fbm(&kept, vec2(0.5f, 0.5f)) != at_before, "the lookup didn't change");
+
+    /* the minimap goes by the field it's given, which it covers again too */
+    uint8_t *want = malloc(res * res * 4), *got = malloc(res * res * 4);
+    seed_simplex();
+    mapgen_minimap_img(got, res, &kept);
+    mapgen_field_free(&fresh);
+    mapgen_minimap_img(want, res, &fresh);
+    CHECK(memcmp(got, want, res * res * 4) == 0, "the minimap came from a stale field");
+    free(want), free(got), free(before);
+    mapgen_field_free(&kept), mapgen_field_free(&fresh);
+}
+
+void bench_ground(void) {
+    seed_simplex();
+    uint8_t *img = malloc(TEST_GROUND_SIZE * TEST_GROUND_SIZE * 4);
+    uint8_t *heights = malloc(TEST_GROUND_SIZE * TEST_GROUND_SIZE);
+    int counts[] = { 0, 1, 2, 4, 8, thread_core_count() };
+    for (int gi = 0; gi < TEST_GROUNDS; gi++) {
+        mapgen_GroundOpts opts = test_ground(gi);
+        double alone = 0;
+        for (int ci = 0; ci < LEN(counts); ci++) {
+            if (ci == LEN(counts) - 1 && counts[ci] <= 8) break;
+            opts.height_map = heights, opts.workers = test_pool(counts[ci]);
+            int runs = 0;
+            double start = test_seconds(), secs;
+            do mapgen_ground_img(img, TEST_GROUND_SIZE, &opts), runs++;
+            while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+            double ms = secs / runs * 1e3;
+            if (ci == 0) alone = ms;
+            printf("  %s %dpx, %2d workers %8.2f ms (%.2fx)\n", gi ? "a chunk " : "the map ",
+                   TEST_GROUND_SIZE, counts[ci], ms, alone / ms);
+        }
+    }
+    printf("  (%d cores here)\n", thread_core_count());
+    test_sink += img[0];
+    free(img), free(heights);
+}
@@ -0,0 +1,91 @@
+/* simplex2_x4, _x8 and simplex2_many have to give exactly what simplex2 does,
+   bit for bit, or the map would come out differently depending on the target.
+   that relies on nothing being fused into FMAs, hence -ffp-contract=off */
+
+/* points of the sorts mapgen asks for and then some: anywhere, on whole
+   and half numbers where the floors are decided, right on the diagonal
+   between a cell's triangles, far out, and near zero */
+Vec2 test_noise_point(void) {
+    f32 a = randf() * 2.0f - 1.0f, b = randf() * 2.0f - 1.0f;
+    switch (test_rand_below(6)) {
+    case (0): return vec2(a * 1000.0f, b * 1000.0f);
+    case (1): return vec2((f32) (i32) (a * 200.0f), (f32) (i32) (b * 200.0f));
+    case (2): return vec2((f32) (i32) (a * 400.0f) * 0.5f, (f32) (i32) (b * 400.0f) * 0.5f);
+    case (3): return vec2(a * 100.0f, a * 100.0f);
+    case (4): return vec2(a * 1e6f, b * 1e6f);
+    default: return vec2(a * 1e-3f, b * 1e-30f);
+    }
+}
+
+#define TEST_NOISE_POINTS 400000
+
+void test_simplex_lanes(void) {
+    seed_simplex();
+    for (int i = 0; i < TEST_NOISE_POINTS; i += 8) {
+        f32 xs[8], ys[8], want[8], x4[8], x8[8];
+        for (int l = 0; l < 8; l++) {
+            Vec2 p = test_noise_point();
+            xs[l] = p.x, ys[l] = p.y;
+            want[l] = simplex2(p);
+        }
+        simplex2_x4(xs, ys, x4);
+        simplex2_x4(xs + 4, ys + 4, x4 + 4);
+        simplex2_x8(xs, ys, x8);
+        for (int l = 0; l < 8; l++) {
+            CHECK(memcmp(&x4[l], &want[l], 4) == 0, "simplex2_x4(%.9g, %.9g) is %.9g, not %.9g",
+                  xs[l], ys[l], x4[l], want[l]);
+            CHECK(memcmp(&x8[l], &want[l], 4) == 0, "simplex2_x8(%.9g, %.9g) is %.9g, not %.9g",
+                  xs[l], ys[l], x8[l], want[l]);
+        }
+    }
+
+    /* and any count, the leftovers being done one at a time */
+    for (int count = 0; count < 40; count++) {
+        f32 xs[40], ys[40], out[40];
+        for (int l = 0; l < count; l++) {
+            Vec2 p = test_noise_point();
+            xs[l] = p.x, ys[l] = p.y;
+        }
+        simplex2_many(xs, ys, out, count);
+        for (int l = 0; l < count; l++) {
+            f32 want = simplex2(vec2(xs[l], ys[l]));
+            CHECK(memcmp(&out[l], &want, 4) == 0, "simplex2_many of %d, point %d is %.9g, not %.9g",
+                  count, l, out[l], want);
+        }
+    }
+}
+
+/* a row of points across the map, as mapgen does them */
+#define TEST_NOISE_ROW 4096
+
+void bench_simplex(void) {
+    seed_simplex();
+    static f32 xs[TEST_NOISE_ROW], ys[TEST_NOISE_ROW], out[TEST_NOISE_ROW];
+    for (int l = 0; l < TEST_NOISE_ROW; l++)
+        xs[l] = randf() * 100.0f, ys[l] = randf() * 100.0f;
+
+    const char *names[] = { "simplex2", "simplex2_x4", "simplex2_x8", "simplex2_many" };
+    for (int which = 0; which < LEN(names); which++) {
+        uint64_t points = 0;
+        double start = test_seconds(), secs;
+        do {
+            switch (which) {
+            case (0):
+                for (int l = 0; l < TEST_NOISE_ROW; l++) out[l] = simplex2(vec2(xs[l], ys[l]));
+                break;
+            case (1):
+                for (int l = 0; l < TEST_NOISE_ROW; l += 4) simplex2_x4(xs + l, ys + l, out + l);
+                break;
+            case (2):
+                for (int l = 0; l < TEST_NOISE_ROW; l += 8) simplex2_x8(xs + l, ys + l, out + l);
+                break;
+            default:
+                simplex2_many(xs, ys, out, TEST_NOISE_ROW);
+            }
+            points += TEST_NOISE_ROW;
+        } while ((secs = test_seconds() - start) < TEST_BENCH_SECONDS);
+        test_sink += out[TEST_NOISE_ROW - 1];
+        printf("  %-14s %8.1f Mpoints/s\n", names[which], points / secs / 1e6);
+    }
+    printf("  (simplex2_many is %d wide here)\n", SIMPLEX2_LANES);
+}
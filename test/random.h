@@ -0,0 +1,42 @@
+/* random values of each basic type for test/ to round trip,
+   which the generated structs' random_ and eq_ in formpack_random.h
+   are made of. numbers come in every magnitude, not just the huge ones */
+
+INLINE u64 random_u64(Scratch *s) {
+    (void) s;
+    u64 x = (u64) rand_u32() << 32 | rand_u32();
+    return x >> (rand_u32() % 64);
+}
+INLINE u32 random_u32(Scratch *s) { return (u32) (random_u64(s) >> 32); }
+INLINE i32 random_i32(Scratch *s) { return (i32) random_u32(s); }
+INLINE uint16_t random_uint16_t(Scratch *s) { return (uint16_t) random_u32(s); }
+INLINE bool random_bool(Scratch *s) { (void) s; return rand_u32() & 1; }
+/* any bits at all, NaNs included */
+INLINE f32 random_f32(Scratch *s) {
+    u32 bits = rand_u32();
+    f32 x;
+    (void) s;
+    memcpy(&x, &bits, 4);
+    return x;
+}
+INLINE String random_string(Scratch *s) {
+    String str = { .len = (uint8_t) (rand_u32() % 8 ? rand_u32() % 24 : rand_u32()) };
+    str.str = scratch_alloc(s, str.len + 1);
+    for (int i = 0; i < str.len; i++) str.str[i] = (char) rand_u32();
+    return str;
+}
+/* often one that's been sent before, sometimes too long to be interned */
+INLINE String random_istring(Scratch *s) {
+    static char *common[] = { "", "bob", "the_dragon_slayer", "someone_with_a_name_too_long_to_intern" };
+    if (rand_u32() % 2) return random_string(s);
+    return string_from_nulterm(common[rand_u32() % LEN(common)]);
+}
+
+INLINE bool eq_u64(u64 *a, u64 *b) { return *a == *b; }
+INLINE bool eq_u32(u32 *a, u32 *b) { return *a == *b; }
+INLINE bool eq_i32(i32 *a, i32 *b) { return *a == *b; }
+INLINE bool eq_uint16_t(uint16_t *a, uint16_t *b) { return *a == *b; }
+INLINE bool eq_bool(bool *a, bool *b) { return *a == *b; }
+INLINE bool eq_f32(f32 *a, f32 *b) { return memcmp(a, b, 4) == 0; }
+INLINE bool eq_string(String *a, String *b) { return string_eq(a, b); }
+INLINE bool eq_istring(String *a, String *b) { return string_eq(a, b); }
@@ -0,0 +1,161 @@
+/* scrypt against RFC 7914's test vectors, the hash pool's queue limit,
+   and how many logins a second hashing on 1..N workers manages */
+
+/* `hex` as bytes into `out`, returns how many */
+int test_unhex(const char *hex, uint8_t *out) {
+    int len = 0;
+    for (; hex[0] && hex[1]; hex += 2) {
+        unsigned byte;
+        sscanf(hex, "%2x", &byte);
+        out[len++] = (uint8_t) byte;
+    }
+    return len;
+}
+
+void test_scrypt_vectors(void) {
+    uint8_t want[64], got[64];
+    struct {
+        const char *pass, *salt;
+        int log_n, r, p;
+        const char *hex;
+    } vectors[] = {
+        { "", "", 4, 1, 1,
+          "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442"
+          "fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906" },
+        { "password", "NaCl", 10, 8, 16,
+          "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+          "2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640" },
+    };
+    for (int i = 0; i < LEN(vectors); i++) {
+        int len = test_unhex(vectors[i].hex, want);
+        bool ok = scrypt((const uint8_t *) vectors[i].pass, strlen(vectors[i].pass),
+                         (const uint8_t *) vectors[i].salt, strlen(vectors[i].salt),
+                         vectors[i].log_n, vectors[i].r, vectors[i].p, got, len);
+        CHECK(ok && memcmp(got, want, len) == 0, "scrypt(\"%s\", \"%s\", N=%d) is wrong",
+              vectors[i].pass, vectors[i].salt, 1 << vectors[i].log_n);
+    }
+
+    /* and the PBKDF2 underneath, RFC 7914 section 11 */
+    int len = test_unhex("55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+                         "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783", want);
+    scrypt_pbkdf2_sha256((const uint8_t *) "passwd", 6, (const uint8_t *) "salt", 4, 1, got, len);
+    CHECK(memcmp(got, want, len) == 0, "PBKDF2-HMAC-SHA256(\"passwd\", \"salt\", 1) is wrong");
+
+    got[len - 1] ^= 1;
+    CHECK(scrypt_equal(want, want, len) && !scrypt_equal(want, got, len),
+          "scrypt_equal got it wrong");
+}
+
+/* a job that holds up its worker until it's let go */
+typedef struct {
+    Mutex lock;
+    Cond cond;
+    int started, finished;
+    bool go;
+} _test_Gate;
+
+void _test_gate_job(void *arg) {
+    _test_Gate *g = arg;
+    mutex_lock(&g->lock);
+    g->started++;
+    cond_broadcast(&g->cond);
+    while (!g->go) cond_wait(&g->cond, &g->lock);
+    g->finished++;
+    cond_broadcast(&g->cond);
+    mutex_unlock(&g->lock);
+}
+
+/* a login storm fills the hash pool's queue and no more, the rest are
+   turned away straight off rather than piling up, as _srv_send_busy expects */
+void test_hash_queue_limit(void) {
+    static workers_Pool pool; /* it can't be stopped, so it outlives the test */
+    static _test_Gate gate;
+    if (!workers_start(&pool, 1, 4)) {
+        CHECK(false, "couldn't start a worker");
+        return;
+    }
+    mutex_init(&gate.lock);
+    cond_init(&gate.cond);
+
+    /* the worker's busy, so everything after this waits in the queue */
+    workers_submit(&pool, _test_gate_job, &gate);
+    mutex_lock(&gate.lock);
+    while (gate.started == 0) cond_wait(&gate.cond, &gate.lock);
+    mutex_unlock(&gate.lock);
+
+    int accepted = 0;
+    for (int i = 0; i < 10; i++) accepted += workers_submit(&pool, _test_gate_job, &gate);
+    CHECK(accepted == 4, "a pool with room for 4 queued took %d", accepted);
+    CHECK(workers_queued(&pool) == 4, "%d jobs queued, not 4", workers_queued(&pool));
+
+    mutex_lock(&gate.lock);
+    gate.go = true;
+    cond_broadcast(&gate.cond);
+    while (gate.finished < 1 + accepted) cond_wait(&gate.cond, &gate.lock);
+    mutex_unlock(&gate.lock);
+    CHECK(workers_submit(&pool, _test_gate_job, &gate), "the drained pool turned a job away");
+}
+
+/* as the server hashes new passwords by default */
+#define TEST_HASH_COST 14
+#define TEST_SCRYPT_R 8
+#define TEST_HASH_QUEUE 256
+#define TEST_STORM 10000
+
+void _test_hash_job(void *arg) {
+    uint8_t out[32];
+    scrypt((const uint8_t *) "hunter2", 7, (const uint8_t *) "0123456789abcdef", 16,
+           TEST_HASH_COST, TEST_SCRYPT_R, 1, out, sizeof(out));
+    _test_gate_job(arg);
+}
+
+void bench_scrypt(void) {
+    uint8_t want[32], got[32];
+    test_unhex("a84c7deddb70b3d9f7b8233a571e6e722a03466fd864c2fa2ff39ec82654646f", want);
+    double start = test_seconds();
+    scrypt((const uint8_t *) "hunter2", 7, (const uint8_t *) "0123456789abcdef", 16,
+           TEST_HASH_COST, TEST_SCRYPT_R, 1, got, sizeof(got));
+    printf("  one hash, N=2^%d r=%d, %8.1f ms%s\n", TEST_HASH_COST, TEST_SCRYPT_R,
+           (test_seconds() - start) * 1e3, memcmp(got, want, 32) ? " (WRONG)" : "");
+
+    int cores = thread_core_count();
+    for (int threads = 1;; threads = min(threads * 2, cores)) {
+        _test_Gate gate = { .go = true };
+        mutex_init(&gate.lock);
+        cond_init(&gate.cond);
+        int jobs = threads * 4;
+        workers_Pool *pool = test_pool(threads);
+        start = test_seconds();
+        for (int i = 0; i < jobs; i++) workers_submit(pool, _test_hash_job, &gate);
+        mutex_lock(&gate.lock);
+        while (gate.finished < jobs) cond_wait(&gate.cond, &gate.lock);
+        mutex_unlock(&gate.lock);
+        double secs = test_seconds() - start;
+        printf("  %2d workers %8.1f logins/s, %6.1f a core\n",
+               threads, jobs / secs, jobs / secs / threads);
+        mutex_free(&gate.lock);
+        cond_free(&gate.cond);
+        if (threads == cores) break;
+    }
+
+    /* a storm against a busy pool with the server's default queue limit.
+       what matters is that the shard handing them over is never held up */
+    static workers_Pool pool;
+    static _test_Gate gate;
+    mutex_init(&gate.lock);
+    cond_init(&gate.cond);
+    workers_start(&pool, 1, TEST_HASH_QUEUE);
+    int accepted = 0;
+    double slowest = 0.0;
+    for (int i = 0; i < TEST_STORM; i++) {
+        start = test_seconds();
+        accepted += workers_submit(&pool, _test_gate_job, &gate);
+        slowest = fmax(slowest, test_seconds() - start);
+    }
+    printf("  a storm of %d logins, queue of %d: %d taken, %d turned away, slowest %.1f us\n",
+           TEST_STORM, TEST_HASH_QUEUE, accepted, TEST_STORM - accepted, slowest * 1e6);
+    mutex_lock(&gate.lock);
+    gate.go = true;
+    cond_broadcast(&gate.cond);
+    mutex_unlock(&gate.lock);
+}
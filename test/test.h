@@ -0,0 +1,143 @@
+/* what the checks and benchmarks in test/ are written with */
+
+/* failures in the check being run. the first few are printed, there's no
+   stopping at one, as what else fails is often a clue to why */
+static int test_failures;
+#define TEST_MAX_PRINTED 8
+#define CHECK(cond, ...) do {                                     \
+    if (!(cond) && test_failures++ < TEST_MAX_PRINTED) {          \
+        printf("  %s:%d: ", __FILE__, __LINE__);                  \
+        printf(__VA_ARGS__);                                      \
+        printf("\n");                                             \
+    }                                                             \
+} while (false)
+
+/* how long each benchmark keeps at something to time it */
+#define TEST_BENCH_SECONDS 0.25
+
+/* what benchmarks add their results to, so they aren't optimized away */
+static volatile double test_sink;
+
+/* monotonic seconds, only useful for measuring intervals */
+double test_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    return (double) now.QuadPart / (double) freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* a buffer that ends right where a page that can't be touched starts,
+   so that reading even a byte past what's put in it crashes there and then,
+   sanitizer or not */
+typedef struct {
+    uint8_t *end;
+    size_t cap;
+} test_Guard;
+
+void test_guard_init(test_Guard *g, size_t cap) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    size_t page = info.dwPageSize;
+    cap = (cap + page - 1) / page * page;
+    uint8_t *mem = VirtualAlloc(NULL, cap + page, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    DWORD old;
+    if (mem == NULL || !VirtualProtect(mem + cap, page, PAGE_NOACCESS, &old)) abort();
+#else
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    cap = (cap + page - 1) / page * page;
+    uint8_t *mem = mmap(NULL, cap + page, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED || mprotect(mem + cap, page, PROT_NONE) != 0) abort();
+#endif
+    *g = (test_Guard) { .end = mem + cap, .cap = cap };
+}
+
+/* copies `len` bytes in up against the guard page, returns where they start */
+uint8_t *test_guard_put(test_Guard *g, void *data, size_t len) {
+    if (len > g->cap) abort();
+    uint8_t *at = g->end - len;
+    memmove(at, data, len);
+    return at;
+}
+
+/* a uniformly random number below `n` */
+INLINE u32 test_rand_below(u32 n) {
+    return (u32) (((u64) rand_u32() * n) >> 32);
+}
+
+/* a pool of `threads` workers, or NULL for none. pools can't be stopped,
+   so each size is started the first time it's asked for and kept */
+#define TEST_MAX_THREADS 16
+workers_Pool *test_pool(int threads) {
+    static workers_Pool pools[TEST_MAX_THREADS + 1];
+    threads = min(threads, TEST_MAX_THREADS);
+    if (threads <= 0) return NULL;
+    if (pools[threads].thread_count == 0) workers_start(&pools[threads], threads, 0);
+    return &pools[threads];
+}
+
+void test_sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/* the p'th percentile of `count` samples, sorting them */
+int _test_cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+double test_percentile(double *samples, int count, double p) {
+    qsort(samples, count, sizeof(double), _test_cmp_double);
+    return samples[min(count - 1, (int) (count * p / 100.0))];
+}
+
+/* makes a new, empty directory to work in, returns false if it can't */
+bool test_temp_dir(char *path, size_t cap) {
+#ifdef _WIN32
+    char base[MAX_PATH];
+    GetTempPathA(sizeof(base), base);
+    snprintf(path, cap, "%sgame_test_%lu_%u", base, GetCurrentProcessId(), rand_u32());
+    return CreateDirectoryA(path, NULL);
+#else
+    snprintf(path, cap, "/tmp/game_test_XXXXXX");
+    return mkdtemp(path) != NULL;
+#endif
+}
+
+/* removes a directory from test_temp_dir, and the files in it */
+void test_remove_dir(const char *dir) {
+    char path[512];
+#ifdef _WIN32
+    snprintf(path, sizeof(path), "%s/*", dir);
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(path, &entry);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            snprintf(path, sizeof(path), "%s/%s", dir, entry.cFileName);
+            DeleteFileA(path);
+        } while (FindNextFileA(find, &entry));
+        FindClose(find);
+    }
+    RemoveDirectoryA(dir);
+#else
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    while (d && (entry = readdir(d)) != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    if (d) closedir(d);
+    rmdir(dir);
+#endif
+}
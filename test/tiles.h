@@ -0,0 +1,236 @@
+/* the client's ground chunks, run headless: chunks next to each other
+   meet without a seam, and the ones let go of are those wanted longest ago.
+   what the client draws with is stood in for here, and images are kept
+   in memory rather than uploaded so they can be looked at */
+
+typedef struct { uint32_t id; } sg_image;
+typedef struct { sg_image src; } SubImg;
+typedef enum { Shape_GroundPlane } Shape;
+typedef enum { EntProp_Active } EntProp;
+typedef struct {
+    Shape shape;
+    Vec3 pos, scale;
+    SubImg img;
+    sg_image height_img;
+} Ent;
+
+#define TEST_TILES_IMAGES 4096
+static struct {
+    Ent ents[TEST_TILES_IMAGES / 2];
+    int ent_count;
+    u8 *images[TEST_TILES_IMAGES]; /* by id, NULL once destroyed */
+    int image_count, live_images;
+} _test_tiles;
+
+Ent *add_ent(void) {
+    Ent *e = &_test_tiles.ents[_test_tiles.ent_count++ % LEN(_test_tiles.ents)];
+    *e = (Ent) { 0 };
+    return e;
+}
+bool take_ent_prop(Ent *e, EntProp prop) { (void) e, (void) prop; return true; }
+SubImg full_sub_img(sg_image img) { return (SubImg) { .src = img }; }
+sg_image _test_tiles_keep(uint8_t *img, size_t bytes) {
+    uint32_t id = 1 + _test_tiles.image_count++ % (TEST_TILES_IMAGES - 1);
+    free(_test_tiles.images[id]);
+    _test_tiles.images[id] = malloc(bytes);
+    memcpy(_test_tiles.images[id], img, bytes);
+    _test_tiles.live_images++;
+    return (sg_image) { id };
+}
+sg_image rendr_make_mapgen_img(uint8_t *img, int size) { return _test_tiles_keep(img, size * size * 4); }
+sg_image rendr_make_height_img(uint8_t *img, int size) { return _test_tiles_keep(img, size * size); }
+void sg_destroy_image(sg_image img) {
+    CHECK(_test_tiles.images[img.id] != NULL, "image %u destroyed twice", img.id);
+    free(_test_tiles.images[img.id]);
+    _test_tiles.images[img.id] = NULL;
+    _test_tiles.live_images--;
+}
+
+#include "../client/tiles.h"
+
+/* frames at `cam` until every chunk around it is uploaded, up to `max_frames` */
+int _test_tiles_settle(Vec3 cam, int max_frames) {
+    for (int frame = 0; frame < max_frames; frame++) {
+        tiles_frame(cam);
+        int uploaded = 0;
+        int cam_x = (int) floorf(cam.x / TILES_CHUNK_SIZE), cam_z = (int) floorf(cam.z / TILES_CHUNK_SIZE);
+        for (int dz = -TILES_RADIUS; dz <= TILES_RADIUS; dz++)
+        for (int dx = -TILES_RADIUS; dx <= TILES_RADIUS; dx++) {
+            Chunk *c = _tiles_find(cam_x + dx, cam_z + dz);
+            uploaded += c && tiles.seen[c - tiles.chunks] == Chunk_Uploaded;
+        }
+        if (uploaded == (TILES_RADIUS * 2 + 1) * (TILES_RADIUS * 2 + 1)) return frame + 1;
+        if (tiles.workers && tiles.workers->thread_count) test_sleep_ms(1);
+    }
+    return -1;
+}
+
+/* starts over with nothing generated, generating on `workers` */
+void _test_tiles_start(workers_Pool *workers) {
+    static bool started;
+    if (!started) tiles_init(workers);
+    started = true;
+
+    /* whatever's on the workers finishes first */
+    for (int busy = 1; busy && tiles.workers && tiles.workers->thread_count; ) {
+        test_sleep_ms(1);
+        mutex_lock(&tiles.lock);
+        busy = 0;
+        for (int i = 0; i < TILES_MAX_CHUNKS; i++) busy += tiles.chunks[i].state == Chunk_Generating;
+        mutex_unlock(&tiles.lock);
+    }
+    for (int i = 0; i < TILES_MAX_CHUNKS; i++) tiles.seen[i] = tiles.chunks[i].state;
+    tiles.frame++;
+    while (_tiles_evict());
+    for (int i = 0; i < TILES_MAX_CHUNKS; i++) {
+        Chunk *c = &tiles.chunks[i];
+        if (c->state != Chunk_Free) free(c->pixels), free(c->heights);
+        c->state = tiles.seen[i] = Chunk_Free;
+    }
+    tiles.workers = workers;
+}
+
+/* the pixels or heights a chunk was uploaded with */
+u8 *_test_tiles_image(int x, int z, bool heights) {
+    Chunk *c = _tiles_find(x, z);
+    if (!c || tiles.seen[c - tiles.chunks] != Chunk_Uploaded) return NULL;
+    return _test_tiles.images[heights ? c->ent->height_img.id : c->ent->img.src.id];
+}
+
+/* the ground around a chunk on the coast, as one image */
+#define TEST_TILES_AROUND 2
+void _test_tiles_around(Vec3 cam, u8 *img, u8 *heights) {
+    int n = TILES_CHUNK_PIXELS * TEST_TILES_AROUND, size = n + TILES_APRON * 2;
+    f32 pixel = TILES_CHUNK_SIZE / TILES_CHUNK_PIXELS;
+    int cam_x = (int) floorf(cam.x / TILES_CHUNK_SIZE), cam_z = (int) floorf(cam.z / TILES_CHUNK_SIZE);
+    Vec2 corner = vec2(cam_x * TILES_CHUNK_SIZE - TILES_APRON * pixel,
+                       (cam_z + TEST_TILES_AROUND) * TILES_CHUNK_SIZE + TILES_APRON * pixel);
+    u8 *whole = malloc(size * size * 4), *whole_heights = malloc(size * size);
+    mapgen_ground_img(whole, size, &(mapgen_GroundOpts) {
+        .tile_corner = tiles_map_pos(corner),
+        .tile_size = size * pixel / TILES_MAP_SIZE,
+        .height_map = whole_heights,
+    });
+    for (int y = 0; y < n + 1; y++)
+    for (int x = 0; x < n + 1; x++) {
+        int from = (y + TILES_APRON) * size + x + TILES_APRON;
+        heights[y * (n + 1) + x] = whole_heights[from];
+        if (x < n && y < n) memcpy(img + (y * n + x) * 4, whole + from * 4, 4);
+    }
+    free(whole), free(whole_heights);
+}
+
+void test_tiles_seams(void) {
+    seed_simplex();
+    mapgen_GroundOpts coast = test_ground(1);
+    Vec2 at = add2f(coast.tile_corner, coast.tile_size / 2);
+    Vec3 cam = vec3((at.x - 0.5f) * TILES_MAP_SIZE, 0.0f, (0.5f - at.y) * TILES_MAP_SIZE);
+    int cam_x = (int) floorf(cam.x / TILES_CHUNK_SIZE), cam_z = (int) floorf(cam.z / TILES_CHUNK_SIZE);
+
+    int n = TILES_CHUNK_PIXELS, around = n * TEST_TILES_AROUND;
+    u8 *want = malloc(around * around * 4), *want_heights = malloc((around + 1) * (around + 1));
+    _test_tiles_around(cam, want, want_heights);
+
+    for (int threads = 0; threads <= 2; threads += 2) {
+        _test_tiles_start(test_pool(threads));
+        int frames = _test_tiles_settle(cam, 5000);
+        CHECK(frames > 0, "with %d workers, the chunks around the camera never all came", threads);
+        /* no workers, so a block a frame */
+        if (threads == 0) CHECK(frames >= 25 * TILES_BLOCKS * TILES_BLOCKS, "took only %d frames", frames);
+
+        long off_pixels = 0, off_heights = 0, worst = 0;
+        for (int cz = 0; cz < TEST_TILES_AROUND; cz++)
+        for (int cx = 0; cx < TEST_TILES_AROUND; cx++) {
+            u8 *img = _test_tiles_image(cam_x + cx, cam_z + cz, false);
+            u8 *heights = _test_tiles_image(cam_x + cx, cam_z + cz, true);
+            if (!img || !heights) continue;
+            /* chunks further north are further up the image */
+            int ox = cx * n, oy = (TEST_TILES_AROUND - 1 - cz) * n;
+            for (int y = 0; y < n + 1; y++)
+            for (int x = 0; x < n + 1; x++) {
+                off_heights += heights[y * (n + 1) + x] != want_heights[(oy + y) * (around + 1) + ox + x];
+                if (x == n || y == n) continue;
+                for (int ch = 0; ch < 3; ch++) {
+                    int d = abs(img[(y * n + x) * 4 + ch] - want[((oy + y) * around + ox + x) * 4 + ch]);
+                    worst = max(worst, d);
+                    off_pixels += d > 2;
+                }
+            }
+        }
+        /* where chunks meet, they share a row or column of heights */
+        long edge_off = 0, edges = 0;
+        for (int cz = -TILES_RADIUS; cz <= TILES_RADIUS; cz++)
+        for (int cx = -TILES_RADIUS; cx <= TILES_RADIUS; cx++) {
+            u8 *heights = _test_tiles_image(cam_x + cx, cam_z + cz, true);
+            u8 *east = _test_tiles_image(cam_x + cx + 1, cam_z + cz, true);
+            u8 *north = _test_tiles_image(cam_x + cx, cam_z + cz + 1, true);
+            for (int i = 0; heights && i < n + 1; i++) {
+                if (cx < TILES_RADIUS && east) edge_off += heights[i * (n + 1) + n] != east[i * (n + 1)], edges++;
+                if (cz < TILES_RADIUS && north) edge_off += heights[i] != north[n * (n + 1) + i], edges++;
+            }
+        }
+
+        /* the odd pixel comes out a little different, as chunks and blocks are
+           worked out from their own corners, and a float can round either way */
+        long pixels = (long) around * around;
+        CHECK(edges == 40 * (n + 1) && edge_off <= edges / 1000,
+              "with %d workers, %ld of %ld heights where chunks meet differ", threads, edge_off, edges);
+        CHECK(worst <= 8 && off_pixels <= pixels * 3 / 1000 && off_heights <= pixels / 1000,
+              "with %d workers, %ld channels and %ld heights differ from the ground made whole, by up to %ld",
+              threads, off_pixels, off_heights, worst);
+    }
+    free(want), free(want_heights);
+}
+
+/* walking away, the chunks let go of are those wanted longest ago, never
+   any near the camera, and the ground stays within its budget */
+void test_tiles_lru(void) {
+    seed_simplex();
+    _test_tiles_start(test_pool(2));
+    int evicted = 0;
+    for (int step = 0; step < 40; step++) {
+        /* east for a while, then back again past where it started */
+        int chunk_x = step < 25 ? step : 50 - step * 2 + 25;
+        Vec3 cam = vec3((chunk_x + 0.5f) * TILES_CHUNK_SIZE, 0.0f, 0.5f * TILES_CHUNK_SIZE);
+        for (int frame = 0; frame < 2000; frame++) {
+            Chunk before[TILES_MAX_CHUNKS];
+            ChunkState seen[TILES_MAX_CHUNKS];
+            mutex_lock(&tiles.lock); /* workers write the states */
+            memcpy(before, tiles.chunks, sizeof(before));
+            mutex_unlock(&tiles.lock);
+            memcpy(seen, tiles.seen, sizeof(seen));
+            tiles_frame(cam);
+
+            int uploaded = 0, wanted = 0;
+            for (int i = 0; i < TILES_MAX_CHUNKS; i++) {
+                Chunk *c = &tiles.chunks[i];
+                bool up = tiles.seen[i] == Chunk_Uploaded;
+                uploaded += up;
+                wanted += up && max(abs(c->x - chunk_x), abs(c->z)) <= TILES_RADIUS;
+                if (seen[i] != Chunk_Uploaded || (up && c->x == before[i].x && c->z == before[i].z)) continue;
+
+                evicted++;
+                int dist = max(abs(before[i].x - chunk_x), abs(before[i].z));
+                CHECK(dist > TILES_RADIUS, "chunk %d,%d was let go of %d from the camera",
+                      before[i].x, before[i].z, dist);
+                for (int j = 0; j < TILES_MAX_CHUNKS; j++) {
+                    Chunk *s = &tiles.chunks[j];
+                    if (tiles.seen[j] != Chunk_Uploaded || seen[j] != Chunk_Uploaded ||
+                        s->last_wanted == tiles.frame) continue;
+                    CHECK(before[i].last_wanted <= s->last_wanted,
+                          "chunk %d,%d, wanted on frame %llu, was let go of before %d,%d, wanted on %llu",
+                          before[i].x, before[i].z, (unsigned long long) before[i].last_wanted,
+                          s->x, s->z, (unsigned long long) s->last_wanted);
+                }
+            }
+            CHECK(tiles.gpu_bytes <= TILES_GPU_BUDGET && tiles.gpu_bytes == uploaded * _tiles_chunk_bytes(),
+                  "%zu bytes on the gpu for %d chunks", tiles.gpu_bytes, uploaded);
+            CHECK(_test_tiles.live_images == uploaded * 2, "%d images for %d chunks",
+                  _test_tiles.live_images, uploaded);
+            if (test_failures) return;
+            if (wanted == (TILES_RADIUS * 2 + 1) * (TILES_RADIUS * 2 + 1)) break;
+            test_sleep_ms(1);
+        }
+    }
+    CHECK(evicted > 100, "only %d chunks were let go of", evicted);
+}